@@ -0,0 +1,164 @@
+#include "arena.h"
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+struct ArenaBlock {
+    ArenaBlock * previous;
+    size_t size; // bytes, this header included
+    size_t used;
+    bool regular; // false for a block cut to fit one big allocation
+};
+
+//the header is padded to the alignment, so a block's first allocation is aligned like the rest
+#define ARENA_HEADER_BYTES ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)
+
+static inline size_t alignSize (size_t bytes) {
+    return (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+static ArenaBlock * allocateArenaBlock (size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc (NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void * block = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return block == MAP_FAILED ? NULL : block;
+#endif
+}
+
+static void releaseArenaBlock (ArenaBlock * block) {
+#ifdef _WIN32
+    VirtualFree (block, 0, MEM_RELEASE);
+#else
+    munmap (block, block->size);
+#endif
+}
+
+// hands back the whole pages in [from, to) of a block; they read as zero if used again
+static void releaseArenaPages (ArenaBlock * block, size_t from, size_t to) {
+#ifdef _WIN32
+    size_t pageSize = 4096;
+#else
+    size_t pageSize = (size_t) sysconf (_SC_PAGESIZE);
+#endif
+    from = (from + pageSize - 1) / pageSize * pageSize;
+    to = to / pageSize * pageSize;
+    if (to <= from) return;
+#ifdef _WIN32
+    VirtualAlloc ((char *) block + from, to - from, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise ((char *) block + from, to - from, MADV_DONTNEED);
+#endif
+}
+
+// a regular block is held whole, since later allocations fill it; a block of its own only up to its end
+static inline size_t getHeldBytes (const ArenaBlock * block) {
+    return block->regular ? block->size : block->used;
+}
+
+void initArena (Arena * arena) {
+    memset (arena, 0, sizeof(Arena));
+}
+
+void freeArena (Arena * arena) {
+    ArenaBlock * block = arena->blocks;
+    while (block) {
+        ArenaBlock * previous = block->previous;
+        releaseArenaBlock (block);
+        block = previous;
+    }
+    if (arena->spare) releaseArenaBlock (arena->spare);
+    //the counts and the peak describe what the arena was used for, so they outlive its memory
+    MemoryUsage usage = arena->usage;
+    size_t peakHeldBytes = arena->peakHeldBytes;
+    initArena (arena);
+    arena->usage = usage;
+    arena->peakHeldBytes = peakHeldBytes;
+}
+
+void * arenaAlloc (Arena * arena, MemorySubsystem subsystem, size_t bytes) {
+    size_t size = alignSize (bytes > 0 ? bytes : 1);
+    ArenaBlock * block = arena->current;
+    if (block == NULL || block->size - block->used < size) {
+        //a big allocation gets its own block and leaves the current one to the small ones after it
+        bool regular = ARENA_HEADER_BYTES + size <= ARENA_BLOCK_BYTES / 4;
+        size_t blockSize = regular ? ARENA_BLOCK_BYTES : ARENA_HEADER_BYTES + size;
+        if (regular && arena->spare) {
+            block = arena->spare;
+            arena->spare = NULL;
+        } else {
+            block = allocateArenaBlock (blockSize);
+            if (block == NULL) return NULL;
+        }
+        block->previous = arena->blocks;
+        block->size = blockSize;
+        block->used = ARENA_HEADER_BYTES;
+        block->regular = regular;
+        arena->blocks = block;
+        arena->numBlocks ++;
+        arena->heldBytes += getHeldBytes (block);
+        if (regular) arena->current = block;
+    }
+
+    void * pointer = (char *) block + block->used;
+    arena->heldBytes -= getHeldBytes (block);
+    block->used += size;
+    arena->heldBytes += getHeldBytes (block);
+    if (arena->heldBytes > arena->peakHeldBytes) arena->peakHeldBytes = arena->heldBytes;
+    arena->last = pointer;
+    arena->lastBlock = block;
+    arena->usage.allocations[subsystem] ++;
+    arena->usage.bytes[subsystem] += bytes;
+    return pointer;
+}
+
+void * arenaResize (Arena * arena, MemorySubsystem subsystem, void * pointer, size_t oldBytes, size_t newBytes) {
+    if (pointer == NULL) return arenaAlloc (arena, subsystem, newBytes);
+
+    if (pointer == arena->last) {
+        ArenaBlock * block = arena->lastBlock;
+        size_t offset = (char *) pointer - (char *) block;
+        size_t size = alignSize (newBytes > 0 ? newBytes : 1);
+        if (offset + size <= block->size) {
+            size_t end = block->used;
+            arena->heldBytes -= getHeldBytes (block);
+            block->used = offset + size;
+            arena->heldBytes += getHeldBytes (block);
+            if (arena->heldBytes > arena->peakHeldBytes) arena->peakHeldBytes = arena->heldBytes;
+            if (block->used < end) releaseArenaPages (block, block->used, end);
+            arena->usage.bytes[subsystem] = arena->usage.bytes[subsystem] - oldBytes + newBytes;
+            return pointer;
+        }
+    }
+
+    void * moved = arenaAlloc (arena, subsystem, newBytes);
+    if (moved == NULL) return NULL;
+    memcpy (moved, pointer, oldBytes < newBytes ? oldBytes : newBytes);
+    return moved;
+}
+
+ArenaMark getArenaMark (const Arena * arena) {
+    return (ArenaMark){arena->blocks, arena->current, arena->current ? arena->current->used : 0};
+}
+
+void rewindArena (Arena * arena, ArenaMark mark) {
+    while (arena->blocks != mark.blocks) {
+        ArenaBlock * block = arena->blocks;
+        arena->blocks = block->previous;
+        arena->heldBytes -= getHeldBytes (block);
+        arena->numBlocks --;
+        //one regular block is kept back, so a scratch arena rewound after every use doesn't map a block each time
+        if (block->regular && arena->spare == NULL) arena->spare = block;
+        else releaseArenaBlock (block);
+    }
+    arena->current = mark.current;
+    if (arena->current) arena->current->used = mark.used;
+    arena->last = NULL;
+    arena->lastBlock = NULL;
+}
\ No newline at end of file
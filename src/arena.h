@@ -0,0 +1,47 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "memoryStats.h"
+#include <stddef.h>
+
+#define ARENA_BLOCK_BYTES (1 << 20) // size of a regular block; bigger allocations get a block of their own
+#define ARENA_ALIGNMENT 64 // every allocation starts on a cache line
+
+/* a bump allocator. allocations are never freed one by one: an arena is released whole, or rewound to
+ * a mark, which hands every block since then back to the system. blocks come straight from the system,
+ * so a released arena leaves nothing behind in the heap to fragment it */
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock * blocks; // newest first
+    ArenaBlock * current; // the regular block small allocations are cut from
+    void * last; // the newest allocation, the one arenaResize can grow or shrink where it lies
+    ArenaBlock * lastBlock;
+    ArenaBlock * spare; // a regular block a rewind let go of, kept for the next one needed
+    int numBlocks;
+    size_t heldBytes; // from the system: regular blocks whole, blocks of their own up to their end
+    size_t peakHeldBytes;
+    MemoryUsage usage;
+} Arena;
+
+typedef struct {
+    ArenaBlock * blocks;
+    ArenaBlock * current;
+    size_t used;
+} ArenaMark;
+
+void initArena (Arena * arena);
+void freeArena (Arena * arena);
+
+void * arenaAlloc (Arena * arena, MemorySubsystem subsystem, size_t bytes); // NULL when out of memory
+
+// the newest allocation changes size in place when its block has room; anything else moves to a new
+// allocation and its old bytes stay with the arena until it is released. NULL, leaving the old
+// allocation as it was, when out of memory
+void * arenaResize (Arena * arena, MemorySubsystem subsystem, void * pointer, size_t oldBytes, size_t newBytes);
+
+ArenaMark getArenaMark (const Arena * arena);
+void rewindArena (Arena * arena, ArenaMark mark); // drops everything allocated since the mark
+
+#endif
\ No newline at end of file
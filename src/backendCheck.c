@@ -0,0 +1,176 @@
+#include "backendCheck.h"
+#include "sceneLoader.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BACKEND_CHECK_RESOLUTION 64
+#define BACKEND_CHECK_BUDGET 5e7 // brute force primitive tests the startup check may spend
+
+static double traceRaySet (Scene * scene, Ray * rays, int numRays, HitRecord * records, bool * hits) {
+    double start = getTimeSeconds();
+    for (int i = 0; i < numRays; ++ i) {
+        hits[i] = getSceneHit (scene, rays[i], &records[i]);
+    }
+    return getTimeSeconds() - start;
+}
+
+static int countMismatches (HitRecord * reference, bool * referenceHits, HitRecord * candidate, bool * candidateHits, int numRays) {
+    int mismatches = 0;
+    for (int i = 0; i < numRays; ++ i) {
+        if (referenceHits[i] != candidateHits[i]) {
+            mismatches ++;
+        } else if (referenceHits[i]) {
+            double tolerance = 1e-9 * fmax (1.0, reference[i].distance);
+            if (fabs (reference[i].distance - candidate[i].distance) > tolerance ||
+                reference[i].materialId != candidate[i].materialId) {
+                mismatches ++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+bool reportBackendComparison (Scene * scene, Camera * cam, Seed * seed) {
+    //camera rays plus one random secondary ray from every camera hit, so rays starting on surfaces get checked too
+    int numPrimitives = scene->numTriangles + scene->numSpheres;
+    int resolution = (int) sqrt (BACKEND_CHECK_BUDGET / (2.0 * (numPrimitives > 0 ? numPrimitives : 1)));
+    if (resolution > BACKEND_CHECK_RESOLUTION) resolution = BACKEND_CHECK_RESOLUTION;
+    if (resolution < 4) resolution = 4;
+
+    int maxRays = resolution * resolution * 2;
+    Ray * rays = malloc (maxRays * sizeof(Ray));
+    HitRecord * reference = malloc (maxRays * sizeof(HitRecord));
+    HitRecord * candidate = malloc (maxRays * sizeof(HitRecord));
+    bool * referenceHits = malloc (maxRays * sizeof(bool));
+    bool * candidateHits = malloc (maxRays * sizeof(bool));
+
+    IntersectionBackend selected = scene->backend;
+    scene->backend = BACKEND_BRUTE_FORCE;
+
+    int numRays = 0;
+    for (int y = 0; y < resolution; ++ y) {
+        for (int x = 0; x < resolution; ++ x) {
+            double px = (x + randomDouble(seed)) * cam->imageWidth / resolution;
+            double py = (y + randomDouble(seed)) * cam->imageHeight / resolution;
+            Ray cameraRay = getCameraRay (cam, px, py);
+            rays[numRays ++] = cameraRay;
+
+            HitRecord hit;
+            if (getSceneHit (scene, cameraRay, &hit)) {
+                Vector direction = normalizeVector ((Vector){randomDouble(seed) - 0.5, randomDouble(seed) - 0.5, randomDouble(seed) - 0.5});
+                if (dotProduct (direction, hit.normal) < 0) direction = negateVector (direction);
+                rays[numRays ++] = (Ray){movePoint (hit.intersection, scaleVector (hit.normal, RAY_EPSILON)), direction};
+            }
+        }
+    }
+
+    double bruteForceTime = traceRaySet (scene, rays, numRays, reference, referenceHits);
+    double bruteForceRate = numRays / fmax (bruteForceTime, 1e-9);
+
+    //every accelerated backend is checked against brute force and timed on the same rays
+    IntersectionBackend candidates[] = {BACKEND_BVH, BACKEND_WIDE_BVH};
+    int numCandidates = sizeof(candidates) / sizeof(candidates[0]);
+    int mismatches = 0;
+    int occlusionMismatches = 0;
+    double candidateRates[sizeof(candidates) / sizeof(candidates[0])];
+
+    for (int c = 0; c < numCandidates; ++ c) {
+        scene->backend = candidates[c];
+        candidateRates[c] = numRays / fmax (traceRaySet (scene, rays, numRays, candidate, candidateHits), 1e-9);
+
+        mismatches += countMismatches (reference, referenceHits, candidate, candidateHits, numRays);
+    }
+
+    //packets are checked on the same rays; the secondary rays in the set make them less coherent than camera packets
+    scene->backend = BACKEND_BVH;
+    double packetStart = getTimeSeconds();
+    getScenePacketHits (scene, rays, numRays, candidate, candidateHits);
+    double packetRate = numRays / fmax (getTimeSeconds() - packetStart, 1e-9);
+    scene->backend = selected;
+
+    int packetMismatches = countMismatches (reference, referenceHits, candidate, candidateHits, numRays);
+
+    long long nodeVisits = 0;
+    for (int i = 0; i < numRays; ++ i) {
+        nodeVisits += countBVHNodeVisits (scene, rays[i]);
+    }
+
+    //an unbounded any-hit query must agree with the closest hit, and a segment stopping short of it must be clear
+    for (int backend = BACKEND_BRUTE_FORCE; backend <= BACKEND_WIDE_BVH; ++ backend) {
+        scene->backend = backend;
+        for (int i = 0; i < numRays; ++ i) {
+            if (getSceneOcclusion (scene, rays[i], 1e20) != referenceHits[i]) occlusionMismatches ++;
+            if (referenceHits[i] && getSceneOcclusion (scene, rays[i], reference[i].distance * 0.5)) occlusionMismatches ++;
+        }
+    }
+    scene->backend = selected;
+
+    fprintf (stderr, "Backend check: %d/%d rays match brute force (distance and material) across %d backends%s\n",
+             numRays * numCandidates - mismatches, numRays * numCandidates, numCandidates, mismatches ? " - MISMATCH" : "");
+    fprintf (stderr, "Packet check: %d/%d rays match brute force%s\n",
+             numRays - packetMismatches, numRays, packetMismatches ? " - MISMATCH" : "");
+    fprintf (stderr, "Occlusion check: %d mismatches across all backends\n", occlusionMismatches);
+    fprintf (stderr, "  brute: %.0f rays/sec", bruteForceRate);
+    for (int c = 0; c < numCandidates; ++ c) {
+        fprintf (stderr, ", %s: %.0f rays/sec (%.1fx)", getBackendName (candidates[c]), candidateRates[c], candidateRates[c] / bruteForceRate);
+    }
+    fprintf (stderr, ", packets: %.0f rays/sec (%.1fx)", packetRate, packetRate / bruteForceRate);
+    fprintf (stderr, "\n  %.1f binary node visits/ray, rendering with %s\n\n", (double)nodeVisits / numRays, getBackendName (selected));
+
+    free (rays);
+    free (reference);
+    free (candidate);
+    free (referenceHits);
+    free (candidateHits);
+    return mismatches == 0 && packetMismatches == 0 && occlusionMismatches == 0;
+}
+
+static bool sameMaterials (const Material * a, const Material * b, int count) {
+    for (int i = 0; i < count; ++ i) {
+        if (memcmp (&a[i].color, &b[i].color, sizeof(Vector)) != 0 || memcmp (&a[i].emission, &b[i].emission, sizeof(Vector)) != 0 ||
+            a[i].type != b[i].type || a[i].indexOfRefraction != b[i].indexOfRefraction) return false;
+    }
+    return true;
+}
+
+static bool sameSpheres (const Sphere * a, const Sphere * b, int count) {
+    for (int i = 0; i < count; ++ i) {
+        if (memcmp (&a[i].center, &b[i].center, sizeof(Point)) != 0 || a[i].radius != b[i].radius || a[i].materialId != b[i].materialId) return false;
+    }
+    return true;
+}
+
+bool reportSerialBuildComparison (const Scene * scene, const char * objPath, const char * mtlPath) {
+    Scene * serial = initScene();
+    if (!serial) {
+        fprintf (stderr, "Thread check: out of memory\n");
+        return false;
+    }
+    serial->bvhSettings = scene->bvhSettings;
+    serial->bvhSettings.numThreads = 1;
+    serial->lightSampler = scene->lightSampler;
+    if (!loadScene (serial, objPath, mtlPath)) {
+        fprintf (stderr, "Thread check: failed to reload %s\n", objPath);
+        freeScene (serial);
+        return false;
+    }
+
+    //the parallel loader and BVH build promise the serial result exactly, so everything is compared bit for bit
+    bool sameMesh = serial->numVertices == scene->numVertices && serial->numTriangles == scene->numTriangles &&
+                    serial->numSpheres == scene->numSpheres && serial->numMaterials == scene->numMaterials &&
+                    memcmp (serial->vertices, scene->vertices, scene->numVertices * sizeof(Vertex)) == 0 &&
+                    memcmp (serial->triangles, scene->triangles, scene->numTriangles * sizeof(Triangle)) == 0 &&
+                    sameSpheres (serial->spheres, scene->spheres, scene->numSpheres) &&
+                    sameMaterials (serial->materials, scene->materials, scene->numMaterials);
+    bool sameBVH = serial->numBVHNodes == scene->numBVHNodes && serial->numBVHPrimitives == scene->numBVHPrimitives &&
+                   memcmp (serial->bvhNodes, scene->bvhNodes, scene->numBVHNodes * sizeof(BVHNode)) == 0 &&
+                   memcmp (serial->bvhPrimitives, scene->bvhPrimitives, scene->numBVHPrimitives * sizeof(int)) == 0;
+
+    fprintf (stderr, "Thread check: mesh loaded on %d threads %s the one loaded on one, BVH built on %d threads %s the one built on one\n\n",
+             scene->bvhSettings.numThreads, sameMesh ? "matches" : "DIFFERS FROM",
+             scene->bvhSettings.numThreads, sameBVH ? "matches" : "DIFFERS FROM");
+    freeScene (serial);
+    return sameMesh && sameBVH;
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#ifndef BACKEND_CHECK_H
+#define BACKEND_CHECK_H
+
+#include "camera.h"
+#include "rand.h"
+
+// traces a set of camera and secondary rays through every backend and reports agreement and speed; false on any mismatch
+bool reportBackendComparison (Scene * scene, Camera * cam, Seed * seed);
+// reloads the scene and rebuilds its BVH on one thread; false unless both match the scene's exactly
+bool reportSerialBuildComparison (const Scene * scene, const char * objPath, const char * mtlPath);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "blockArray.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// blocks come straight from the system where mmap exists, so freeing one always hands its pages back
+static char * allocateBlock (size_t bytes) {
+#ifdef _WIN32
+    return malloc (bytes);
+#else
+    void * block = mmap (NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return block == MAP_FAILED ? NULL : block;
+#endif
+}
+
+static void releaseBlock (BlockArray * array, int index) {
+#ifdef _WIN32
+    free (array->blocks[index]);
+#else
+    munmap (array->blocks[index], array->blockSizes[index] * array->elementSize);
+#endif
+    array->blocks[index] = NULL;
+}
+
+void initBlockArray (BlockArray * array, size_t elementSize) {
+    memset (array, 0, sizeof(BlockArray));
+    array->elementSize = elementSize;
+    array->blockLength = BLOCK_ARRAY_BYTES / elementSize;
+    if (array->blockLength < 1) array->blockLength = 1;
+}
+
+void freeBlockArray (BlockArray * array) {
+    for (int i = 0; i < array->numBlocks; ++ i) {
+        releaseBlock (array, i);
+    }
+    free (array->blocks);
+    free (array->blockCounts);
+    free (array->blockSizes);
+    initBlockArray (array, array->elementSize);
+}
+
+static bool addBlock (BlockArray * array, size_t length) {
+    if (array->numBlocks == array->blocksCapacity) {
+        int capacity = array->blocksCapacity ? array->blocksCapacity * 2 : 16;
+        char ** blocks = realloc (array->blocks, capacity * sizeof(char *));
+        if (blocks == NULL) return false;
+        array->blocks = blocks;
+        size_t * counts = realloc (array->blockCounts, capacity * sizeof(size_t));
+        if (counts == NULL) return false;
+        array->blockCounts = counts;
+        size_t * sizes = realloc (array->blockSizes, capacity * sizeof(size_t));
+        if (sizes == NULL) return false;
+        array->blockSizes = sizes;
+        array->blocksCapacity = capacity;
+    }
+    char * block = allocateBlock (length * array->elementSize);
+    if (block == NULL) return false;
+    array->blocks[array->numBlocks] = block;
+    array->blockCounts[array->numBlocks] = 0;
+    array->blockSizes[array->numBlocks] = length;
+    array->numBlocks ++;
+    return true;
+}
+
+void * appendBlockElementsToNewBlock (BlockArray * array, size_t count) {
+    if (!addBlock (array, count > array->blockLength ? count : array->blockLength)) return NULL;
+    int last = array->numBlocks - 1;
+    void * elements = array->blocks[last] + array->blockCounts[last] * array->elementSize;
+    array->blockCounts[last] += count;
+    array->count += count;
+    return elements;
+}
+
+void moveBlockArray (BlockArray * array, void * destination) {
+    char * position = destination;
+    for (int i = 0; i < array->numBlocks; ++ i) {
+        memcpy (position, array->blocks[i], array->blockCounts[i] * array->elementSize);
+        position += array->blockCounts[i] * array->elementSize;
+        releaseBlock (array, i);
+    }
+    free (array->blocks);
+    free (array->blockCounts);
+    free (array->blockSizes);
+    initBlockArray (array, array->elementSize);
+}
\ No newline at end of file
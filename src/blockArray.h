@@ -0,0 +1,49 @@
+#ifndef BLOCK_ARRAY_H
+#define BLOCK_ARRAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BLOCK_ARRAY_BYTES (1 << 20) // size of one regular block
+
+/* an array that grows a block at a time. blocks never move, so appending copies nothing, pointers into
+ * the array stay valid, and the peak while growing is the data plus one block rather than twice the data */
+typedef struct {
+    char ** blocks;
+    size_t * blockCounts; // elements used in each block
+    size_t * blockSizes; // elements each block has room for
+    int numBlocks;
+    int blocksCapacity;
+    size_t elementSize;
+    size_t blockLength; // elements per regular block
+    size_t count;
+} BlockArray;
+
+void initBlockArray (BlockArray * array, size_t elementSize);
+void freeBlockArray (BlockArray * array);
+
+void * appendBlockElementsToNewBlock (BlockArray * array, size_t count);
+
+// room for count adjacent elements, NULL when out of memory. a run that doesn't fit the last block starts
+// a new one (sized for the run if it is longer than a block), so only arrays appended one element at a
+// time are indexable with getBlockElement
+static inline void * appendBlockElements (BlockArray * array, size_t count) {
+    int last = array->numBlocks - 1;
+    if (last < 0 || array->blockCounts[last] + count > array->blockSizes[last]) {
+        return appendBlockElementsToNewBlock (array, count);
+    }
+    void * elements = array->blocks[last] + array->blockCounts[last] * array->elementSize;
+    array->blockCounts[last] += count;
+    array->count += count;
+    return elements;
+}
+
+// copies the elements in order to destination, which has room for count of them, freeing each block
+// once it is copied so the two copies are never both whole. the array is left empty
+void moveBlockArray (BlockArray * array, void * destination);
+
+static inline void * getBlockElement (const BlockArray * array, size_t index) {
+    return array->blocks[index / array->blockLength] + (index % array->blockLength) * array->elementSize;
+}
+
+#endif
\ No newline at end of file
@@ -1,6 +1,62 @@
 #include <math.h>
 #include "bvh.h"
+#include "timer.h"
+#include "threadPool.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define MAX_SAH_BINS 64
+
+typedef struct {
+    BoundingBox bounds;
+    int count;
+} SAHBin;
+
+typedef struct {
+    BVHObject * objects;
+    BVHNode * nodes;
+    int numNodes;
+    const BVHBuildSettings * settings;
+    Arena * scratch; // this builder's alone, so a forked subtree has its own on its thread
+    bool failed; // out of memory somewhere below; the nodes are incomplete
+} BVHBuilder;
+
+typedef struct {
+    BVHBuilder builder;
+    Arena scratch;
+    int start;
+    int end;
+    int depth;
+    int threads;
+} SubtreeTask;
+
+typedef struct {
+    BoundingBox bounds;
+    BoundingBox centroidBounds;
+} RangeBounds;
+
+typedef struct {
+    bool enabled[3];
+    double low[3];
+    double scale[3];
+    int numBins;
+} BinSetup;
+
+typedef struct {
+    SAHBin bins[3][MAX_SAH_BINS];
+} AxisBins;
+
+typedef struct {
+    const BVHObject * objects;
+    int start;
+    int count;
+    int numChunks;
+    const BinSetup * setup;
+    RangeBounds * boundsResults;
+    AxisBins * binResults;
+} RangeJob;
 
 static inline double minDouble (double a, double b) {
     return (a < b ? a : b);
@@ -10,31 +66,34 @@ static inline double maxDouble (double a, double b) {
     return (a > b ? a : b);
 }
 
-static BVHObject createBVHObject (void * data, GeometryType type, int index) {
+static BVHObject createBVHObject (const Scene * scene, GeometryType type, int index) {
     BVHObject newObject;
     newObject.type = type;        
     newObject.index = index;
 
     if (type == TRIANGLE) {
-        Triangle triangle = *((Triangle *) data);
+        const Triangle * triangle = &scene->triangles[index];
+        Point p1 = getVertex (scene, triangle->vertices[0]);
+        Point p2 = getVertex (scene, triangle->vertices[1]);
+        Point p3 = getVertex (scene, triangle->vertices[2]);
 
-        newObject.bounds.min.x = minDouble(triangle.p1.x, minDouble(triangle.p2.x, triangle.p3.x));
-        newObject.bounds.min.y = minDouble(triangle.p1.y, minDouble(triangle.p2.y, triangle.p3.y));
-        newObject.bounds.min.z = minDouble(triangle.p1.z, minDouble(triangle.p2.z, triangle.p3.z));
+        newObject.bounds.min.x = minDouble(p1.x, minDouble(p2.x, p3.x));
+        newObject.bounds.min.y = minDouble(p1.y, minDouble(p2.y, p3.y));
+        newObject.bounds.min.z = minDouble(p1.z, minDouble(p2.z, p3.z));
 
-        newObject.bounds.max.x = maxDouble(triangle.p1.x, maxDouble(triangle.p2.x, triangle.p3.x));
-        newObject.bounds.max.y = maxDouble(triangle.p1.y, maxDouble(triangle.p2.y, triangle.p3.y));
-        newObject.bounds.max.z = maxDouble(triangle.p1.z, maxDouble(triangle.p2.z, triangle.p3.z));
+        newObject.bounds.max.x = maxDouble(p1.x, maxDouble(p2.x, p3.x));
+        newObject.bounds.max.y = maxDouble(p1.y, maxDouble(p2.y, p3.y));
+        newObject.bounds.max.z = maxDouble(p1.z, maxDouble(p2.z, p3.z));
 
         newObject.bounds.min.x -= RAY_EPSILON; newObject.bounds.min.y -= RAY_EPSILON; newObject.bounds.min.z -= RAY_EPSILON;
         newObject.bounds.max.x += RAY_EPSILON; newObject.bounds.max.y += RAY_EPSILON; newObject.bounds.max.z += RAY_EPSILON;
 
-        newObject.centroid.x = (triangle.p1.x + triangle.p2.x + triangle.p3.x)/ 3.0;
-        newObject.centroid.y = (triangle.p1.y + triangle.p2.y + triangle.p3.y)/ 3.0;
-        newObject.centroid.z = (triangle.p1.z + triangle.p2.z + triangle.p3.z)/ 3.0;
+        newObject.centroid.x = (p1.x + p2.x + p3.x)/ 3.0;
+        newObject.centroid.y = (p1.y + p2.y + p3.y)/ 3.0;
+        newObject.centroid.z = (p1.z + p2.z + p3.z)/ 3.0;
 
     } else if (type == SPHERE) {
-        Sphere sphere = *((Sphere * ) data);
+        Sphere sphere = scene->spheres[index];
 
         newObject.bounds.min.x = sphere.center.x - sphere.radius;
         newObject.bounds.min.y = sphere.center.y - sphere.radius;
@@ -49,109 +108,512 @@ static BVHObject createBVHObject (void * data, GeometryType type, int index) {
     return newObject;
 }
 
-static int compareX (const void *a, const void *b ) {
-    const BVHObject * objA = (const BVHObject *) a;
-    const BVHObject * objB = (const BVHObject *) b;
+BVHBuildSettings getBVHBuildSettings (BVHQuality quality) {
+    BVHBuildSettings settings;
+    settings.traversalCost = 1.0;
+    settings.numThreads = getProcessorCount ();
+    settings.wideWidth = 0;
+    settings.simdLevel = -1;
+
+    switch (quality) {
+        case BVH_QUALITY_FAST:
+            settings.numBins = 8;
+            settings.maxLeafSize = 8;
+            settings.splitAllAxes = false;
+            break;
+        case BVH_QUALITY_HIGH:
+            settings.numBins = 32;
+            settings.maxLeafSize = 4;
+            settings.splitAllAxes = true;
+            break;
+        case BVH_QUALITY_BALANCED:
+        default:
+            settings.numBins = 16;
+            settings.maxLeafSize = 4;
+            settings.splitAllAxes = true;
+            break;
+    }
+
+    return settings;
+}
+
+bool parseBVHQualityName (const char * name, BVHQuality * quality) {
+    if (strcmp (name, "fast") == 0) {
+        *quality = BVH_QUALITY_FAST;
+    } else if (strcmp (name, "balanced") == 0) {
+        *quality = BVH_QUALITY_BALANCED;
+    } else if (strcmp (name, "high") == 0) {
+        *quality = BVH_QUALITY_HIGH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static inline BoundingBox emptyBox () {
+    return (BoundingBox){.min = {INFINITY, INFINITY, INFINITY}, .max = {-INFINITY, -INFINITY, -INFINITY}};
+}
+
+static inline void growBox (BoundingBox * box, BoundingBox other) {
+    box->min.x = minDouble (box->min.x, other.min.x);
+    box->min.y = minDouble (box->min.y, other.min.y);
+    box->min.z = minDouble (box->min.z, other.min.z);
+
+    box->max.x = maxDouble (box->max.x, other.max.x);
+    box->max.y = maxDouble (box->max.y, other.max.y);
+    box->max.z = maxDouble (box->max.z, other.max.z);
+}
+
+static inline void growBoxPoint (BoundingBox * box, Point p) {
+    growBox (box, (BoundingBox){p, p});
+}
+
+static inline double surfaceArea (BoundingBox box) {
+    double x = box.max.x - box.min.x;
+    double y = box.max.y - box.min.y;
+    double z = box.max.z - box.min.z;
+    if (x < 0 || y < 0 || z < 0) return 0;
+    return 2.0 * (x * y + y * z + z * x);
+}
+
+static inline double axisValue (Point p, int axis) {
+    return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+static inline int getBinIndex (double centroid, double low, double scale, int numBins) {
+    int bin = (int)((centroid - low) * scale);
+    if (bin < 0) bin = 0;
+    if (bin >= numBins) bin = numBins - 1;
+    return bin;
+}
+
+/* binned surface area heuristic (Wald 2007)
+ * centroids are dropped into equal width bins along an axis, and one sweep from each side
+ * prices every bin boundary as traversalCost + (areaL * countL + areaR * countR) / areaParent.
+ * no sorting happens at any level, so a build is O(N log N). */
+
+static float roundDown (double value) {
+    float rounded = (float) value;
+    return ((double) rounded > value) ? nextafterf (rounded, -INFINITY) : rounded;
+}
+
+static float roundUp (double value) {
+    float rounded = (float) value;
+    return ((double) rounded < value) ? nextafterf (rounded, INFINITY) : rounded;
+}
+
+static void setNodeBounds (BVHNode * node, BoundingBox bounds) {
+    //float bounds are rounded outwards so they still contain the double precision geometry
+    node->min[0] = roundDown (bounds.min.x);
+    node->min[1] = roundDown (bounds.min.y);
+    node->min[2] = roundDown (bounds.min.z);
+    node->max[0] = roundUp (bounds.max.x);
+    node->max[1] = roundUp (bounds.max.y);
+    node->max[2] = roundUp (bounds.max.z);
+}
+
+static inline void makeLeaf (BVHNode * node, int start, int count) {
+    node->offset = start;
+    node->numPrimitives = (unsigned short) count;
+    node->axis = 0;
+}
+
+static void computeRangeBounds (const BVHObject * objects, int from, int to, RangeBounds * result) {
+    result->bounds = emptyBox ();
+    result->centroidBounds = emptyBox ();
+    for (int i = from; i < to; ++ i) {
+        growBoxPoint (&result->centroidBounds, objects[i].centroid);
+        growBox (&result->bounds, objects[i].bounds);
+    }
+}
+
+static void computeRangeBins (const BVHObject * objects, int from, int to, const BinSetup * setup, AxisBins * result) {
+    for (int axis = 0; axis < 3; ++ axis) {
+        if (!setup->enabled[axis]) continue;
+        for (int b = 0; b < setup->numBins; ++ b) {
+            result->bins[axis][b].bounds = emptyBox ();
+            result->bins[axis][b].count = 0;
+        }
+    }
+
+    //one sweep fills the bins of every candidate axis
+    for (int i = from; i < to; ++ i) {
+        for (int axis = 0; axis < 3; ++ axis) {
+            if (!setup->enabled[axis]) continue;
+            int b = getBinIndex (axisValue (objects[i].centroid, axis), setup->low[axis], setup->scale[axis], setup->numBins);
+            result->bins[axis][b].count ++;
+            growBox (&result->bins[axis][b].bounds, objects[i].bounds);
+        }
+    }
+}
 
-    if (objA->centroid.x > objB->centroid.x) return 1;
-    else if (objA->centroid.x < objB->centroid.x) return -1;
-    return 0;
+static inline int getChunkStart (const RangeJob * job, int chunk) {
+    return job->start + (int)((long long)job->count * chunk / job->numChunks);
 }
 
-static int compareY (const void *a, const void *b ) {
-    const BVHObject * objA = (const BVHObject *) a;
-    const BVHObject * objB = (const BVHObject *) b;
+static void boundsChunkTask (void * context, int chunk, int threadIndex) {
+    RangeJob * job = (RangeJob *) context;
+    computeRangeBounds (job->objects, getChunkStart (job, chunk), getChunkStart (job, chunk + 1), &job->boundsResults[chunk]);
+}
 
-    if (objA->centroid.y > objB->centroid.y) return 1;
-    else if (objA->centroid.y < objB->centroid.y) return -1;
-    return 0;
+static void binsChunkTask (void * context, int chunk, int threadIndex) {
+    RangeJob * job = (RangeJob *) context;
+    computeRangeBins (job->objects, getChunkStart (job, chunk), getChunkStart (job, chunk + 1), job->setup, &job->binResults[chunk]);
 }
 
-static int compareZ (const void *a, const void *b ) {
-    const BVHObject * objA = (const BVHObject *) a;
-    const BVHObject * objB = (const BVHObject *) b;
+/* big nodes near the root are summarized in parallel chunks. min/max and counts merge exactly,
+ * so the bins (and every split decision made from them) match a serial sweep bit for bit */
+
+static void summarizeRange (BVHBuilder * builder, int start, int end, int threads, RangeBounds * result) {
+    if (threads < 2 || end - start < BVH_PARALLEL_BINNING_CUTOFF) {
+        computeRangeBounds (builder->objects, start, end, result);
+        return;
+    }
 
-    if (objA->centroid.z > objB->centroid.z) return 1;
-    else if (objA->centroid.z < objB->centroid.z) return -1;
-    return 0;
+    RangeJob job = {builder->objects, start, end - start, threads, NULL, NULL, NULL};
+    ArenaMark mark = getArenaMark (builder->scratch);
+    job.boundsResults = arenaAlloc (builder->scratch, MEMORY_BUILD_SCRATCH, threads * sizeof(RangeBounds));
+    if (job.boundsResults == NULL) {
+        computeRangeBounds (builder->objects, start, end, result);
+        return;
+    }
+    parallelFor (threads, threads, boundsChunkTask, &job);
+
+    *result = job.boundsResults[0];
+    for (int i = 1; i < threads; ++ i) {
+        growBox (&result->bounds, job.boundsResults[i].bounds);
+        growBox (&result->centroidBounds, job.boundsResults[i].centroidBounds);
+    }
+    rewindArena (builder->scratch, mark);
+}
+
+static void binRange (BVHBuilder * builder, int start, int end, int threads, const BinSetup * setup, AxisBins * result) {
+    if (threads < 2 || end - start < BVH_PARALLEL_BINNING_CUTOFF) {
+        computeRangeBins (builder->objects, start, end, setup, result);
+        return;
+    }
+
+    RangeJob job = {builder->objects, start, end - start, threads, setup, NULL, NULL};
+    ArenaMark mark = getArenaMark (builder->scratch);
+    job.binResults = arenaAlloc (builder->scratch, MEMORY_BUILD_SCRATCH, threads * sizeof(AxisBins));
+    if (job.binResults == NULL) {
+        computeRangeBins (builder->objects, start, end, setup, result);
+        return;
+    }
+    parallelFor (threads, threads, binsChunkTask, &job);
+
+    *result = job.binResults[0];
+    for (int i = 1; i < threads; ++ i) {
+        for (int axis = 0; axis < 3; ++ axis) {
+            if (!setup->enabled[axis]) continue;
+            for (int b = 0; b < setup->numBins; ++ b) {
+                result->bins[axis][b].count += job.binResults[i].bins[axis][b].count;
+                growBox (&result->bins[axis][b].bounds, job.binResults[i].bins[axis][b].bounds);
+            }
+        }
+    }
+    rewindArena (builder->scratch, mark);
 }
 
-static BVHNode * createBVHNode (BVHObject * bvhArray, int start, int end) {
+static int createBVHNode (BVHBuilder * builder, int start, int end, int depth, int threads);
+
+static void buildSubtreeTask (void * context, int item, int threadIndex) {
+    SubtreeTask * task = &((SubtreeTask *) context)[item];
+    createBVHNode (&task->builder, task->start, task->end, task->depth, task->threads);
+}
+
+static void moveSubtree (BVHBuilder * builder, int from, int to, int numNodes) {
+    //interior child offsets are absolute, so they shift with the subtree
+    memmove (&builder->nodes[to], &builder->nodes[from], numNodes * sizeof(BVHNode));
+    for (int i = to; i < to + numNodes; ++ i) {
+        if (builder->nodes[i].numPrimitives == 0) builder->nodes[i].offset -= from - to;
+    }
+}
+
+static int createBVHNode (BVHBuilder * builder, int start, int end, int depth, int threads) {
+    BVHObject * bvhArray = builder->objects;
+    const BVHBuildSettings * settings = builder->settings;
     int count = end - start ;
-    if (count <= 0) return NULL;
 
-    BVHNode * newNode = malloc(sizeof(BVHNode));
+    int nodeIndex = builder->numNodes ++;
+    BVHNode * newNode = &builder->nodes[nodeIndex];
+    newNode->padding = 0;
+
+    RangeBounds range;
+    summarizeRange (builder, start, end, threads, &range);
+    BoundingBox centroidVolume = range.centroidBounds;
+    BoundingBox boundingVolume = range.bounds;
+    setNodeBounds (newNode, boundingVolume);
+
+    /* the depth cap keeps traversal inside its fixed stack. leaf counts are stored in 16 bits, so a
+     * bigger range at the cap is halved by count instead, which takes at most BVH_OVERFLOW_LEVELS more */
+    bool atDepthCap = depth >= BVH_MAX_DEPTH;
+    if (count == 1 || (atDepthCap && count <= USHRT_MAX)) {
+        makeLeaf (newNode, start, count);
+        return nodeIndex;
+    }
 
-    if (count == 1) {
-        newNode->index = bvhArray[start].index;
-        newNode->type = bvhArray [start].type;
-        newNode->bounds = bvhArray[start].bounds;
-        newNode->left = NULL;
-        newNode->right = NULL;
-    } else {
-        BoundingBox centroidVolume = {.min = {INFINITY, INFINITY, INFINITY}, .max = {-INFINITY, -INFINITY, -INFINITY}};
-        BoundingBox boundingVolume = {.min = {INFINITY, INFINITY, INFINITY}, .max = {-INFINITY, -INFINITY, -INFINITY}};
-        for (int i = start; i < end; ++ i ) {
-            Point p = bvhArray[i].centroid;
-            BoundingBox bounds = bvhArray[i].bounds;
-            
-            centroidVolume.min.x = minDouble (centroidVolume.min.x, p.x);
-            centroidVolume.min.y = minDouble (centroidVolume.min.y, p.y);
-            centroidVolume.min.z = minDouble (centroidVolume.min.z, p.z);
-
-            centroidVolume.max.x = maxDouble (centroidVolume.max.x, p.x);
-            centroidVolume.max.y = maxDouble (centroidVolume.max.y, p.y);
-            centroidVolume.max.z = maxDouble (centroidVolume.max.z, p.z);
-            
-            boundingVolume.min.x = minDouble (boundingVolume.min.x, bounds.min.x);
-            boundingVolume.min.y = minDouble (boundingVolume.min.y, bounds.min.y);
-            boundingVolume.min.z = minDouble (boundingVolume.min.z, bounds.min.z);
-
-            boundingVolume.max.x = maxDouble (boundingVolume.max.x, bounds.max.x);
-            boundingVolume.max.y = maxDouble (boundingVolume.max.y, bounds.max.y);
-            boundingVolume.max.z = maxDouble (boundingVolume.max.z, bounds.max.z);
+    int numBins = settings->numBins < 2 ? 2 : (settings->numBins > MAX_SAH_BINS ? MAX_SAH_BINS : settings->numBins);
+    double leafCost = count;
+    double parentArea = surfaceArea (boundingVolume);
+
+    Vector extent = getVector (centroidVolume.min, centroidVolume.max);
+    int largestAxis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+
+    BinSetup setup;
+    setup.numBins = numBins;
+    bool anyAxis = false;
+    for (int axis = 0; axis < 3; ++ axis) {
+        setup.low[axis] = axisValue (centroidVolume.min, axis);
+        double high = axisValue (centroidVolume.max, axis);
+        setup.enabled[axis] = !atDepthCap && (settings->splitAllAxes || axis == largestAxis) && high > setup.low[axis];
+        setup.scale[axis] = setup.enabled[axis] ? numBins / (high - setup.low[axis]) : 0;
+        anyAxis = anyAxis || setup.enabled[axis];
+    }
+
+    double bestCost = INFINITY;
+    int bestAxis = -1;
+    int bestBin = -1;
+
+    //the bins are too big for the stack of a deep recursion, and come off the scratch arena instead
+    ArenaMark mark = getArenaMark (builder->scratch);
+    AxisBins * axisBins = NULL;
+    if (anyAxis) {
+        axisBins = arenaAlloc (builder->scratch, MEMORY_BUILD_SCRATCH, sizeof(AxisBins));
+        if (axisBins == NULL) {
+            //the build is thrown away, but the node is still left a well formed leaf
+            makeLeaf (newNode, start, count < USHRT_MAX ? count : USHRT_MAX);
+            builder->failed = true;
+            return nodeIndex;
+        }
+        binRange (builder, start, end, threads, &setup, axisBins);
+    }
+
+    for (int axis = 0; axis < 3; ++ axis) {
+        if (!setup.enabled[axis]) continue;
+        SAHBin * bins = axisBins->bins[axis];
+
+        //rightArea[b] / rightCount[b] describe bins b..numBins-1
+        double rightArea[MAX_SAH_BINS];
+        int rightCount[MAX_SAH_BINS];
+        BoundingBox accumulated = emptyBox ();
+        int accumulatedCount = 0;
+        for (int b = numBins - 1; b > 0; -- b) {
+            growBox (&accumulated, bins[b].bounds);
+            accumulatedCount += bins[b].count;
+            rightArea[b] = surfaceArea (accumulated);
+            rightCount[b] = accumulatedCount;
         }
 
-        newNode->index = -1;
-        newNode->type = -1;
-        newNode->bounds = boundingVolume;
+        accumulated = emptyBox ();
+        accumulatedCount = 0;
+        for (int b = 0; b < numBins - 1; ++ b) {
+            growBox (&accumulated, bins[b].bounds);
+            accumulatedCount += bins[b].count;
+            if (accumulatedCount == 0 || rightCount[b + 1] == 0) continue;
+
+            double cost = settings->traversalCost +
+                (surfaceArea (accumulated) * accumulatedCount + rightArea[b + 1] * rightCount[b + 1]) / fmax (parentArea, 1e-30);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+    rewindArena (builder->scratch, mark);
 
-        double x = centroidVolume.max.x - centroidVolume.min.x;
-        double y = centroidVolume.max.y - centroidVolume.min.y;
-        double z = centroidVolume.max.z - centroidVolume.min.z; 
+    if (count <= settings->maxLeafSize && leafCost <= bestCost) {
+        makeLeaf (newNode, start, count);
+        return nodeIndex;
+    }
 
-        if (x > y && x > z) {
-            qsort(bvhArray + start, count, sizeof(BVHObject), compareX);
-        } else if (y > x && y > z) {
-            qsort(bvhArray + start, count, sizeof(BVHObject), compareY);
-        } else {
-            qsort(bvhArray + start, count, sizeof(BVHObject), compareZ);
+    int mid;
+    if (bestAxis >= 0) {
+        double low = setup.low[bestAxis];
+        double scale = setup.scale[bestAxis];
+
+        //in place partition: objects in bins up to bestBin go left
+        int left = start;
+        int right = end - 1;
+        while (left <= right) {
+            if (getBinIndex (axisValue (bvhArray[left].centroid, bestAxis), low, scale, numBins) <= bestBin) {
+                left ++;
+            } else {
+                BVHObject temp = bvhArray[left];
+                bvhArray[left] = bvhArray[right];
+                bvhArray[right] = temp;
+                right --;
+            }
         }
+        mid = left;
+    } else {
+        bestAxis = largestAxis;
+        //every centroid coincides (or the depth cap is reached), so no plane is tried; halve by count to keep leaves small
+        mid = start + count / 2;
+    }
+
+    newNode->numPrimitives = 0;
+    newNode->axis = (unsigned char) bestAxis;
 
-        int mid = start + count / 2;
-        newNode->left = createBVHNode(bvhArray, start, mid);
-        newNode->right = createBVHNode(bvhArray, mid, end);
+    if (threads < 2 || count < BVH_PARALLEL_CUTOFF) {
+        createBVHNode(builder, start, mid, depth + 1, 1);
+        newNode->offset = createBVHNode(builder, mid, end, depth + 1, 1);
+        return nodeIndex;
     }
-    
 
-    return newNode;
+    /* fork: both halves build on the scheduler, sharing this node's thread budget in proportion to
+     * their size. each builds in place, the right one past the most nodes the left could need, and
+     * then slides down against the left to give the same depth first order as a serial build */
+    int leftThreads = (int)((long long)threads * (mid - start) / count);
+    if (leftThreads < 1) leftThreads = 1;
+    if (leftThreads > threads - 1) leftThreads = threads - 1;
+
+    int leftBase = builder->numNodes;
+    int rightBase = leftBase + 2 * (mid - start) - 1;
+    SubtreeTask tasks[2] = {
+        {{bvhArray, builder->nodes, leftBase, settings, NULL, false}, {0}, start, mid, depth + 1, leftThreads},
+        {{bvhArray, builder->nodes, rightBase, settings, NULL, false}, {0}, mid, end, depth + 1, threads - leftThreads}
+    };
+    for (int i = 0; i < 2; ++ i) {
+        initArena (&tasks[i].scratch);
+        tasks[i].builder.scratch = &tasks[i].scratch;
+    }
+
+    parallelFor (2, 2, buildSubtreeTask, tasks);
+    builder->failed = builder->failed || tasks[0].builder.failed || tasks[1].builder.failed;
+    //the halves held their scratch at the same time, on top of what this builder holds
+    size_t heldBelow = builder->scratch->heldBytes;
+    for (int i = 0; i < 2; ++ i) {
+        freeArena (&tasks[i].scratch);
+        addMemoryUsage (&builder->scratch->usage, &tasks[i].scratch.usage);
+        heldBelow += tasks[i].scratch.peakHeldBytes;
+    }
+    if (heldBelow > builder->scratch->peakHeldBytes) builder->scratch->peakHeldBytes = heldBelow;
+
+    builder->numNodes = tasks[0].builder.numNodes;
+    newNode->offset = builder->numNodes;
+    moveSubtree (builder, rightBase, builder->numNodes, tasks[1].builder.numNodes - rightBase);
+    builder->numNodes += tasks[1].builder.numNodes - rightBase;
+
+    return nodeIndex;
 }
 
 
-void createBVH (Scene * scene) {
+bool createBVH (Scene * scene) {
+    double start = getTimeSeconds ();
+
+    //the objects and everything the split search uses are scratch; only the nodes and primitives stay
+    Arena scratch;
+    initArena (&scratch);
+    ArenaMark sceneMark = getArenaMark (&scene->arena);
+
     int totalNumberOfObjects = scene->numTriangles + scene->numSpheres;
-    BVHObject * bvhArray = malloc(totalNumberOfObjects * sizeof(BVHObject));
+    BVHObject * bvhArray = arenaAlloc(&scratch, MEMORY_BUILD_SCRATCH, totalNumberOfObjects * sizeof(BVHObject));
+    int * primitives = arenaAlloc(&scene->arena, MEMORY_BVH, totalNumberOfObjects * sizeof(int));
+
+    //a binary tree whose leaves hold at least one primitive has at most 2N - 1 nodes. the node array is
+    //the arena's newest allocation, so it shrinks to what the build used without moving
+    BVHBuilder builder;
+    builder.objects = bvhArray;
+    builder.settings = &scene->bvhSettings;
+    builder.scratch = &scratch;
+    builder.numNodes = 0;
+    builder.failed = false;
+    size_t maxNodes = totalNumberOfObjects > 0 ? 2 * (size_t) totalNumberOfObjects - 1 : 1;
+    builder.nodes = arenaAlloc(&scene->arena, MEMORY_BVH, maxNodes * sizeof(BVHNode));
+
+    if (bvhArray && builder.nodes && primitives && totalNumberOfObjects > 0) {
+        int index = 0;
+        for (int i = 0; i < scene->numTriangles; ++ i) {
+            bvhArray [index++] = createBVHObject (scene, TRIANGLE, i);
+        }
+
+        for (int i = 0; i < scene->numSpheres; ++ i) {
+            bvhArray [index++] = createBVHObject (scene, SPHERE, i);
+        }
 
-    int index = 0;
-    for (int i = 0; i < scene->numTriangles; ++ i) {
-        bvhArray [index++] = createBVHObject (&(scene->triangles[i]), TRIANGLE, i);
+        createBVHNode(&builder, 0, totalNumberOfObjects, 0, scene->bvhSettings.numThreads);
+    }
+    if (!bvhArray || !builder.nodes || !primitives || builder.failed) {
+        fprintf (stderr, "Out of memory building the BVH over %d primitives\n", totalNumberOfObjects);
+        rewindArena (&scene->arena, sceneMark);
+        freeArena (&scratch);
+        return false;
     }
 
-    for (int i = 0; i < scene->numSpheres; ++ i) {
-        bvhArray [index++] = createBVHObject (&(scene->spheres[i]), SPHERE, i);
+    scene->bvhNodes = arenaResize(&scene->arena, MEMORY_BVH, builder.nodes, maxNodes * sizeof(BVHNode), builder.numNodes * sizeof(BVHNode));
+    scene->numBVHNodes = builder.numNodes;
+
+    //leaves index this array, so it takes the order the build left the objects in
+    scene->bvhPrimitives = primitives;
+    scene->numBVHPrimitives = totalNumberOfObjects;
+    for (int i = 0; i < totalNumberOfObjects; ++ i) {
+        scene->bvhPrimitives[i] = (bvhArray[i].type == TRIANGLE) ? bvhArray[i].index : scene->numTriangles + bvhArray[i].index;
     }
 
-    scene->root = createBVHNode(bvhArray, 0, totalNumberOfObjects);
+    freeArena (&scratch);
+    addMemoryUsage (&scene->scratchUsage, &scratch.usage);
+    if (scratch.peakHeldBytes > scene->scratchPeakBytes) scene->scratchPeakBytes = scratch.peakHeldBytes;
+
+    scene->bvhBuildTime = getTimeSeconds () - start;
+    return true;
+}
+
+static BoundingBox getNodeBounds (const BVHNode * node) {
+    return (BoundingBox){{node->min[0], node->min[1], node->min[2]}, {node->max[0], node->max[1], node->max[2]}};
+}
+
+static void accumulateBVHStats (Scene * scene, int nodeIndex, int depth, double rootArea, BVHStats * stats) {
+    BVHNode * node = &scene->bvhNodes[nodeIndex];
+
+    stats->numNodes ++;
+    if (depth > stats->maxDepth) stats->maxDepth = depth;
+
+    double relativeArea = surfaceArea (getNodeBounds (node)) / fmax (rootArea, 1e-30);
+
+    if (node->numPrimitives > 0) {
+        stats->numLeaves ++;
+        if (node->numPrimitives > stats->maxLeafSize) stats->maxLeafSize = node->numPrimitives;
+        stats->sahCost += relativeArea * node->numPrimitives;
+        return;
+    }
+
+    stats->sahCost += relativeArea * scene->bvhSettings.traversalCost;
+    accumulateBVHStats (scene, nodeIndex + 1, depth + 1, rootArea, stats);
+    accumulateBVHStats (scene, node->offset, depth + 1, rootArea, stats);
+}
+
+BVHStats getBVHStats (Scene * scene) {
+    BVHStats stats;
+    memset (&stats, 0, sizeof(stats));
+    stats.buildTime = scene->bvhBuildTime;
+
+    if (scene->numBVHNodes > 0) {
+        accumulateBVHStats (scene, 0, 0, surfaceArea (getNodeBounds (&scene->bvhNodes[0])), &stats);
+    }
+    if (stats.numLeaves > 0) {
+        stats.averageLeafSize = (double)scene->numBVHPrimitives / stats.numLeaves;
+    }
+
+    //fnv-1a over the node and primitive arrays, so two builds can be compared from the log
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char * bytes = (const unsigned char *) scene->bvhNodes;
+    for (size_t i = 0; i < (size_t)scene->numBVHNodes * sizeof(BVHNode); ++ i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    bytes = (const unsigned char *) scene->bvhPrimitives;
+    for (size_t i = 0; i < (size_t)scene->numBVHPrimitives * sizeof(int); ++ i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    stats.layoutHash = hash;
+
+    return stats;
+}
 
-    free (bvhArray);
+void printBVHStats (Scene * scene) {
+    BVHStats stats = getBVHStats (scene);
+    fprintf (stderr, "BVH: %d primitives, %d nodes (%.1f KB), %d leaves (%.2f avg / %d max per leaf), depth %d, SAH cost %.2f, built in %.3f ms on %d threads, layout %016llx\n",
+             scene->numBVHPrimitives, stats.numNodes, stats.numNodes * sizeof(BVHNode) / 1024.0, stats.numLeaves, stats.averageLeafSize, stats.maxLeafSize,
+             stats.maxDepth, stats.sahCost, stats.buildTime * 1000.0, scene->bvhSettings.numThreads, (unsigned long long) stats.layoutHash);
 }
\ No newline at end of file
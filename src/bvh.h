@@ -1,26 +1,60 @@
 #ifndef BVH_H
 #define BVH_H
 
+#include <stdint.h>
 #include "geometry.h"
 typedef enum {
     TRIANGLE,
     SPHERE
 } GeometryType;
 
+typedef enum {
+    BVH_QUALITY_FAST,
+    BVH_QUALITY_BALANCED,
+    BVH_QUALITY_HIGH
+} BVHQuality;
+
+#define BVH_MAX_DEPTH 60                   // SAH splits stop here
+#define BVH_OVERFLOW_LEVELS 16             // below the cap, ranges too big for a 16 bit leaf are halved, and 16 halvings bring any int count under 2^16
+#define BVH_TREE_DEPTH (BVH_MAX_DEPTH + BVH_OVERFLOW_LEVELS) // deepest a node can be, whatever the scene
+#define BVH_STACK_SIZE (BVH_TREE_DEPTH + 4)
+#define BVH_PARALLEL_CUTOFF 4096           // subtrees smaller than this build on the current thread
+#define BVH_PARALLEL_BINNING_CUTOFF 65536  // nodes larger than this bin their objects in parallel chunks
+
+// 32 bytes, stored depth first: an interior node's first child directly follows it
 struct _BVHNode {
-    BoundingBox bounds;
-    BVHNode * left;
-    BVHNode * right;
-    GeometryType type;
-    int index;
+    float min[3];
+    float max[3];
+    int offset;                   // first bvhPrimitives entry for leaves, second child for interior nodes
+    unsigned short numPrimitives; // 0 marks an interior node
+    unsigned char axis;           // split axis, used to visit the nearer child first
+    unsigned char padding;
 };
 
+_Static_assert (sizeof(BVHNode) == 32, "BVHNode should stay 32 bytes");
+
 typedef struct {
-    GeometryType type;
     BoundingBox bounds;
     Point centroid;
+    GeometryType type; // beside the index so the two share one 8 byte slot
     int index;
 } BVHObject;
 
-void createBVH (Scene * scene);
+typedef struct {
+    int numNodes;
+    int numLeaves;
+    int maxDepth;
+    int maxLeafSize;
+    double averageLeafSize;
+    double sahCost;
+    double buildTime;
+    uint64_t layoutHash;
+} BVHStats;
+
+BVHBuildSettings getBVHBuildSettings (BVHQuality quality);
+bool parseBVHQualityName (const char * name, BVHQuality * quality);
+
+bool createBVH (Scene * scene); // false, with no BVH, when out of memory
+BVHStats getBVHStats (Scene * scene);
+void printBVHStats (Scene * scene);
 #endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "frontend.h"
+#include <stdio.h>
+#include <string.h>
+
+/* headless renderer for machines without a display: same options as the viewer plus an output file */
+
+int main (int argc, char ** argv) {
+    for (int i = 1; i < argc; ++ i) {
+        if (strcmp (argv[i], "--help") == 0 || strcmp (argv[i], "-h") == 0) {
+            printRenderOptionsUsage (argv[0]);
+            return 0;
+        }
+    }
+
+    RenderOptions options = defaultRenderOptions();
+    if (!parseRenderOptions (argc, argv, &options)) {
+        printRenderOptionsUsage (argv[0]);
+        return 1;
+    }
+    if (!options.outputPath) {
+        options.outputPath = "render.ppm";
+    }
+
+    Scene * scene = initScene();
+    if (!scene) {
+        fprintf (stderr, "Out of memory\n");
+        return 1;
+    }
+    Film * film = renderFromOptions (&options, scene);
+    freeScene(scene);
+
+    if (!film) return 1;
+
+    freeFilm(film);
+    return 0;
+}
\ No newline at end of file
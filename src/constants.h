@@ -1,13 +1,33 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
 
-#define MAX_BOUNCES 5
+#define MAX_BOUNCES 64 // default limit on path vertices; russian roulette ends most paths long before
+#define DEFAULT_ROULETTE_DEPTH 3 // vertices before russian roulette may end a path
+#define DEFAULT_LIGHT_SAMPLES 1 // shadow rays per diffuse vertex
 #define RAY_EPSILON 1e-3
 
 #define DEFAULT_OBJ "../test_scenes/cornell_box/CornellBox-Sphere.obj"
 #define DEFAULT_MTL "../test_scenes/cornell_box/CornellBox-Sphere.mtl"
 
 #define TOTAL_SAMPLES 2
+#define DEFAULT_TILE_SIZE 16
+#define PROGRESSIVE_FRAME_RATE 30 // viewer refreshes per second while rendering progressively
+#define PACKET_BLOCK_SIZE 4 // pixels per side of a camera ray packet
+#define WAVEFRONT_PATHS_PER_THREAD 4096 // wavefront batch size per thread; the queues of a batch should stay in cache
+#define WAVEFRONT_CHUNK_SIZE 256 // paths per thread pool task in each wavefront stage
+#define DEFAULT_SEED 0x5EED
+#define OBJ_CHUNK_BYTES (1 << 22) // slice of an OBJ file that one loader task parses
+#define OBJ_CHUNKS_PER_THREAD 2 // chunks parsed per thread before the merge catches up; bounds what is held at once
+
+#define ADAPTIVE_MIN_SAMPLES 4 // default floor before a pixel may stop, capped by --spp
+#define ADAPTIVE_MAX_SCALE 8 // default per pixel cap as a multiple of --spp
+#define ADAPTIVE_LUMINANCE_FLOOR 0.01 // dark pixels are judged on absolute rather than relative error
+
+#define MLT_BOOTSTRAP_SAMPLES 100000
+#define MLT_LARGE_STEP_PROBABILITY 0.3
+#define MLT_MUTATION_SIGMA 0.01
+#define MLT_DEFAULT_CHAINS 64
+#define MLT_CHECKPOINTS 4
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -12,8 +12,40 @@ struct _GtkDisplay{
     int height;
     
     PixelMap * pixelMap;
+    ProgressiveRender * progressive;
+    guint refreshSource;
 };
 
+static gboolean refreshProgressiveFrame (gpointer user_data) {
+    GtkDisplay * self = (GtkDisplay *) user_data;
+
+    //the frame is copied out under the renderer's lock, so the texture owns its bytes
+    gsize size = (gsize) self->width * self->height * 4;
+    guchar * pixels = g_malloc (size);
+    int passes = 0;
+
+    if (!copyProgressiveFrame (self->progressive, pixels, &passes)) {
+        g_free (pixels);
+        if (isProgressiveRenderFinished (self->progressive)) {
+            self->refreshSource = 0;
+            return G_SOURCE_REMOVE;
+        }
+        return G_SOURCE_CONTINUE;
+    }
+
+    GBytes * frameBytes = g_bytes_new_take (pixels, size);
+    GdkTexture * texture = gdk_memory_texture_new (self->width, self->height, GDK_MEMORY_R8G8B8A8, frameBytes, self->width * 4);
+    gtk_picture_set_paintable (GTK_PICTURE(self->picture), GDK_PAINTABLE(texture));
+
+    char title[64];
+    snprintf (title, sizeof(title), "Metropolis Light Transport - %d spp", passes);
+    gtk_window_set_title (GTK_WINDOW(self->window), title);
+
+    g_bytes_unref (frameBytes);
+    g_object_unref (texture);
+    return G_SOURCE_CONTINUE;
+}
+
 static void activate(GtkApplication * app, gpointer user_data) {
     GtkDisplay * self = (GtkDisplay *) user_data;
 
@@ -21,6 +53,15 @@ static void activate(GtkApplication * app, gpointer user_data) {
     gtk_window_set_title(GTK_WINDOW(self->window), "GdkTexture Test");
     gtk_window_set_default_size(GTK_WINDOW(self->window), self->width, self->height);
 
+    if (self->progressive) {
+        //frames arrive from the render thread; the timeout caps how often the texture is replaced
+        self->picture = gtk_picture_new();
+        gtk_window_set_child(GTK_WINDOW(self->window), self->picture);
+        gtk_window_present(GTK_WINDOW (self->window));
+        self->refreshSource = g_timeout_add (1000 / PROGRESSIVE_FRAME_RATE, refreshProgressiveFrame, self);
+        return;
+    }
+
     GBytes * pixelMapByteData = g_bytes_new_static (self->pixelMap->data, self->pixelMap->size);
 
     GdkTexture * texture = gdk_memory_texture_new (self->pixelMap->width, self->pixelMap->height, GDK_MEMORY_R8G8B8A8, pixelMapByteData, self->pixelMap->width * 4);
@@ -38,6 +79,10 @@ void setPixelMap (GtkDisplay * self, PixelMap * map) {
     self->pixelMap = map;
 }
 
+void setProgressiveRender (GtkDisplay * self, ProgressiveRender * render) {
+    self->progressive = render;
+}
+
 GtkDisplay * createDisplay (int width, int height) {
     GtkDisplay * newDisplay = malloc (sizeof(GtkDisplay));
     newDisplay->app = gtk_application_new("com.test.metroLT", G_APPLICATION_DEFAULT_FLAGS); 
@@ -47,6 +92,8 @@ GtkDisplay * createDisplay (int width, int height) {
     newDisplay->window = NULL;
     newDisplay->picture = NULL;
     newDisplay->pixelMap = NULL;
+    newDisplay->progressive = NULL;
+    newDisplay->refreshSource = 0;
 
     return newDisplay;
 }
@@ -57,10 +104,8 @@ void runDisplay (GtkDisplay * self, int argc, char ** argv) {
 }
 
 void cleanDisplay (GtkDisplay * self) {
+    if (self->refreshSource) g_source_remove(self->refreshSource);
     g_object_unref(self->app);
-    if (self->pixelMap) {
-        free(self->pixelMap->data);
-        free(self->pixelMap);
-    }
+    freePixelMap(self->pixelMap);
     free(self);
 }
\ No newline at end of file
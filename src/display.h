@@ -2,19 +2,15 @@
 #define DISPLAY_H
 
 #include <gtk/gtk.h>
-
-typedef struct {
-    int width;
-    int height;
-    unsigned char * data;
-    int size;
-} PixelMap;
+#include "pixelMap.h"
+#include "renderer.h"
 
 typedef struct _GtkDisplay GtkDisplay;
 
 GtkDisplay * createDisplay (int width, int height);
 void runDisplay (GtkDisplay * self, int argc, char ** argv);
 void setPixelMap (GtkDisplay * self, PixelMap * map);
+void setProgressiveRender (GtkDisplay * self, ProgressiveRender * render);
 void cleanDisplay (GtkDisplay * self);
 
 
@@ -0,0 +1,280 @@
+#include "film.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FILM_FILE_MAGIC "FILM1\n"
+#define GAUSSIAN_FILTER_ALPHA 2.0
+
+/* film
+ * samples are kept as linear radiance until the very end: the renderers only ever add weighted
+ * sums, so films can be merged, saved and re-exposed. turning them into display bytes is a
+ * separate pass that goes through a lookup table instead of calling pow per channel. */
+
+static unsigned char toneMapLut[TONE_MAP_LUT_SIZE];
+static pthread_once_t toneMapLutOnce = PTHREAD_ONCE_INIT; // the viewer and the progressive controller both tone map
+
+PixelFilter getPixelFilter (FilterType type) {
+    switch (type) {
+        case FILTER_TENT: return (PixelFilter){FILTER_TENT, 1.0};
+        case FILTER_GAUSSIAN: return (PixelFilter){FILTER_GAUSSIAN, 1.5};
+        case FILTER_BOX:
+        default: return (PixelFilter){FILTER_BOX, 0.5};
+    }
+}
+
+const char * getFilterName (FilterType type) {
+    switch (type) {
+        case FILTER_BOX: return "box";
+        case FILTER_TENT: return "tent";
+        case FILTER_GAUSSIAN: return "gaussian";
+        default: return "unknown";
+    }
+}
+
+bool parseFilterName (const char * name, FilterType * type) {
+    if (strcmp (name, "box") == 0) {
+        *type = FILTER_BOX;
+    } else if (strcmp (name, "tent") == 0) {
+        *type = FILTER_TENT;
+    } else if (strcmp (name, "gaussian") == 0) {
+        *type = FILTER_GAUSSIAN;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Film * createFilm (int width, int height, PixelFilter filter) {
+    Film * film = malloc (sizeof(Film));
+    size_t numPixels = (size_t)width * height;
+    film->width = width;
+    film->height = height;
+    film->filter = filter;
+    film->radiance = calloc (numPixels * 3, sizeof(float));
+    film->weights = calloc (numPixels, sizeof(float));
+    film->sampleCounts = calloc (numPixels, sizeof(uint32_t));
+    return film;
+}
+
+void clearFilm (Film * film) {
+    size_t numPixels = (size_t)film->width * film->height;
+    memset (film->radiance, 0, numPixels * 3 * sizeof(float));
+    memset (film->weights, 0, numPixels * sizeof(float));
+    memset (film->sampleCounts, 0, numPixels * sizeof(uint32_t));
+}
+
+void freeFilm (Film * film) {
+    if (!film) return;
+    free (film->radiance);
+    free (film->weights);
+    free (film->sampleCounts);
+    free (film);
+}
+
+static inline double evaluateFilter (const PixelFilter * filter, double offset) {
+    double distance = fabs (offset);
+    if (distance >= filter->radius) return 0;
+
+    switch (filter->type) {
+        case FILTER_TENT:
+            return 1.0 - distance / filter->radius;
+        case FILTER_GAUSSIAN:
+            return exp (-GAUSSIAN_FILTER_ALPHA * distance * distance) - exp (-GAUSSIAN_FILTER_ALPHA * filter->radius * filter->radius);
+        case FILTER_BOX:
+        default:
+            return 1.0;
+    }
+}
+
+static inline void addToPixel (Film * film, int x, int y, Vector radiance, double weight) {
+    size_t index = (size_t)y * film->width + x;
+    film->radiance[index * 3 + 0] += (float)(radiance.x * weight);
+    film->radiance[index * 3 + 1] += (float)(radiance.y * weight);
+    film->radiance[index * 3 + 2] += (float)(radiance.z * weight);
+    film->weights[index] += (float) weight;
+}
+
+void splatFilmSample (Film * film, double filmX, double filmY, Vector radiance, double weight) {
+    //film coordinates put pixel x over [x, x + 1) with its centre at x + 0.5
+    int pixelX = (int) floor (filmX);
+    int pixelY = (int) floor (filmY);
+    if (pixelX >= 0 && pixelY >= 0 && pixelX < film->width && pixelY < film->height) {
+        film->sampleCounts[(size_t)pixelY * film->width + pixelX] ++;
+    }
+
+    if (film->filter.type == FILTER_BOX && film->filter.radius <= 0.5) {
+        if (pixelX >= 0 && pixelY >= 0 && pixelX < film->width && pixelY < film->height) {
+            addToPixel (film, pixelX, pixelY, radiance, weight);
+        }
+        return;
+    }
+
+    double radius = film->filter.radius;
+    int startX = (int) ceil (filmX - 0.5 - radius), endX = (int) floor (filmX - 0.5 + radius);
+    int startY = (int) ceil (filmY - 0.5 - radius), endY = (int) floor (filmY - 0.5 + radius);
+    if (startX < 0) startX = 0;
+    if (startY < 0) startY = 0;
+    if (endX >= film->width) endX = film->width - 1;
+    if (endY >= film->height) endY = film->height - 1;
+
+    for (int y = startY; y <= endY; ++ y) {
+        double weightY = evaluateFilter (&film->filter, y + 0.5 - filmY);
+        if (weightY <= 0) continue;
+        for (int x = startX; x <= endX; ++ x) {
+            double filterWeight = weightY * evaluateFilter (&film->filter, x + 0.5 - filmX);
+            if (filterWeight > 0) addToPixel (film, x, y, radiance, weight * filterWeight);
+        }
+    }
+}
+
+void setFilmPixel (Film * film, int x, int y, Vector radiance) {
+    size_t index = (size_t)y * film->width + x;
+    film->radiance[index * 3 + 0] = (float) radiance.x;
+    film->radiance[index * 3 + 1] = (float) radiance.y;
+    film->radiance[index * 3 + 2] = (float) radiance.z;
+    film->weights[index] = 1.0f;
+}
+
+Vector getFilmPixel (const Film * film, int x, int y) {
+    size_t index = (size_t)y * film->width + x;
+    float weight = film->weights[index];
+    if (weight <= 0) return (Vector){0, 0, 0};
+
+    double inverse = 1.0 / weight;
+    return (Vector){film->radiance[index * 3 + 0] * inverse, film->radiance[index * 3 + 1] * inverse, film->radiance[index * 3 + 2] * inverse};
+}
+
+bool mergeFilm (Film * target, const Film * source) {
+    if (target->width != source->width || target->height != source->height) {
+        fprintf (stderr, "Film is %d x %d, this render is %d x %d\n", source->width, source->height, target->width, target->height);
+        return false;
+    }
+    //the sums are only comparable when every sample was spread by the same filter
+    if (target->filter.type != source->filter.type || target->filter.radius != source->filter.radius) {
+        fprintf (stderr, "Film was filtered with %s (radius %g), this render with %s (radius %g)\n",
+                 getFilterName (source->filter.type), source->filter.radius, getFilterName (target->filter.type), target->filter.radius);
+        return false;
+    }
+
+    size_t numPixels = (size_t)target->width * target->height;
+    for (size_t i = 0; i < numPixels * 3; ++ i) {
+        target->radiance[i] += source->radiance[i];
+    }
+    for (size_t i = 0; i < numPixels; ++ i) {
+        target->weights[i] += source->weights[i];
+        target->sampleCounts[i] += source->sampleCounts[i];
+    }
+    return true;
+}
+
+static void buildToneMapLut () {
+    double gamma = 1.0/2.2;
+    for (int i = 0; i < TONE_MAP_LUT_SIZE; ++ i) {
+        toneMapLut[i] = (unsigned char)(fmin(1.0, pow((double)i / (TONE_MAP_LUT_SIZE - 1), gamma)) * 255.0);
+    }
+}
+
+void toneMapFilm (const Film * film, double exposure, PixelMap * map) {
+    pthread_once (&toneMapLutOnce, buildToneMapLut);
+
+    //exposure is in stops; a row is scaled and clamped to lut indices first so that loop vectorizes
+    float scale = (float)(pow (2.0, exposure) * (TONE_MAP_LUT_SIZE - 1));
+    int * indices = malloc ((size_t)film->width * 3 * sizeof(int));
+
+    for (int y = 0; y < film->height; ++ y) {
+        const float * radiance = film->radiance + (size_t)y * film->width * 3;
+        const float * weights = film->weights + (size_t)y * film->width;
+
+        for (int x = 0; x < film->width; ++ x) {
+            float pixelScale = weights[x] > 0 ? scale / weights[x] : 0.0f;
+            for (int c = 0; c < 3; ++ c) {
+                float value = radiance[x * 3 + c] * pixelScale + 0.5f;
+                value = value < 0.0f ? 0.0f : value;
+                value = value > (float)(TONE_MAP_LUT_SIZE - 1) ? (float)(TONE_MAP_LUT_SIZE - 1) : value;
+                indices[x * 3 + c] = (int) value;
+            }
+        }
+
+        unsigned char * row = map->data + (size_t)y * map->width * 4;
+        for (int x = 0; x < film->width; ++ x) {
+            row[x * 4 + 0] = toneMapLut[indices[x * 3 + 0]];
+            row[x * 4 + 1] = toneMapLut[indices[x * 3 + 1]];
+            row[x * 4 + 2] = toneMapLut[indices[x * 3 + 2]];
+            row[x * 4 + 3] = 255;
+        }
+    }
+
+    free (indices);
+}
+
+bool writeFilmPFM (const Film * film, const char * path) {
+    FILE * file = fopen (path, "wb");
+    if (!file) return false;
+
+    //a negative scale marks little endian data; rows run bottom to top
+    fprintf (file, "PF\n%d %d\n-1.0\n", film->width, film->height);
+
+    float * row = malloc ((size_t)film->width * 3 * sizeof(float));
+    for (int y = film->height - 1; y >= 0; -- y) {
+        for (int x = 0; x < film->width; ++ x) {
+            Vector pixel = getFilmPixel (film, x, y);
+            row[x * 3 + 0] = (float) pixel.x;
+            row[x * 3 + 1] = (float) pixel.y;
+            row[x * 3 + 2] = (float) pixel.z;
+        }
+        fwrite (row, sizeof(float) * 3, film->width, file);
+    }
+    free (row);
+
+    return fclose (file) == 0;
+}
+
+/* saved films keep the raw sums, weights and counts so a render can be resumed or merged later */
+
+bool saveFilm (const Film * film, const char * path) {
+    FILE * file = fopen (path, "wb");
+    if (!file) return false;
+
+    size_t numPixels = (size_t)film->width * film->height;
+    int header[3] = {film->width, film->height, (int) film->filter.type};
+    bool written = fwrite (FILM_FILE_MAGIC, 1, strlen (FILM_FILE_MAGIC), file) == strlen (FILM_FILE_MAGIC) &&
+                   fwrite (header, sizeof(int), 3, file) == 3 &&
+                   fwrite (&film->filter.radius, sizeof(double), 1, file) == 1 &&
+                   fwrite (film->radiance, sizeof(float), numPixels * 3, file) == numPixels * 3 &&
+                   fwrite (film->weights, sizeof(float), numPixels, file) == numPixels &&
+                   fwrite (film->sampleCounts, sizeof(uint32_t), numPixels, file) == numPixels;
+
+    return (fclose (file) == 0) && written;
+}
+
+Film * loadFilm (const char * path) {
+    FILE * file = fopen (path, "rb");
+    if (!file) return NULL;
+
+    char magic[sizeof(FILM_FILE_MAGIC)] = {0};
+    int header[3];
+    PixelFilter filter;
+    if (fread (magic, 1, strlen (FILM_FILE_MAGIC), file) != strlen (FILM_FILE_MAGIC) || strcmp (magic, FILM_FILE_MAGIC) != 0 ||
+        fread (header, sizeof(int), 3, file) != 3 || fread (&filter.radius, sizeof(double), 1, file) != 1 ||
+        header[0] <= 0 || header[1] <= 0 || header[2] < FILTER_BOX || header[2] > FILTER_GAUSSIAN) {
+        fclose (file);
+        return NULL;
+    }
+    filter.type = (FilterType) header[2];
+
+    Film * film = createFilm (header[0], header[1], filter);
+    size_t numPixels = (size_t)film->width * film->height;
+    bool read = fread (film->radiance, sizeof(float), numPixels * 3, file) == numPixels * 3 &&
+                fread (film->weights, sizeof(float), numPixels, file) == numPixels &&
+                fread (film->sampleCounts, sizeof(uint32_t), numPixels, file) == numPixels;
+    fclose (file);
+
+    if (!read) {
+        freeFilm (film);
+        return NULL;
+    }
+    return film;
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef FILM_H
+#define FILM_H
+
+#include "vectorMath.h"
+#include "pixelMap.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TONE_MAP_LUT_SIZE 65536
+
+typedef enum {
+    FILTER_BOX,
+    FILTER_TENT,
+    FILTER_GAUSSIAN
+} FilterType;
+
+typedef struct {
+    FilterType type;
+    double radius; // in pixels; 0.5 keeps every sample inside its own pixel
+} PixelFilter;
+
+// linear radiance accumulated in float32; a pixel's value is radiance / weight
+typedef struct {
+    int width;
+    int height;
+    float * radiance;        // weighted rgb sums, three per pixel
+    float * weights;         // filter weight sums
+    uint32_t * sampleCounts; // samples whose position fell inside the pixel
+    PixelFilter filter;
+} Film;
+
+PixelFilter getPixelFilter (FilterType type);
+const char * getFilterName (FilterType type);
+bool parseFilterName (const char * name, FilterType * type);
+
+Film * createFilm (int width, int height, PixelFilter filter);
+void clearFilm (Film * film);
+void freeFilm (Film * film);
+
+void splatFilmSample (Film * film, double filmX, double filmY, Vector radiance, double weight);
+void setFilmPixel (Film * film, int x, int y, Vector radiance);
+Vector getFilmPixel (const Film * film, int x, int y);
+bool mergeFilm (Film * target, const Film * source);
+
+void toneMapFilm (const Film * film, double exposure, PixelMap * map);
+
+bool writeFilmPFM (const Film * film, const char * path);
+bool saveFilm (const Film * film, const char * path);
+Film * loadFilm (const char * path);
+
+#endif
\ No newline at end of file
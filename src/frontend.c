@@ -0,0 +1,418 @@
+#include "frontend.h"
+#include "threadPool.h"
+#include "wideBvh.h"
+#include "lights.h"
+#include "sceneLoader.h"
+#include "sceneCache.h"
+#include "backendCheck.h"
+#include "loaderBench.h"
+#include "memoryStats.h"
+#include "imageWriter.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+RenderOptions defaultRenderOptions () {
+    RenderOptions options;
+    options.width = 500;
+    options.height = 500;
+    options.scenePath = DEFAULT_OBJ;
+    options.materialPath = NULL;
+    options.outputPath = NULL;
+    options.saveFilmPath = NULL;
+    options.mergeFilmPath = NULL;
+    options.heatmapPath = NULL;
+    options.sceneCachePath = NULL;
+
+    options.backend = BACKEND_WIDE_BVH;
+    options.bvhQuality = BVH_QUALITY_BALANCED;
+    options.wideWidth = 0;
+    options.simdLevel = -1;
+    options.lightSampler = -1;
+
+    options.integrator = INTEGRATOR_PATH;
+    options.engine = ENGINE_TILES;
+    options.wavefrontSize = 0;
+    options.samplesPerPixel = TOTAL_SAMPLES;
+    options.adaptiveThreshold = 0;
+    options.minSamples = 0;
+    options.maxSamples = 0;
+    options.lightSamples = DEFAULT_LIGHT_SAMPLES;
+    options.multipleImportance = true;
+    options.maxDepth = MAX_BOUNCES;
+    options.rouletteDepth = DEFAULT_ROULETTE_DEPTH;
+    options.numThreads = getProcessorCount();
+    options.numChains = MLT_DEFAULT_CHAINS;
+    options.seed = DEFAULT_SEED;
+    options.primaryPackets = true;
+    options.filter = FILTER_BOX;
+    options.exposure = 0;
+    options.checkBackends = false;
+    options.checkThreads = false;
+    options.loaderBenchTriangles = 0;
+    options.progressive = true;
+    return options;
+}
+
+static bool parsePositiveCount (const char * flag, const char * value, int * count) {
+    *count = strtol(value, NULL, 10);
+    if (*count < 1) {
+        fprintf (stderr, "%s expects a positive count\n", flag);
+        return false;
+    }
+    return true;
+}
+
+bool parseRenderOptions (int argc, char ** argv, RenderOptions * options) {
+    int positional = 0;
+    for (int i = 1; i < argc; ++ i) {
+        const char * flag = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp (flag, "--scene") == 0 && hasValue) {
+            options->scenePath = argv[++ i];
+        } else if (strcmp (flag, "--mtl") == 0 && hasValue) {
+            options->materialPath = argv[++ i];
+        } else if (strcmp (flag, "--scene-cache") == 0 && hasValue) {
+            options->sceneCachePath = argv[++ i];
+        } else if ((strcmp (flag, "--output") == 0 || strcmp (flag, "-o") == 0) && hasValue) {
+            options->outputPath = argv[++ i];
+        } else if (strcmp (flag, "--save-film") == 0 && hasValue) {
+            options->saveFilmPath = argv[++ i];
+        } else if (strcmp (flag, "--merge-film") == 0 && hasValue) {
+            options->mergeFilmPath = argv[++ i];
+        } else if (strcmp (flag, "--spp-heatmap") == 0 && hasValue) {
+            options->heatmapPath = argv[++ i];
+        } else if (strcmp (flag, "--filter") == 0 && hasValue) {
+            if (!parseFilterName (argv[++ i], &options->filter)) {
+                fprintf (stderr, "Unknown filter '%s' (expected box, tent or gaussian)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp (flag, "--exposure") == 0 && hasValue) {
+            options->exposure = strtod(argv[++ i], NULL);
+        } else if (strcmp (flag, "--backend") == 0 && hasValue) {
+            if (!parseBackendName (argv[++ i], &options->backend)) {
+                fprintf (stderr, "Unknown backend '%s' (expected wide, bvh or brute)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp (flag, "--bvh-quality") == 0 && hasValue) {
+            if (!parseBVHQualityName (argv[++ i], &options->bvhQuality)) {
+                fprintf (stderr, "Unknown BVH quality '%s' (expected fast, balanced or high)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp (flag, "--wide-width") == 0 && hasValue) {
+            options->wideWidth = strtol(argv[++ i], NULL, 10);
+            if (options->wideWidth != 4 && options->wideWidth != 8) {
+                fprintf (stderr, "--wide-width expects 4 or 8\n");
+                return false;
+            }
+        } else if (strcmp (flag, "--simd") == 0 && hasValue) {
+            SimdLevel level;
+            if (!parseSimdLevelName (argv[++ i], &level)) {
+                fprintf (stderr, "Unknown SIMD level '%s' (expected avx2, sse or scalar)\n", argv[i]);
+                return false;
+            }
+            options->simdLevel = level;
+        } else if (strcmp (flag, "--threads") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->numThreads)) return false;
+        } else if (strcmp (flag, "--integrator") == 0 && hasValue) {
+            if (!parseIntegratorName (argv[++ i], &options->integrator)) {
+                fprintf (stderr, "Unknown integrator '%s' (expected path or mlt)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp (flag, "--engine") == 0 && hasValue) {
+            if (!parseEngineName (argv[++ i], &options->engine)) {
+                fprintf (stderr, "Unknown engine '%s' (expected tiles or wavefront)\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp (flag, "--wavefront-size") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->wavefrontSize)) return false;
+        } else if (strcmp (flag, "--spp") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->samplesPerPixel)) return false;
+        } else if (strcmp (flag, "--adaptive") == 0 && hasValue) {
+            options->adaptiveThreshold = strtod(argv[++ i], NULL);
+            if (options->adaptiveThreshold <= 0) {
+                fprintf (stderr, "--adaptive expects a positive relative error, e.g. 0.05\n");
+                return false;
+            }
+        } else if (strcmp (flag, "--min-spp") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->minSamples)) return false;
+        } else if (strcmp (flag, "--max-spp") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->maxSamples)) return false;
+        } else if (strcmp (flag, "--light-samples") == 0 && hasValue) {
+            options->lightSamples = strtol(argv[++ i], NULL, 10);
+            if (options->lightSamples < 0) {
+                fprintf (stderr, "--light-samples expects a count, 0 turns shadow rays off\n");
+                return false;
+            }
+        } else if (strcmp (flag, "--light-sampler") == 0 && hasValue) {
+            LightSamplerType type;
+            if (!parseLightSamplerName (argv[++ i], &type)) {
+                fprintf (stderr, "Unknown light sampler '%s' (expected power or bvh)\n", argv[i]);
+                return false;
+            }
+            options->lightSampler = type;
+        } else if (strcmp (flag, "--max-depth") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->maxDepth)) return false;
+        } else if (strcmp (flag, "--roulette-depth") == 0 && hasValue) {
+            options->rouletteDepth = strtol(argv[++ i], NULL, 10);
+            if (options->rouletteDepth < 0) {
+                fprintf (stderr, "--roulette-depth expects a count, 0 turns russian roulette off\n");
+                return false;
+            }
+        } else if (strcmp (flag, "--no-mis") == 0) {
+            options->multipleImportance = false;
+        } else if (strcmp (flag, "--chains") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->numChains)) return false;
+        } else if (strcmp (flag, "--seed") == 0 && hasValue) {
+            options->seed = strtoull(argv[++ i], NULL, 10);
+        } else if (strcmp (flag, "--no-packets") == 0) {
+            options->primaryPackets = false;
+        } else if (strcmp (flag, "--no-progressive") == 0) {
+            options->progressive = false;
+        } else if (strcmp (flag, "--check-backends") == 0) {
+            options->checkBackends = true;
+        } else if (strcmp (flag, "--check-threads") == 0) {
+            options->checkThreads = true;
+        } else if (strcmp (flag, "--bench-loader") == 0 && hasValue) {
+            if (!parsePositiveCount (flag, argv[++ i], &options->loaderBenchTriangles)) return false;
+        } else if (flag[0] == '-') {
+            fprintf (stderr, "Unknown option '%s'\n", flag);
+            return false;
+        } else if (positional == 0) {
+            if (!parsePositiveCount ("width", flag, &options->width)) return false;
+            positional ++;
+        } else if (positional == 1) {
+            if (!parsePositiveCount ("height", flag, &options->height)) return false;
+            positional ++;
+        } else {
+            fprintf (stderr, "Unexpected argument '%s'\n", flag);
+            return false;
+        }
+    }
+    ImageFormat format;
+    if (options->outputPath && !getImageFormat (options->outputPath, &format)) {
+        fprintf (stderr, "Unknown image format for '%s' (expected .ppm, .pfm or .png)\n", options->outputPath);
+        return false;
+    }
+    if (options->heatmapPath && !getImageFormat (options->heatmapPath, &format)) {
+        fprintf (stderr, "Unknown image format for '%s' (expected .ppm, .pfm or .png)\n", options->heatmapPath);
+        return false;
+    }
+    if (options->minSamples > 0 && options->maxSamples > 0 && options->minSamples > options->maxSamples) {
+        fprintf (stderr, "--min-spp is larger than --max-spp\n");
+        return false;
+    }
+    if (options->engine == ENGINE_WAVEFRONT && options->adaptiveThreshold > 0) {
+        fprintf (stderr, "--adaptive needs the tiles engine\n");
+        return false;
+    }
+    return true;
+}
+
+void printRenderOptionsUsage (const char * program) {
+    fprintf (stderr,
+             "usage: %s [width height] [options]\n"
+             "  --scene file.obj       scene to render (default %s)\n"
+             "  --mtl file.mtl         materials (default: the scene path with .mtl, else the OBJ's mtllib)\n"
+             "  --scene-cache file     load the compiled scene from file, writing it first when missing or out of date\n"
+             "  --output, -o file      image to write; .ppm, .pfm or .png\n"
+             "  --exposure stops       exposure applied when tone mapping (default 0)\n"
+             "  --filter box|tent|gaussian\n"
+             "  --save-film file       keep the raw film so the render can be merged or resumed\n"
+             "  --merge-film file      add a saved film of the same size to this render\n"
+             "  --spp n                samples per pixel; with --adaptive, the average\n"
+             "  --adaptive error       stop each pixel once its relative standard error is below this\n"
+             "  --min-spp n            adaptive: samples every pixel gets first (default %d)\n"
+             "  --max-spp n            adaptive: most samples one pixel may take (default %d x --spp)\n"
+             "  --spp-heatmap file     write the samples taken per pixel as an image\n"
+             "  --light-samples n      shadow rays per diffuse vertex (default %d, 0 finds the light by bouncing only)\n"
+             "  --light-sampler power|bvh  pick lights by power alone or by a light BVH (default: bvh from %d lights)\n"
+             "  --max-depth n          path vertices at most (default %d)\n"
+             "  --roulette-depth n     vertices before russian roulette may end a path (default %d, 0 = off)\n"
+             "  --no-mis               count the light through shadow rays only instead of weighting both strategies\n"
+             "  --threads n            worker threads (default: all processors)\n"
+             "  --integrator path|mlt\n"
+             "  --engine tiles|wavefront  path integrator: trace each path to its end, or whole batches a bounce at a time\n"
+             "  --wavefront-size n     paths per wavefront batch (default %d per thread)\n"
+             "  --chains n             Markov chains for mlt\n"
+             "  --seed n\n"
+             "  --backend wide|bvh|brute\n"
+             "  --bvh-quality fast|balanced|high\n"
+             "  --wide-width 4|8\n"
+             "  --simd avx2|sse|scalar\n"
+             "  --no-packets           trace camera rays (wavefront: all rays) one at a time\n"
+             "  --no-progressive       viewer only: show the image once it is finished\n"
+             "  --check-backends       compare every backend against brute force before rendering, failing on a mismatch\n"
+             "  --check-threads        reload the scene and rebuild the BVH on one thread, failing unless both match\n"
+             "  --bench-loader n       time reading a generated OBJ of n triangles before loading the scene\n",
+             program, DEFAULT_OBJ, ADAPTIVE_MIN_SAMPLES, ADAPTIVE_MAX_SCALE, DEFAULT_LIGHT_SAMPLES, LIGHT_BVH_MIN_LIGHTS, MAX_BOUNCES, DEFAULT_ROULETTE_DEPTH,
+             WAVEFRONT_PATHS_PER_THREAD);
+}
+
+void applySceneOptions (const RenderOptions * options, Scene * scene) {
+    scene->backend = options->backend;
+    scene->bvhSettings = getBVHBuildSettings (options->bvhQuality);
+    scene->bvhSettings.numThreads = options->numThreads;
+    scene->bvhSettings.wideWidth = options->wideWidth;
+    scene->bvhSettings.simdLevel = options->simdLevel;
+    scene->lightSampler = options->lightSampler;
+}
+
+const char * getMaterialPath (const RenderOptions * options, char * buffer, size_t size) {
+    if (options->materialPath) return options->materialPath;
+
+    //scene.obj pairs with scene.mtl next to it
+    snprintf (buffer, size, "%s", options->scenePath);
+    char * extension = strrchr (buffer, '.');
+    char * separator = strrchr (buffer, '/');
+    if (extension && (!separator || extension > separator) && (size_t)(extension - buffer) + 5 <= size) {
+        strcpy (extension, ".mtl");
+    } else if (strlen (buffer) + 5 <= size) {
+        strcat (buffer, ".mtl");
+    }
+    return buffer;
+}
+
+RenderSettings getRenderSettings (const RenderOptions * options) {
+    RenderSettings settings = defaultRenderSettings (options->width, options->height);
+    settings.numThreads = options->numThreads;
+    settings.seed = options->seed;
+    settings.samplesPerPixel = options->samplesPerPixel;
+    settings.adaptiveThreshold = options->adaptiveThreshold;
+    settings.minSamples = options->minSamples;
+    settings.maxSamples = options->maxSamples;
+    settings.path.lightSamples = options->lightSamples;
+    settings.path.multipleImportance = options->multipleImportance;
+    settings.path.maxDepth = options->maxDepth;
+    settings.path.rouletteDepth = options->rouletteDepth;
+    settings.integrator = options->integrator;
+    settings.engine = options->engine;
+    settings.wavefrontSize = options->wavefrontSize;
+    settings.numChains = options->numChains;
+    settings.primaryPackets = options->primaryPackets;
+    settings.filter = getPixelFilter (options->filter);
+    return settings;
+}
+
+Camera * loadSceneFromOptions (const RenderOptions * options, Scene * scene) {
+    char materialBuffer[4096];
+    const char * materialPath = getMaterialPath (options, materialBuffer, sizeof(materialBuffer));
+    applySceneOptions (options, scene);
+    if (options->loaderBenchTriangles > 0) reportLoaderBenchmark (options->loaderBenchTriangles, options->numThreads);
+
+    double start = getTimeSeconds();
+    //hashed before loading, since the load resolves settings (the light sampler) the hash covers as requested
+    uint64_t sourceHash = options->sceneCachePath ? getSceneSourceHash (scene, options->scenePath, materialPath) : 0;
+    bool cached = sourceHash != 0 && loadSceneCache (scene, options->sceneCachePath, sourceHash);
+    if (!cached && !loadScene (scene, options->scenePath, materialPath)) {
+        fprintf (stderr, "Failed to load scene: %s\n", options->scenePath);
+        return NULL;
+    }
+
+    fprintf (stderr, "Loaded: %d triangles, %d spheres, %d materials in %.3f seconds%s\n",
+             scene->numTriangles, scene->numSpheres, scene->numMaterials, getTimeSeconds() - start, cached ? " from the scene cache" : "");
+    if (options->sceneCachePath && !cached) {
+        if (saveSceneCache (scene, options->sceneCachePath, sourceHash)) fprintf (stderr, "Wrote scene cache %s\n", options->sceneCachePath);
+        else fprintf (stderr, "Failed to write scene cache: %s\n", options->sceneCachePath);
+    }
+    fprintf (stderr, "Mesh: %d vertices (%s), %.1f KB, %.1f bytes per triangle\n", scene->numVertices,
+             sizeof(Real) == sizeof(float) ? "float" : "double", getMeshBytes (scene) / 1024.0,
+             scene->numTriangles > 0 ? (double) getMeshBytes (scene) / scene->numTriangles : 0.0);
+    fprintf (stderr, "Memory: %.1f MB peak resident after loading\n", getPeakResidentBytes () / 1e6);
+    if (!cached) printSceneMemoryStats (scene);
+    printBVHStats (scene);
+    printWideBVHStats (scene);
+    printLightStats (scene);
+    fprintf (stderr, "\n");
+
+    Camera * cam = createCamera(options->width, options->height);
+    frameScene(scene, cam);
+
+    bool checked = true;
+    if (options->checkBackends) {
+        Seed * seed = generateSeed();
+        checked = reportBackendComparison (scene, cam, seed);
+        free(seed);
+    }
+    if (options->checkThreads) {
+        checked = reportSerialBuildComparison (scene, options->scenePath, materialPath) && checked;
+    }
+    if (!checked) {
+        fprintf (stderr, "Scene check failed\n");
+        freeCamera (cam);
+        return NULL;
+    }
+
+    return cam;
+}
+
+bool finishFilmOutput (const RenderOptions * options, Film * film) {
+    if (options->mergeFilmPath) {
+        //films from other runs (another seed, another machine) add up to one render with all their samples
+        Film * previous = loadFilm (options->mergeFilmPath);
+        if (!previous || !mergeFilm (film, previous)) {
+            fprintf (stderr, "Failed to merge film: %s\n", options->mergeFilmPath);
+            freeFilm (previous);
+            return false;
+        }
+        freeFilm (previous);
+        fprintf (stderr, "Merged %s\n", options->mergeFilmPath);
+    }
+
+    if (options->saveFilmPath && !saveFilm (film, options->saveFilmPath)) {
+        fprintf (stderr, "Failed to save film: %s\n", options->saveFilmPath);
+        return false;
+    }
+
+    if (options->heatmapPath) {
+        if (!writeSampleHeatmap (film, options->heatmapPath)) {
+            fprintf (stderr, "Failed to write heatmap: %s\n", options->heatmapPath);
+            return false;
+        }
+        fprintf (stderr, "Wrote %s\n", options->heatmapPath);
+    }
+
+    if (options->outputPath) {
+        if (!writeImage (film, options->exposure, options->outputPath)) {
+            fprintf (stderr, "Failed to write image: %s\n", options->outputPath);
+            return false;
+        }
+        fprintf (stderr, "Wrote %s\n", options->outputPath);
+    }
+
+    return true;
+}
+
+Film * renderFromOptions (const RenderOptions * options, Scene * scene) {
+    Camera * cam = loadSceneFromOptions (options, scene);
+    if (!cam) return NULL;
+
+    RenderSettings settings = getRenderSettings (options);
+    char engine[32] = "";
+    if (settings.integrator == INTEGRATOR_PATH) snprintf (engine, sizeof(engine), " on the %s engine", getEngineName (settings.engine));
+    fprintf (stderr, "Rendering %d x %d at %d spp with %s integrator%s, %d threads\n\n", settings.width, settings.height,
+             settings.samplesPerPixel, getIntegratorName (settings.integrator), engine, settings.numThreads);
+
+    double start = getTimeSeconds();
+    Film * film = renderImage (scene, cam, &settings);
+    double timeSpent = getTimeSeconds() - start;
+    freeCamera(cam);
+
+    fprintf(stderr, "Rendered %d x %d pixels in %f seconds.\n", settings.width, settings.height, timeSpent);
+    //adaptive sampling takes a different number of samples per pixel, so count what the film received
+    double samples = 0;
+    for (size_t i = 0; i < (size_t)film->width * film->height; ++ i) {
+        samples += film->sampleCounts[i];
+    }
+    if (settings.integrator != INTEGRATOR_PATH) samples = (double)settings.width * settings.height * settings.samplesPerPixel;
+    double raysPerSecond = samples / timeSpent;
+    fprintf(stderr, "Rendered %f rays per second.\n", raysPerSecond);
+
+    if (!finishFilmOutput (options, film)) {
+        freeFilm (film);
+        return NULL;
+    }
+    return film;
+}
\ No newline at end of file
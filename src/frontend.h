@@ -0,0 +1,65 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include "renderer.h"
+#include "bvh.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// command line settings shared by the viewer and the headless renderer
+typedef struct {
+    int width;
+    int height;
+    const char * scenePath;
+    const char * materialPath;
+    const char * outputPath;
+    const char * saveFilmPath;
+    const char * mergeFilmPath;
+    const char * heatmapPath; // samples per pixel, mostly of interest with adaptive sampling
+    const char * sceneCachePath; // compiled scene to load from, or to write when it is missing or stale
+
+    IntersectionBackend backend;
+    BVHQuality bvhQuality;
+    int wideWidth;
+    int simdLevel;
+    int lightSampler; // LightSamplerType, -1 picks from the light count
+
+    Integrator integrator;
+    RenderEngine engine;
+    int wavefrontSize;
+    int samplesPerPixel;
+    double adaptiveThreshold;
+    int minSamples;
+    int maxSamples;
+    int lightSamples;
+    bool multipleImportance;
+    int maxDepth;
+    int rouletteDepth;
+    int numThreads;
+    int numChains;
+    uint64_t seed;
+    bool primaryPackets;
+    FilterType filter;
+    double exposure; // stops applied when tone mapping
+    bool checkBackends;
+    bool checkThreads; // reload and rebuild on one thread and compare with the threaded results
+    int loaderBenchTriangles; // 0 skips the loader benchmark
+    bool progressive; // viewer refreshes while passes of one sample each come in
+} RenderOptions;
+
+RenderOptions defaultRenderOptions ();
+bool parseRenderOptions (int argc, char ** argv, RenderOptions * options);
+void printRenderOptionsUsage (const char * program);
+
+const char * getMaterialPath (const RenderOptions * options, char * buffer, size_t size);
+void applySceneOptions (const RenderOptions * options, Scene * scene);
+RenderSettings getRenderSettings (const RenderOptions * options);
+
+Camera * loadSceneFromOptions (const RenderOptions * options, Scene * scene); // NULL if the scene fails to load or a requested check fails
+bool finishFilmOutput (const RenderOptions * options, Film * film); // merges, saves and writes as requested
+
+// loads the scene, prints its stats, renders, and writes the image when an output path is set
+Film * renderFromOptions (const RenderOptions * options, Scene * scene);
+
+#endif
\ No newline at end of file
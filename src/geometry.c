@@ -1,20 +1,26 @@
 #include "geometry.h"
+#include "bvh.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-Triangle createTriangle (Point p1, Point p2, Point p3, int materialId) {
+Triangle createTriangle (int v1, int v2, int v3, int materialId) {
     Triangle newTriangle;
-    newTriangle.p1 = p1;
-    newTriangle.p2 = p2;
-    newTriangle.p3 = p3;
-    newTriangle.edge1 = getVector (p1, p2);
-    newTriangle.edge2 = getVector (p1, p3);
-    newTriangle.edge3 = getVector (p2, p3);
-    newTriangle.normal = normalizeVector (crossProduct (newTriangle.edge1, newTriangle.edge2));
+    newTriangle.vertices[0] = v1;
+    newTriangle.vertices[1] = v2;
+    newTriangle.vertices[2] = v3;
     newTriangle.materialId = materialId;
     return newTriangle;
 }
 
+Vector getTriangleNormal (const Scene * scene, const Triangle * triangle) {
+    //recomputed from the shared vertices when a hit needs it rather than stored with every triangle
+    Point p1 = getVertex (scene, triangle->vertices[0]);
+    Vector edge1 = getVector (p1, getVertex (scene, triangle->vertices[1]));
+    Vector edge2 = getVector (p1, getVertex (scene, triangle->vertices[2]));
+    return normalizeVector (crossProduct (edge1, edge2));
+}
+
 Sphere createSphere (Point center, double radius, int materialId) {
     Sphere newSphere;
     newSphere.center = center;
@@ -32,137 +38,110 @@ Material createMaterial (Vector color, Vector emission, MaterialType type, doubl
     return newMaterial;
 }
 
-void addTriangle (Scene * scene, Triangle triangle) {
-    if (scene->numTriangles == scene->trianglesCapacity) {
-        scene->trianglesCapacity = scene->trianglesCapacity * 2;
-        Triangle * temp = realloc (scene->triangles, scene->trianglesCapacity * sizeof(*(scene->triangles)));
-        if (temp == NULL) {
-            return;
-        }
-        scene->triangles = temp;
+/* the growable arrays double inside the scene's arena. the newest allocation grows where it lies, so
+ * an array that is added to alone doesn't move; one that does leaves its old copy to the arena */
+
+static bool growSceneArray (Scene * scene, void ** array, int * capacity, size_t elementSize) {
+    //the capacity only changes once the larger block exists, so a failed add leaves the scene as it was
+    int newCapacity = *capacity * 2;
+    void * temp = arenaResize (&scene->arena, MEMORY_MESH, *array, *capacity * elementSize, newCapacity * elementSize);
+    if (temp == NULL) {
+        //likely due to being out of memory
+        return false;
+    }
+    *array = temp;
+    *capacity = newCapacity;
+    return true;
+}
+
+int addVertex (Scene * scene, Point point) {
+    if (scene->numVertices == scene->verticesCapacity &&
+        !growSceneArray (scene, (void **) &scene->vertices, &scene->verticesCapacity, sizeof(*(scene->vertices)))) {
+        return -1;
+    }
+    scene->vertices[scene->numVertices] = (Vertex){(Real) point.x, (Real) point.y, (Real) point.z};
+    return scene->numVertices ++;
+}
+
+bool addTriangle (Scene * scene, Triangle triangle) {
+    if (scene->numTriangles == scene->trianglesCapacity &&
+        !growSceneArray (scene, (void **) &scene->triangles, &scene->trianglesCapacity, sizeof(*(scene->triangles)))) {
+        return false;
     }
     scene->triangles[scene->numTriangles] = triangle;
     scene->numTriangles ++;
+    return true;
+}
+
+size_t getMeshBytes (const Scene * scene) {
+    return (size_t)scene->numVertices * sizeof(Vertex) + (size_t)scene->numTriangles * sizeof(Triangle);
 }
 
-void addSphere (Scene * scene, Sphere sphere) {
-    if (scene->numSpheres == scene->spheresCapacity) {
-        scene->spheresCapacity = scene->spheresCapacity * 2;
-        Sphere * temp = realloc (scene->spheres, scene->spheresCapacity * sizeof(*(scene->spheres)));
-        if (temp == NULL) {
-            //likely due to being out of memory
-            return;
-        }
-        scene->spheres = temp;
+bool addSphere (Scene * scene, Sphere sphere) {
+    if (scene->numSpheres == scene->spheresCapacity &&
+        !growSceneArray (scene, (void **) &scene->spheres, &scene->spheresCapacity, sizeof(*(scene->spheres)))) {
+        return false;
     }
     scene->spheres[scene->numSpheres] = sphere;
     scene->numSpheres ++;
+    return true;
 }
 
-void addMaterial (Scene * scene, Material material) {
-    if (scene->numMaterials == scene->materialsCapacity) {
-        scene->materialsCapacity = scene->materialsCapacity * 2;
-        Material * temp = realloc (scene->materials, scene->materialsCapacity * sizeof(*(scene->materials)));
-        if (temp == NULL) {
-            //likely due to being out of memory
-            return;
-        }
-        scene->materials = temp;
+bool addMaterial (Scene * scene, Material material) {
+    if (scene->numMaterials == scene->materialsCapacity &&
+        !growSceneArray (scene, (void **) &scene->materials, &scene->materialsCapacity, sizeof(*(scene->materials)))) {
+        return false;
     }
     scene->materials[scene->numMaterials] = material;
     scene->numMaterials ++;
+    return true;
 }
 
 Scene * initScene () {
     Scene * newScene = calloc (1, sizeof(Scene));
+    if (!newScene) return NULL;
+    initArena (&newScene->arena);
 
     int initialCapacity = 100;
+    newScene->verticesCapacity = initialCapacity;
     newScene->spheresCapacity = initialCapacity;
     newScene->trianglesCapacity = initialCapacity;
     newScene->materialsCapacity = initialCapacity;
 
-    newScene->triangles = malloc (sizeof(Triangle) * newScene->trianglesCapacity);
-    newScene->spheres = malloc (sizeof(Sphere) * newScene->spheresCapacity);
-    newScene->materials = malloc (sizeof(Material) * newScene->materialsCapacity);
+    newScene->vertices = arenaAlloc (&newScene->arena, MEMORY_MESH, sizeof(Vertex) * newScene->verticesCapacity);
+    newScene->triangles = arenaAlloc (&newScene->arena, MEMORY_MESH, sizeof(Triangle) * newScene->trianglesCapacity);
+    newScene->spheres = arenaAlloc (&newScene->arena, MEMORY_MESH, sizeof(Sphere) * newScene->spheresCapacity);
+    newScene->materials = arenaAlloc (&newScene->arena, MEMORY_MESH, sizeof(Material) * newScene->materialsCapacity);
+    if (!newScene->vertices || !newScene->triangles || !newScene->spheres || !newScene->materials) {
+        freeScene (newScene);
+        return NULL;
+    }
+
+    newScene->backend = BACKEND_WIDE_BVH;
+    newScene->bvhSettings = getBVHBuildSettings (BVH_QUALITY_BALANCED);
+    newScene->lightSampler = -1;
 
     return newScene;
 }
 
 void freeScene (Scene * scene) {
     if (!scene) return;
-    free (scene->spheres);
-    free (scene->triangles);
-    free (scene->materials);
-    free (scene->root);
+    if (scene->cacheFile) {
+        unmapFile (scene->cacheFile);
+        free (scene->cacheFile);
+    }
+    //every array the scene built is in its arena, so this is the whole teardown
+    freeArena (&scene->arena);
     free (scene);
 }
 
-void detectLight (Scene * scene) {
-    scene->hasLight = false;
-
-    int lightMaterial = -1;
-    for (int i = 0; i < scene->numMaterials; ++ i) {
-        if (maxComponent (scene->materials[i].emission) > 0) {
-            lightMaterial = i;
-            break;
-        }
+void printSceneMemoryStats (const Scene * scene) {
+    const MemoryUsage * usage = &scene->arena.usage;
+    fprintf (stderr, "Scene memory: %.1f MB held in %d arena blocks (", scene->arena.heldBytes / 1e6, scene->arena.numBlocks);
+    for (int i = 0; i < NUM_MEMORY_SUBSYSTEMS; ++ i) {
+        if (i == MEMORY_BUILD_SCRATCH) continue;
+        fprintf (stderr, "%s%s %.2f MB in %zu", i > 0 ? ", " : "", getMemorySubsystemName (i), usage->bytes[i] / 1e6, usage->allocations[i]);
     }
-    if (lightMaterial < 0) return;
-    scene->lightMaterialId = lightMaterial;
-
-    int lightTriangles[8];
-    int numLightTriangles = 0;
-    for (int i = 0; i < scene->numTriangles && numLightTriangles < 8; ++ i) {
-        if (scene->triangles[i].materialId == lightMaterial) {
-            lightTriangles[numLightTriangles ++] = i;
-        }
-    }
-
-    if (numLightTriangles == 2) {
-        Triangle * t0 = &scene->triangles[lightTriangles[0]];
-        Triangle * t1 = &scene->triangles[lightTriangles[1]];
-
-        Point t0Verts[3] = {t0->p1, t0->p2, t0->p3};
-        Point t1Verts[3] = {t1->p1, t1->p2, t1->p3};
-        Point uniqueVertex = t1Verts[0];
-        int found = 0;
-
-        for (int i = 0; i < 3 && !found; ++ i) {
-            int inFirstTriangle = 0;
-            for (int j = 0; j < 3; ++ j) {
-                Vector diff = getVector (t1Verts[i], t0Verts[j]);
-                if (vectorLengthSquared (diff) < 1e-8) {
-                    inFirstTriangle = 1;
-                    break;
-                }
-            }
-            if (!inFirstTriangle) {
-                uniqueVertex = t1Verts[i];
-                found = 1;
-            }
-        }
-
-        if (found) {
-            scene->lightEdge1 = getVector (t0->p1, t0->p2);
-            scene->lightEdge2 = getVector (t0->p1, uniqueVertex);
-
-            Point lightCorner = t0->p1;
-            Vector halfE1 = scaleVector(scene->lightEdge1, 0.5);
-            Vector halfE2 = scaleVector(scene->lightEdge2, 0.5);
-            scene->lightVertex = movePoint(lightCorner, addVector(halfE1, halfE2));
-
-            scene->lightNormal = t0->normal;
-            scene->lightArea = vectorLength (crossProduct (scene->lightEdge1, scene->lightEdge2));
-            scene->hasLight = true;
-        }
-    } else if (numLightTriangles == 1) {
-        Triangle * t = &scene->triangles[lightTriangles[0]];
-        scene->lightEdge1 = getVector (t->p1, t->p2);
-        scene->lightEdge2 = getVector (t->p1, t->p3);
-        scene->lightVertex = t->p1;
-        scene->lightNormal = t->normal;
-        scene->lightArea = 0.5 * vectorLength (crossProduct (scene->lightEdge1, scene->lightEdge2));
-        scene->hasLight = true;
-    }
-}
-
+    fprintf (stderr, "), build scratch peaked at %.2f MB over %zu allocations, all released\n",
+             scene->scratchPeakBytes / 1e6, scene->scratchUsage.allocations[MEMORY_BUILD_SCRATCH]);
+}
\ No newline at end of file
@@ -2,7 +2,10 @@
 #define GEOMETRY_H
 
 #include "vectorMath.h"
+#include "mappedFile.h"
+#include "arena.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef enum {
     MATERIAL_DIFFUSE,
@@ -17,10 +20,20 @@ typedef struct {
     double indexOfRefraction;
 } Material;
 
+// stored geometry precision; building with -DFLOAT_GEOMETRY (make render-float) keeps vertices in single precision
+#ifdef FLOAT_GEOMETRY
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 typedef struct {
-    Point p1, p2, p3;
-    Vector edge1, edge2, edge3;
-    Vector normal;
+    Real x, y, z;
+} Vertex;
+
+// indices into the scene's shared vertices, wound counter clockwise around the normal
+typedef struct {
+    int vertices[3];
     int materialId;
 } Triangle;
 
@@ -36,8 +49,41 @@ typedef struct {
 } BoundingBox;
 
 typedef struct _BVHNode BVHNode; 
+typedef struct _WideBVHNode WideBVHNode;
+typedef struct _LightBVHNode LightBVHNode;
+
+// an emissive triangle, with the geometry copied next to what the light sampler reads
+typedef struct {
+    Point corner;
+    Vector edge1, edge2;
+    Vector normal;
+    Vector emission;
+    double area;
+    double power; // luminance of the emitted flux
+    int triangle;
+} Light;
 
 typedef struct {
+    int numBins;
+    int maxLeafSize;
+    double traversalCost; // relative to one primitive intersection
+    bool splitAllAxes;
+    int numThreads;
+    int wideWidth; // 4 or 8 children per wide node, 0 picks from the SIMD level
+    int simdLevel; // SimdLevel for the wide box test, -1 detects it at runtime
+} BVHBuildSettings;
+
+typedef enum {
+    BACKEND_BRUTE_FORCE,
+    BACKEND_BVH,
+    BACKEND_WIDE_BVH
+} IntersectionBackend;
+
+typedef struct {
+    Vertex * vertices;
+    int numVertices;
+    int verticesCapacity;
+
     Triangle * triangles;
     int numTriangles;
     int trianglesCapacity;
@@ -50,32 +96,59 @@ typedef struct {
     int numMaterials;
     int materialsCapacity;
 
-    BVHNode * root;
+    BVHNode * bvhNodes;
+    int numBVHNodes;
+    int * bvhPrimitives; // leaf order; ids below numTriangles are triangles, the rest spheres
+    int numBVHPrimitives;
+    BVHBuildSettings bvhSettings;
+    double bvhBuildTime;
+    WideBVHNode * wideBVHNodes; // collapsed from bvhNodes, leaves share bvhPrimitives
+    int numWideBVHNodes;
+    int wideBVHWidth;
+    int simdLevel; // SimdLevel picked at load for the wide box test and ray packets
+    double wideBVHBuildTime;
+    IntersectionBackend backend;
 
     BoundingBox boundingBox;
-    Point lightVertex;
-    Vector lightEdge1;
-    Vector lightEdge2;
-    Vector lightNormal;
-    double lightArea;
-    int lightMaterialId;
-    bool hasLight;
+    Light * lights; // every emissive triangle
+    int numLights;
+    int * triangleLights; // light index of each triangle, -1 when it does not emit
+    double * lightPmf;    // power / total power, what the alias table draws with
+    double * lightAliasProbability;
+    int * lightAlias;
+    LightBVHNode * lightBVHNodes;
+    int numLightBVHNodes;
+    int lightSampler; // LightSamplerType, -1 until buildLights picks one from the light count
+    double lightBuildTime;
+
+    MappedFile * cacheFile; // when the scene came from a compiled scene file, every array above points into it
+    Arena arena; // otherwise they live here, and go with it in one release
+    MemoryUsage scratchUsage; // what the builds allocated while they ran, all released since
+    size_t scratchPeakBytes; // most the builds held at once
 
 } Scene;
 
 
 
-Triangle createTriangle (Point p1, Point p2, Point p3, int materialId);
+static inline Point getVertex (const Scene * scene, int index) {
+    const Vertex * vertex = &scene->vertices[index];
+    return (Point){vertex->x, vertex->y, vertex->z};
+}
+
+Triangle createTriangle (int v1, int v2, int v3, int materialId);
 Sphere createSphere (Point center, double radius, int materialId);
 Material createMaterial (Vector color, Vector emission, MaterialType type, double indexOfRefraction);
 
-void addTriangle (Scene * scene, Triangle triangle);
-void addSphere (Scene * scene, Sphere sphere);
-void addMaterial (Scene * scene, Material material);
+int addVertex (Scene * scene, Point point); // index of the new vertex, -1 if out of memory
+bool addTriangle (Scene * scene, Triangle triangle); // false, with the scene unchanged, when out of memory
+Vector getTriangleNormal (const Scene * scene, const Triangle * triangle);
+size_t getMeshBytes (const Scene * scene);
+bool addSphere (Scene * scene, Sphere sphere);
+bool addMaterial (Scene * scene, Material material);
 
-Scene * initScene(); 
+Scene * initScene(); // NULL if out of memory
 void freeScene (Scene * scene);
-void detectLight (Scene * scene);
+void printSceneMemoryStats (const Scene * scene);
 
 
 
@@ -0,0 +1,212 @@
+#include "imageWriter.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define PNG_STORED_BLOCK_SIZE 65535
+
+bool getImageFormat (const char * path, ImageFormat * format) {
+    const char * extension = strrchr (path, '.');
+    if (!extension) return false;
+
+    if (strcasecmp (extension, ".ppm") == 0) {
+        *format = IMAGE_FORMAT_PPM;
+    } else if (strcasecmp (extension, ".pfm") == 0) {
+        *format = IMAGE_FORMAT_PFM;
+    } else if (strcasecmp (extension, ".png") == 0) {
+        *format = IMAGE_FORMAT_PNG;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool writePPM (const PixelMap * map, const char * path) {
+    FILE * file = fopen (path, "wb");
+    if (!file) return false;
+
+    fprintf (file, "P6\n%d %d\n255\n", map->width, map->height);
+
+    unsigned char * row = malloc (map->width * 3);
+    for (int y = 0; y < map->height; ++ y) {
+        for (int x = 0; x < map->width; ++ x) {
+            memcpy (row + x * 3, map->data + (y * map->width + x) * 4, 3);
+        }
+        fwrite (row, 3, map->width, file);
+    }
+    free (row);
+
+    return fclose (file) == 0;
+}
+
+/* png
+ * written without zlib: the image data goes into stored (uncompressed) deflate blocks, so all that is
+ * needed is the zlib header, the block headers, an adler32 of the raw bytes and a crc32 per chunk. */
+
+static uint32_t crcTable[256];
+static pthread_once_t crcTableOnce = PTHREAD_ONCE_INIT; // images may be written from more than one thread
+
+static void buildCrcTable () {
+    for (uint32_t n = 0; n < 256; ++ n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++ k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crcTable[n] = c;
+    }
+}
+
+static uint32_t updateCrc (uint32_t crc, const unsigned char * bytes, size_t length) {
+    pthread_once (&crcTableOnce, buildCrcTable);
+
+    for (size_t i = 0; i < length; ++ i) {
+        crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void putBigEndian (unsigned char * bytes, uint32_t value) {
+    bytes[0] = value >> 24;
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+}
+
+static void writeChunk (FILE * file, const char * type, const unsigned char * data, size_t length) {
+    unsigned char header[8];
+    putBigEndian (header, (uint32_t) length);
+    memcpy (header + 4, type, 4);
+    fwrite (header, 1, 8, file);
+    if (length > 0) fwrite (data, 1, length, file);
+
+    uint32_t crc = updateCrc (0xFFFFFFFFu, (const unsigned char *) type, 4);
+    crc = updateCrc (crc, data, length) ^ 0xFFFFFFFFu;
+    unsigned char footer[4];
+    putBigEndian (footer, crc);
+    fwrite (footer, 1, 4, file);
+}
+
+bool writePNG (const PixelMap * map, const char * path) {
+    FILE * file = fopen (path, "wb");
+    if (!file) return false;
+
+    //every scanline starts with filter type 0 (none) followed by RGB bytes
+    size_t rowSize = 1 + (size_t) map->width * 3;
+    size_t rawSize = rowSize * map->height;
+    size_t numBlocks = rawSize / PNG_STORED_BLOCK_SIZE + 1;
+    unsigned char * stream = malloc (2 + rawSize + numBlocks * 5 + 4);
+
+    size_t length = 0;
+    stream[length ++] = 0x78; //deflate with a 32K window
+    stream[length ++] = 0x01; //no preset dictionary, header check bits
+
+    uint32_t adlerA = 1, adlerB = 0;
+    size_t blockRemaining = 0;
+    size_t rawWritten = 0;
+
+    for (int y = 0; y < map->height; ++ y) {
+        for (size_t i = 0; i < rowSize; ++ i) {
+            unsigned char value = (i == 0) ? 0 : map->data[(y * map->width + (i - 1) / 3) * 4 + (i - 1) % 3];
+
+            if (blockRemaining == 0) {
+                size_t blockSize = rawSize - rawWritten < PNG_STORED_BLOCK_SIZE ? rawSize - rawWritten : PNG_STORED_BLOCK_SIZE;
+                stream[length ++] = (rawWritten + blockSize == rawSize) ? 1 : 0; //final bit, type 00
+                stream[length ++] = blockSize & 0xFF;
+                stream[length ++] = (blockSize >> 8) & 0xFF;
+                stream[length ++] = ~blockSize & 0xFF;
+                stream[length ++] = (~blockSize >> 8) & 0xFF;
+                blockRemaining = blockSize;
+            }
+
+            stream[length ++] = value;
+            blockRemaining --;
+            rawWritten ++;
+
+            adlerA = (adlerA + value) % 65521;
+            adlerB = (adlerB + adlerA) % 65521;
+        }
+    }
+
+    putBigEndian (stream + length, (adlerB << 16) | adlerA);
+    length += 4;
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite (signature, 1, 8, file);
+
+    unsigned char header[13];
+    putBigEndian (header, map->width);
+    putBigEndian (header + 4, map->height);
+    header[8] = 8;  //bits per channel
+    header[9] = 2;  //truecolour RGB
+    header[10] = 0; //deflate
+    header[11] = 0; //adaptive filtering
+    header[12] = 0; //not interlaced
+    writeChunk (file, "IHDR", header, sizeof(header));
+    writeChunk (file, "IDAT", stream, length);
+    writeChunk (file, "IEND", NULL, 0);
+
+    free (stream);
+    return fclose (file) == 0;
+}
+
+bool writeImage (const Film * film, double exposure, const char * path) {
+    ImageFormat format;
+    if (!getImageFormat (path, &format)) return false;
+
+    //PFM keeps the linear radiance, the 8 bit formats get the tone mapped display image
+    if (format == IMAGE_FORMAT_PFM) return writeFilmPFM (film, path);
+
+    PixelMap * map = createPixelMap (film->width, film->height);
+    toneMapFilm (film, exposure, map);
+    bool written = (format == IMAGE_FORMAT_PNG) ? writePNG (map, path) : writePPM (map, path);
+    freePixelMap (map);
+    return written;
+}
+
+static void getHeatmapColor (double t, unsigned char * rgb) {
+    //black -> blue -> red -> yellow -> white, so a few extra samples already stand out from the floor
+    static const double stops[5][3] = {{0, 0, 0}, {0.1, 0.1, 0.8}, {0.9, 0.1, 0.2}, {1, 0.85, 0}, {1, 1, 1}};
+    double position = fmin (fmax (t, 0), 1) * 4;
+    int index = position >= 4 ? 3 : (int) position;
+    double blend = position - index;
+    for (int c = 0; c < 3; ++ c) {
+        double value = stops[index][c] + (stops[index + 1][c] - stops[index][c]) * blend;
+        rgb[c] = (unsigned char) (value * 255 + 0.5);
+    }
+}
+
+bool writeSampleHeatmap (const Film * film, const char * path) {
+    ImageFormat format;
+    if (!getImageFormat (path, &format)) return false;
+    size_t numPixels = (size_t)film->width * film->height;
+
+    if (format == IMAGE_FORMAT_PFM) {
+        Film * counts = createFilm (film->width, film->height, getPixelFilter (FILTER_BOX));
+        for (int y = 0; y < film->height; ++ y) {
+            for (int x = 0; x < film->width; ++ x) {
+                double count = film->sampleCounts[(size_t)y * film->width + x];
+                setFilmPixel (counts, x, y, (Vector){count, count, count});
+            }
+        }
+        bool written = writeFilmPFM (counts, path);
+        freeFilm (counts);
+        return written;
+    }
+
+    uint32_t most = 1;
+    for (size_t i = 0; i < numPixels; ++ i) {
+        if (film->sampleCounts[i] > most) most = film->sampleCounts[i];
+    }
+
+    PixelMap * map = createPixelMap (film->width, film->height);
+    for (size_t i = 0; i < numPixels; ++ i) {
+        getHeatmapColor ((double)film->sampleCounts[i] / most, map->data + i * 4);
+        map->data[i * 4 + 3] = 255;
+    }
+    bool written = (format == IMAGE_FORMAT_PNG) ? writePNG (map, path) : writePPM (map, path);
+    freePixelMap (map);
+    return written;
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "film.h"
+#include <stdbool.h>
+
+typedef enum {
+    IMAGE_FORMAT_PPM,
+    IMAGE_FORMAT_PFM,
+    IMAGE_FORMAT_PNG
+} ImageFormat;
+
+bool getImageFormat (const char * path, ImageFormat * format);
+
+bool writePPM (const PixelMap * map, const char * path);
+bool writePNG (const PixelMap * map, const char * path);
+bool writeImage (const Film * film, double exposure, const char * path); // picks the format from the extension
+bool writeSampleHeatmap (const Film * film, const char * path); // samples per pixel; PFM keeps the raw counts
+
+#endif
\ No newline at end of file
@@ -0,0 +1,403 @@
+#include "lights.h"
+#include "sampling.h"
+#include "timer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* light sampling
+ * every emissive triangle becomes a light. two ways to pick one for a shadow ray:
+ * an alias table over emitted power draws in O(1) but ignores where the shading point is, and a
+ * light bvh descends from the root choosing each child in proportion to a conservative estimate
+ * of what it can contribute at the shading point (power, distance, and the cone of its normals),
+ * so far away or back facing clusters are rarely or never picked. both give the exact pmf of
+ * any light back, which multiple importance sampling needs for lights found by bouncing. */
+
+typedef struct {
+    double key;
+    int light;
+} LightKey;
+
+typedef struct {
+    Scene * scene;
+    Light * scratch;
+    LightKey * keys;
+    int numNodes;
+} LightBVHBuilder;
+
+const char * getLightSamplerName (LightSamplerType type) {
+    switch (type) {
+        case LIGHT_SAMPLER_POWER: return "power";
+        case LIGHT_SAMPLER_BVH: return "bvh";
+        default: return "unknown";
+    }
+}
+
+bool parseLightSamplerName (const char * name, LightSamplerType * type) {
+    if (strcmp (name, "power") == 0) {
+        *type = LIGHT_SAMPLER_POWER;
+    } else if (strcmp (name, "bvh") == 0) {
+        *type = LIGHT_SAMPLER_BVH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool buildAliasTable (Scene * scene, Arena * scratch) {
+    int n = scene->numLights;
+    double * scaled = arenaAlloc (scratch, MEMORY_BUILD_SCRATCH, n * sizeof(double));
+    int * small = arenaAlloc (scratch, MEMORY_BUILD_SCRATCH, n * sizeof(int));
+    int * large = arenaAlloc (scratch, MEMORY_BUILD_SCRATCH, n * sizeof(int));
+    if (!scaled || !small || !large) return false;
+    int numSmall = 0, numLarge = 0;
+
+    //Vose: every slot holds its own light with some probability and one alias for the rest
+    for (int i = 0; i < n; ++ i) {
+        scaled[i] = scene->lightPmf[i] * n;
+        if (scaled[i] < 1.0) small[numSmall ++] = i;
+        else large[numLarge ++] = i;
+    }
+    while (numSmall > 0 && numLarge > 0) {
+        int less = small[-- numSmall];
+        int more = large[-- numLarge];
+        scene->lightAliasProbability[less] = scaled[less];
+        scene->lightAlias[less] = more;
+        scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+        if (scaled[more] < 1.0) small[numSmall ++] = more;
+        else large[numLarge ++] = more;
+    }
+    //whatever is left is 1 up to rounding
+    while (numLarge > 0) {
+        int i = large[-- numLarge];
+        scene->lightAliasProbability[i] = 1.0;
+        scene->lightAlias[i] = i;
+    }
+    while (numSmall > 0) {
+        int i = small[-- numSmall];
+        scene->lightAliasProbability[i] = 1.0;
+        scene->lightAlias[i] = i;
+    }
+    return true;
+}
+
+static inline void growBounds (BoundingBox * box, Point p) {
+    box->min.x = fmin (box->min.x, p.x);
+    box->min.y = fmin (box->min.y, p.y);
+    box->min.z = fmin (box->min.z, p.z);
+    box->max.x = fmax (box->max.x, p.x);
+    box->max.y = fmax (box->max.y, p.y);
+    box->max.z = fmax (box->max.z, p.z);
+}
+
+static inline double getAxis (Point p, int axis) {
+    return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+static int compareLightKeys (const void * a, const void * b) {
+    const LightKey * left = (const LightKey *) a;
+    const LightKey * right = (const LightKey *) b;
+    if (left->key != right->key) return left->key < right->key ? -1 : 1;
+    return left->light - right->light;
+}
+
+static int buildLightBVHNode (LightBVHBuilder * builder, int first, int count) {
+    Scene * scene = builder->scene;
+    int nodeIndex = builder->numNodes ++;
+    LightBVHNode * node = &scene->lightBVHNodes[nodeIndex];
+
+    BoundingBox centroids;
+    node->bounds.min = node->bounds.max = scene->lights[first].corner;
+    centroids.min = centroids.max = scene->lights[first].corner;
+    Vector normalSum = {0, 0, 0};
+    node->power = 0;
+
+    for (int i = first; i < first + count; ++ i) {
+        const Light * light = &scene->lights[i];
+        Point p2 = movePoint (light->corner, light->edge1);
+        Point p3 = movePoint (light->corner, light->edge2);
+        growBounds (&node->bounds, light->corner);
+        growBounds (&node->bounds, p2);
+        growBounds (&node->bounds, p3);
+        growBounds (&centroids, movePoint (light->corner, scaleVector (addVector (light->edge1, light->edge2), 1.0 / 3.0)));
+        normalSum = addVector (normalSum, light->normal);
+        node->power += light->power;
+    }
+
+    //a cone around the mean normal; opposing normals leave no useful cone
+    double normalLength = vectorLength (normalSum);
+    if (normalLength > 1e-6) {
+        node->axis = scaleVector (normalSum, 1.0 / normalLength);
+        node->cosTheta = 1.0;
+        for (int i = first; i < first + count; ++ i) {
+            node->cosTheta = fmin (node->cosTheta, dotProduct (node->axis, scene->lights[i].normal));
+        }
+    } else {
+        node->axis = scene->lights[first].normal;
+        node->cosTheta = -1.0;
+    }
+
+    node->firstLight = first;
+    node->numLights = count;
+    node->children[0] = node->children[1] = -1;
+    if (count == 1) return nodeIndex;
+
+    //median split along the widest extent of the centroids; halving the count bounds the depth by log2 of it
+    //and sampling walks down without a stack, so the tree needs no depth cap
+    Vector extent = getVector (centroids.min, centroids.max);
+    int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    for (int i = 0; i < count; ++ i) {
+        const Light * light = &scene->lights[first + i];
+        Point centroid = movePoint (light->corner, scaleVector (addVector (light->edge1, light->edge2), 1.0 / 3.0));
+        builder->keys[i].key = getAxis (centroid, axis);
+        builder->keys[i].light = first + i;
+    }
+    qsort (builder->keys, count, sizeof(LightKey), compareLightKeys);
+    for (int i = 0; i < count; ++ i) {
+        builder->scratch[i] = scene->lights[builder->keys[i].light];
+    }
+    memcpy (&scene->lights[first], builder->scratch, count * sizeof(Light));
+
+    int half = count / 2;
+    int left = buildLightBVHNode (builder, first, half);
+    int right = buildLightBVHNode (builder, first + half, count - half);
+    node->children[0] = left;
+    node->children[1] = right;
+    return nodeIndex;
+}
+
+// an upper bound on what the node's lights can deliver to point, up to a common factor
+static double getLightNodeImportance (const LightBVHNode * node, Point point) {
+    Point center = {(node->bounds.min.x + node->bounds.max.x) * 0.5,
+                    (node->bounds.min.y + node->bounds.max.y) * 0.5,
+                    (node->bounds.min.z + node->bounds.max.z) * 0.5};
+    double radius = 0.5 * vectorLength (getVector (node->bounds.min, node->bounds.max));
+    Vector toPoint = getVector (center, point);
+    double distanceSquared = vectorLengthSquared (toPoint);
+    double distance = sqrt (distanceSquared);
+
+    /* the point can see an emitting side if the angle between the axis and the direction to the point
+     * is within the normal cone plus the angle the bounds subtend; past that the cosine of the
+     * remaining angle bounds the emission. angles are subtracted through their sines and cosines */
+    double cosine = 1.0;
+    if (node->cosTheta > -1.0 && distance > radius) {
+        double cosAngle = fmax (-1.0, fmin (1.0, dotProduct (node->axis, toPoint) / distance));
+        if (cosAngle < node->cosTheta) {
+            double sinAngle = sqrt (1.0 - cosAngle * cosAngle);
+            double sinCone = sqrt (fmax (0.0, 1.0 - node->cosTheta * node->cosTheta));
+            double cosOutside = cosAngle * node->cosTheta + sinAngle * sinCone;
+            double sinOutside = sinAngle * node->cosTheta - cosAngle * sinCone;
+
+            double sinBounds = radius / distance;
+            double cosBounds = sqrt (1.0 - sinBounds * sinBounds);
+            if (cosOutside < cosBounds) {
+                cosine = cosOutside * cosBounds + sinOutside * sinBounds;
+                if (cosine <= 0) return 0;
+            }
+        }
+    }
+
+    return node->power * cosine / fmax (distanceSquared, radius * radius);
+}
+
+bool buildLights (Scene * scene) {
+    double start = getTimeSeconds ();
+    scene->numLights = 0;
+    for (int i = 0; i < scene->numTriangles; ++ i) {
+        if (maxComponent (scene->materials[scene->triangles[i].materialId].emission) > 0) scene->numLights ++;
+    }
+    if (scene->numLights == 0) return true;
+
+    int n = scene->numLights;
+    Arena scratch;
+    initArena (&scratch);
+    scene->lights = arenaAlloc (&scene->arena, MEMORY_LIGHTS, n * sizeof(Light));
+    scene->triangleLights = arenaAlloc (&scene->arena, MEMORY_LIGHTS, scene->numTriangles * sizeof(int));
+    scene->lightPmf = arenaAlloc (&scene->arena, MEMORY_LIGHTS, n * sizeof(double));
+    scene->lightAliasProbability = arenaAlloc (&scene->arena, MEMORY_LIGHTS, n * sizeof(double));
+    scene->lightAlias = arenaAlloc (&scene->arena, MEMORY_LIGHTS, n * sizeof(int));
+    if (!scene->lights || !scene->triangleLights || !scene->lightPmf || !scene->lightAliasProbability || !scene->lightAlias) {
+        fprintf (stderr, "Out of memory building %d lights\n", n);
+        scene->numLights = 0;
+        return false;
+    }
+
+    int count = 0;
+    for (int i = 0; i < scene->numTriangles; ++ i) {
+        const Triangle * triangle = &scene->triangles[i];
+        Vector emission = scene->materials[triangle->materialId].emission;
+        if (maxComponent (emission) <= 0) continue;
+
+        Light * light = &scene->lights[count ++];
+        light->corner = getVertex (scene, triangle->vertices[0]);
+        light->edge1 = getVector (light->corner, getVertex (scene, triangle->vertices[1]));
+        light->edge2 = getVector (light->corner, getVertex (scene, triangle->vertices[2]));
+        light->normal = getTriangleNormal (scene, triangle);
+        light->emission = emission;
+        light->area = 0.5 * vectorLength (crossProduct (light->edge1, light->edge2));
+        //a one sided lambertian emitter sends pi * area * radiance
+        light->power = luminance (emission) * light->area * M_PI;
+        light->triangle = i;
+    }
+
+    if (scene->lightSampler < 0) {
+        scene->lightSampler = (n >= LIGHT_BVH_MIN_LIGHTS) ? LIGHT_SAMPLER_BVH : LIGHT_SAMPLER_POWER;
+    }
+
+    if (scene->lightSampler == LIGHT_SAMPLER_BVH) {
+        LightBVHBuilder builder;
+        builder.scene = scene;
+        builder.scratch = arenaAlloc (&scratch, MEMORY_BUILD_SCRATCH, n * sizeof(Light));
+        builder.keys = arenaAlloc (&scratch, MEMORY_BUILD_SCRATCH, n * sizeof(LightKey));
+        builder.numNodes = 0;
+        scene->lightBVHNodes = arenaAlloc (&scene->arena, MEMORY_LIGHTS, (2 * n - 1) * sizeof(LightBVHNode));
+        if (!builder.scratch || !builder.keys || !scene->lightBVHNodes) {
+            fprintf (stderr, "Out of memory building the light BVH, sampling by power instead\n");
+            scene->lightBVHNodes = NULL;
+            scene->lightSampler = LIGHT_SAMPLER_POWER;
+        } else {
+            buildLightBVHNode (&builder, 0, n);
+            scene->numLightBVHNodes = builder.numNodes;
+        }
+    }
+
+    //the bvh reorders the lights, so indices are handed out afterwards
+    double totalPower = 0;
+    for (int i = 0; i < n; ++ i) {
+        totalPower += scene->lights[i].power;
+    }
+    for (int i = 0; i < scene->numTriangles; ++ i) {
+        scene->triangleLights[i] = -1;
+    }
+    for (int i = 0; i < n; ++ i) {
+        scene->triangleLights[scene->lights[i].triangle] = i;
+        scene->lightPmf[i] = (totalPower > 0) ? scene->lights[i].power / totalPower : 1.0 / n;
+    }
+    bool built = buildAliasTable (scene, &scratch);
+    freeArena (&scratch);
+    addMemoryUsage (&scene->scratchUsage, &scratch.usage);
+    if (scratch.peakHeldBytes > scene->scratchPeakBytes) scene->scratchPeakBytes = scratch.peakHeldBytes;
+    if (!built) {
+        fprintf (stderr, "Out of memory building the alias table for %d lights\n", n);
+        scene->numLights = 0;
+        return false;
+    }
+
+    scene->lightBuildTime = getTimeSeconds () - start;
+    return true;
+}
+
+void printLightStats (Scene * scene) {
+    if (scene->numLights == 0) {
+        fprintf (stderr, "Lights: none, emitters are only found by bouncing\n");
+        return;
+    }
+
+    double totalPower = 0;
+    for (int i = 0; i < scene->numLights; ++ i) {
+        totalPower += scene->lights[i].power;
+    }
+    fprintf (stderr, "Lights: %d emissive triangles, total power %.4g, %s sampler", scene->numLights, totalPower,
+             getLightSamplerName (scene->lightSampler));
+    if (scene->lightSampler == LIGHT_SAMPLER_BVH) {
+        fprintf (stderr, " (%d nodes)", scene->numLightBVHNodes);
+    }
+    fprintf (stderr, ", built in %.3f ms\n", scene->lightBuildTime * 1000.0);
+}
+
+static int pickLight (const Scene * scene, Point from, double u, double * pmf) {
+    if (scene->lightSampler != LIGHT_SAMPLER_BVH) {
+        double scaled = u * scene->numLights;
+        int slot = (int) scaled;
+        if (slot >= scene->numLights) slot = scene->numLights - 1;
+        int light = (scaled - slot < scene->lightAliasProbability[slot]) ? slot : scene->lightAlias[slot];
+        *pmf = scene->lightPmf[light];
+        return light;
+    }
+
+    //descend, reusing what is left of u at every level
+    const LightBVHNode * node = &scene->lightBVHNodes[0];
+    double probability = 1.0;
+    while (node->children[0] >= 0) {
+        const LightBVHNode * left = &scene->lightBVHNodes[node->children[0]];
+        const LightBVHNode * right = &scene->lightBVHNodes[node->children[1]];
+        double leftImportance = getLightNodeImportance (left, from);
+        double rightImportance = getLightNodeImportance (right, from);
+        double total = leftImportance + rightImportance;
+        if (total <= 0) return -1;
+
+        double leftProbability = leftImportance / total;
+        if (u < leftProbability) {
+            u = u / leftProbability;
+            probability *= leftProbability;
+            node = left;
+        } else {
+            u = (u - leftProbability) / (1.0 - leftProbability);
+            probability *= 1.0 - leftProbability;
+            node = right;
+        }
+        u = fmin (u, 1.0 - 1e-12);
+    }
+    *pmf = probability;
+    return node->firstLight;
+}
+
+static double getLightPmf (const Scene * scene, Point from, int light) {
+    if (scene->lightSampler != LIGHT_SAMPLER_BVH) return scene->lightPmf[light];
+
+    //follow the lights' index ranges down to the leaf, with the same importances sampling used
+    const LightBVHNode * node = &scene->lightBVHNodes[0];
+    double probability = 1.0;
+    while (node->children[0] >= 0) {
+        const LightBVHNode * left = &scene->lightBVHNodes[node->children[0]];
+        const LightBVHNode * right = &scene->lightBVHNodes[node->children[1]];
+        double leftImportance = getLightNodeImportance (left, from);
+        double rightImportance = getLightNodeImportance (right, from);
+        double total = leftImportance + rightImportance;
+        if (total <= 0) return 0;
+
+        if (light < left->firstLight + left->numLights) {
+            probability *= leftImportance / total;
+            node = left;
+        } else {
+            probability *= rightImportance / total;
+            node = right;
+        }
+    }
+    return probability;
+}
+
+bool sampleLight (const Scene * scene, Point from, double uLight, double u, double v, LightSample * sample) {
+    if (scene->numLights == 0) return false;
+
+    double pmf;
+    int index = pickLight (scene, from, uLight, &pmf);
+    if (index < 0 || pmf <= 0) return false;
+    const Light * light = &scene->lights[index];
+
+    double b1, b2;
+    sampleUniformTriangle (u, v, &b1, &b2);
+    Vector offset = addVector (scaleVector (light->edge1, b1), scaleVector (light->edge2, b2));
+    sample->point = movePoint (light->corner, offset);
+
+    Vector toLight = getVector (from, sample->point);
+    sample->distance = vectorLength (toLight);
+    if (sample->distance <= 0) return false;
+    sample->direction = scaleVector (toLight, 1.0 / sample->distance);
+
+    double cosThetaLight = -dotProduct (light->normal, sample->direction);
+    if (cosThetaLight <= 0) return false;
+
+    sample->pdf = pmf * sample->distance * sample->distance / (cosThetaLight * light->area);
+    sample->emission = light->emission;
+    sample->light = index;
+    return true;
+}
+
+double getLightPdf (const Scene * scene, Point from, int light, Vector direction, double distance) {
+    const Light * target = &scene->lights[light];
+    double cosThetaLight = -dotProduct (target->normal, direction);
+    if (cosThetaLight <= 0 || target->area <= 0) return 0;
+    return getLightPmf (scene, from, light) * distance * distance / (cosThetaLight * target->area);
+}
\ No newline at end of file
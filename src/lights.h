@@ -0,0 +1,42 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include "geometry.h"
+
+#define LIGHT_BVH_MIN_LIGHTS 16 // below this many lights the alias table alone is picked
+
+typedef enum {
+    LIGHT_SAMPLER_POWER,
+    LIGHT_SAMPLER_BVH
+} LightSamplerType;
+
+// a binary tree over the lights, each node bounding their positions, normals and power
+struct _LightBVHNode {
+    BoundingBox bounds;
+    Vector axis;     // mean emitting direction
+    double cosTheta; // every normal in the node lies within this cone around axis, -1 for any
+    double power;
+    int firstLight;  // lights are reordered so a node covers firstLight .. firstLight + numLights - 1
+    int numLights;
+    int children[2]; // -1 in leaves
+};
+
+typedef struct {
+    Point point;
+    Vector direction; // unit vector from the shading point to the light point
+    double distance;
+    Vector emission;
+    double pdf;       // solid angle density, the choice of light included
+    int light;
+} LightSample;
+
+const char * getLightSamplerName (LightSamplerType type);
+bool parseLightSamplerName (const char * name, LightSamplerType * type);
+
+bool buildLights (Scene * scene);
+void printLightStats (Scene * scene);
+
+bool sampleLight (const Scene * scene, Point from, double uLight, double u, double v, LightSample * sample);
+double getLightPdf (const Scene * scene, Point from, int light, Vector direction, double distance);
+
+#endif
\ No newline at end of file
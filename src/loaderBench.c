@@ -0,0 +1,123 @@
+#include "loaderBench.h"
+#include "sceneLoader.h"
+#include "timer.h"
+#include "memoryStats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define LOADER_BENCH_RUNS 3
+
+/* writes a bumpy grid the way exporters do: six decimals per coordinate, texture coordinates and
+ * normals alongside the positions, and quads in v/vt/vn form. returns the file size, 0 on failure */
+static size_t writeBenchmarkMesh (FILE * file, int numTriangles) {
+    int side = (int) ceil (sqrt (numTriangles / 2.0));
+    if (side < 1) side = 1;
+
+    fprintf (file, "# loader benchmark grid, %d x %d quads\n", side, side);
+    for (int j = 0; j <= side; ++ j) {
+        for (int i = 0; i <= side; ++ i) {
+            double u = (double) i / side;
+            double v = (double) j / side;
+            fprintf (file, "v %.6f %.6f %.6f\n", u * 2 - 1, 0.05 * sin (u * 40) * cos (v * 40) - 1, v * 2 - 1);
+            fprintf (file, "vt %.6f %.6f\n", u, v);
+        }
+    }
+    fprintf (file, "vn 0.000000 1.000000 0.000000\ng floor\nusemtl floor\n");
+    for (int j = 0; j < side; ++ j) {
+        for (int i = 0; i < side; ++ i) {
+            int a = j * (side + 1) + i + 1;
+            int b = a + side + 1;
+            fprintf (file, "f %d/%d/1 %d/%d/1 %d/%d/1 %d/%d/1\n", a, a, a + 1, a + 1, b + 1, b + 1, b, b);
+        }
+    }
+    long size = ftell (file);
+    return size > 0 ? (size_t) size : 0;
+}
+
+// time to pull the bytes in with nothing parsed, the rate the loader is measured against
+static double timeFileRead (const char * path, size_t size) {
+    char * buffer = malloc (size > 0 ? size : 1);
+    FILE * file = fopen (path, "rb");
+    if (!buffer || !file) {
+        free (buffer);
+        if (file) fclose (file);
+        return 0;
+    }
+    double start = getTimeSeconds();
+    size_t read = fread (buffer, 1, size, file);
+    double timeSpent = getTimeSeconds() - start;
+    fclose (file);
+    free (buffer);
+    return read == size ? timeSpent : 0;
+}
+
+// best time of a few reads of the file into a fresh scene, 0 if it fails to load
+static double timeSceneRead (const char * path, int numThreads, int * numTriangles) {
+    double best = 0;
+    for (int run = 0; run < LOADER_BENCH_RUNS; ++ run) {
+        Scene * scene = initScene();
+        if (!scene) return 0;
+        scene->bvhSettings.numThreads = numThreads;
+        double start = getTimeSeconds();
+        bool loaded = readSceneFile (scene, path, "", NULL);
+        double timeSpent = getTimeSeconds() - start;
+        *numTriangles = scene->numTriangles;
+        freeScene (scene);
+        if (!loaded) return 0;
+        if (best == 0 || timeSpent < best) best = timeSpent;
+    }
+    return best;
+}
+
+void reportLoaderBenchmark (int numTriangles, int numThreads) {
+    char path[256];
+    FILE * file = NULL;
+#ifdef _WIN32
+    snprintf (path, sizeof(path), "loader-bench.obj");
+    file = fopen (path, "w");
+#else
+    const char * directory = getenv ("TMPDIR");
+    snprintf (path, sizeof(path), "%s/loader-bench-XXXXXX", directory && directory[0] ? directory : "/tmp");
+    int descriptor = mkstemp (path);
+    if (descriptor >= 0) file = fdopen (descriptor, "w");
+#endif
+    if (!file) {
+        fprintf (stderr, "Loader benchmark: could not create %s\n", path);
+        return;
+    }
+    size_t size = writeBenchmarkMesh (file, numTriangles);
+    if (fclose (file) != 0 || size == 0) {
+        fprintf (stderr, "Loader benchmark: could not write %s\n", path);
+        remove (path);
+        return;
+    }
+
+    //best of a few runs, with the file already in the page cache from writing it
+    double bestRead = 0;
+    for (int run = 0; run < LOADER_BENCH_RUNS; ++ run) {
+        double readTime = timeFileRead (path, size);
+        if (readTime > 0 && (bestRead == 0 || readTime < bestRead)) bestRead = readTime;
+    }
+    int loadedTriangles = 0;
+    double serialParse = timeSceneRead (path, 1, &loadedTriangles);
+    double bestParse = numThreads > 1 ? timeSceneRead (path, numThreads, &loadedTriangles) : serialParse;
+    if (serialParse == 0 || bestParse == 0) {
+        fprintf (stderr, "Loader benchmark: failed to read %s\n", path);
+        remove (path);
+        return;
+    }
+    remove (path);
+
+    double megabytes = size / 1e6;
+    fprintf (stderr, "Loader benchmark: %d triangles, %.1f MB of OBJ parsed in %.3f seconds on %d threads, %.0f MB/s (%.0f MB/s on one, reading alone %.0f MB/s)\n",
+             loadedTriangles, megabytes, bestParse, numThreads, megabytes / bestParse, megabytes / serialParse, bestRead > 0 ? megabytes / bestRead : 0.0);
+    //the benchmark runs before any scene is loaded, so the peak so far is from the reads above
+    fprintf (stderr, "Loader benchmark: %.1f MB peak resident, %.2f times the OBJ\n\n",
+             getPeakResidentBytes () / 1e6, getPeakResidentBytes () / (double) size);
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+#ifndef LOADER_BENCH_H
+#define LOADER_BENCH_H
+
+// writes a generated OBJ mesh of about this many triangles to a temporary file and reports how fast it reads back on one and on numThreads threads
+void reportLoaderBenchmark (int numTriangles, int numThreads);
+
+#endif
\ No newline at end of file
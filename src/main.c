@@ -1,108 +1,69 @@
-#include "pathTracer.h"
 #include "display.h"
-#include "geometry.h"
-#include "camera.h"
-#include "ray.h"
-#include "sceneLoader.h"
-#include <windows.h>
+#include "frontend.h"
 #include <stdio.h>
-#include "constants.h"
+#include <stdlib.h>
 
-PixelMap * createPixelMap (int width, int height) {
-    PixelMap * map = malloc(sizeof(PixelMap));
-    map->width = width;
-    map->height = height;
-    map->size = width * height * sizeof(unsigned char) * 4;
-    map->data = malloc (map->size);
-    return map;
-}
-
-PixelMap * generateTestPixelMap (int width, int height) {
-    Scene * scene = initScene();
-    Camera * cam = createCamera(width, height);
-
-    if (!loadScene (scene, DEFAULT_OBJ, DEFAULT_MTL)) {
-        fprintf (stderr, "Failed to load scene: %s\n", DEFAULT_OBJ);
-        freeScene (scene);
-        freeCamera (cam);
-        return NULL;
-    }
-
-    fprintf (stderr, "Loaded: %d triangles, %d spheres, %d materials\n\n",
-             scene->numTriangles, scene->numSpheres, scene->numMaterials);
+static int runProgressiveViewer (const RenderOptions * options, Scene * scene) {
+    Camera * cam = loadSceneFromOptions (options, scene);
+    if (!cam) return 1;
 
-    frameScene(scene, cam);
-    PixelMap * newPixels = createPixelMap(width, height);
-    
-    Seed * seed = generateSeed();
+    RenderSettings settings = getRenderSettings (options);
+    fprintf (stderr, "Rendering %d x %d progressively, %d passes of 1 spp, %d threads\n",
+             settings.width, settings.height, settings.samplesPerPixel, settings.numThreads);
 
-    for (int x = 0; x < width; ++ x) {
-        fprintf(stderr, "\033[1A\033[2K%.3f percent of the way there\n", ((double)x)/width * 100);
+    ProgressiveRender * render = startProgressiveRender (scene, cam, &settings, options->exposure);
 
-        for (int y = 0; y < height; ++ y) {
-            HitRecord path [MAX_BOUNCES];
-
-            Vector color = {0, 0, 0};
-
-            for (int samples = 0; samples < TOTAL_SAMPLES; ++ samples) {
-                double jitterX = (double)x + (randomDouble(seed) - 0.5);
-                double jitterY = (double)y + (randomDouble(seed) - 0.5);
-                Ray cameraRay = getCameraRay(cam, jitterX, jitterY);
-                int totalHits = tracePath(cameraRay, path, 0, scene, seed);
-                Vector tempColor = calculatePathColor(path, totalHits, scene, seed);
-                color = addVector(color, tempColor);
-            }
-
-            color = scaleVector (color, 1.0/TOTAL_SAMPLES);
-
-            int index = (x + y * width) * 4;
-            double gamma = 1.0/2.2;
-            newPixels->data[index + 0] = (unsigned char)(fmin(1.0, pow(color.x, gamma)) * 255.0); 
-            newPixels->data[index + 1] = (unsigned char)(fmin(1.0, pow(color.y, gamma)) * 255.0); 
-            newPixels->data[index + 2] = (unsigned char)(fmin(1.0, pow(color.z, gamma)) * 255.0); 
-            newPixels->data[index + 3] = 255; 
-            
-        }
-    }
+    GtkDisplay * display = createDisplay(options->width, options->height);
+    setProgressiveRender(display, render);
+    runDisplay(display, 0, NULL);
 
-    freeScene(scene);
+    //closing the window stops the render after the tile in flight; whatever has accumulated is kept
+    int passes = getProgressivePasses (render);
+    Film * film = finishProgressiveRender (render, true);
+    cleanDisplay(display);
     freeCamera(cam);
-    free(seed);
 
-    return newPixels;
+    fprintf (stderr, "Stopped after %d of %d passes\n", passes, settings.samplesPerPixel);
+    bool written = finishFilmOutput (options, film);
+    freeFilm(film);
+    return written ? 0 : 1;
 }
 
 int main (int argc, char ** argv) {
-    int width = 500, height = 500;    
+    RenderOptions options = defaultRenderOptions();
+    options.checkBackends = true;
+    if (!parseRenderOptions (argc, argv, &options)) {
+        printRenderOptionsUsage (argv[0]);
+        return 1;
+    }
 
-    if (argc == 3) {
-        width = strtol(argv[1], NULL, 10);
-        height = strtol(argv[2], NULL, 10);
-    } 
+    Scene * scene = initScene();
+    if (!scene) {
+        fprintf (stderr, "Out of memory\n");
+        return 1;
+    }
 
-    LARGE_INTEGER frequency;
-    LARGE_INTEGER start;
-    LARGE_INTEGER end;
+    //mlt resolves its chains in rounds of its own and the wavefront engine finishes whole batches at
+    //a time, so only the tile engine renders progressively
+    if (options.progressive && options.integrator == INTEGRATOR_PATH && options.engine == ENGINE_TILES) {
+        int status = runProgressiveViewer (&options, scene);
+        freeScene(scene);
+        return status;
+    }
 
-    QueryPerformanceFrequency(&frequency);
-    QueryPerformanceCounter(&start);
-    PixelMap * map = generateTestPixelMap(width, height);
-    QueryPerformanceCounter(&end);
+    Film * film = renderFromOptions (&options, scene);
+    freeScene(scene);
 
-    if (!map) {
+    if (!film) {
         fprintf (stderr, "Failed to generate pixel map.\n");
         return 1;
     }
 
-    double timeSpent = (double)(end.QuadPart - start.QuadPart)/frequency.QuadPart;
-
-    fprintf(stderr,"Rendered %d x %d pixels in %f seconds.\n", width, height, timeSpent);
-    
-    double raysPerSecond = width * height * TOTAL_SAMPLES / timeSpent;
-    fprintf(stderr, "Rendered %f rays per second.\n", raysPerSecond);
-
+    PixelMap * map = createPixelMap(options.width, options.height);
+    toneMapFilm(film, options.exposure, map);
+    freeFilm(film);
 
-    GtkDisplay * display = createDisplay(width, height);
+    GtkDisplay * display = createDisplay(options.width, options.height);
     setPixelMap(display, map);
     runDisplay(display, 0, NULL);
     cleanDisplay(display);
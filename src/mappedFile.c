@@ -0,0 +1,82 @@
+#include "mappedFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool mapFile (const char * path, bool sequential, MappedFile * file) {
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = false;
+#ifdef _WIN32
+    FILE * stream = fopen (path, "rb");
+    if (!stream) return false;
+    fseek (stream, 0, SEEK_END);
+    long size = ftell (stream);
+    fseek (stream, 0, SEEK_SET);
+    char * data = malloc (size > 0 ? size : 1);
+    if (size < 0 || !data || fread (data, 1, size, stream) != (size_t) size) {
+        free (data);
+        fclose (stream);
+        return false;
+    }
+    fclose (stream);
+    file->data = data;
+    file->size = size;
+    return true;
+#else
+    int descriptor = open (path, O_RDONLY);
+    if (descriptor < 0) return false;
+    struct stat info;
+    if (fstat (descriptor, &info) != 0) {
+        close (descriptor);
+        return false;
+    }
+    if (info.st_size > 0) {
+        //private and writable, so callers may use the pages as their own arrays without touching the file
+        void * data = mmap (NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+        if (data == MAP_FAILED) {
+            close (descriptor);
+            return false;
+        }
+        if (sequential) madvise (data, info.st_size, MADV_SEQUENTIAL);
+        file->data = data;
+        file->size = info.st_size;
+        file->mapped = true;
+    }
+    close (descriptor);
+    return true;
+#endif
+}
+
+void unmapFile (MappedFile * file) {
+#ifndef _WIN32
+    if (file->mapped) {
+        munmap (file->data, file->size);
+        file->data = NULL;
+        return;
+    }
+#endif
+    free (file->data);
+    file->data = NULL;
+}
+
+void releaseMappedRange (MappedFile * file, size_t offset, size_t length) {
+#ifndef _WIN32
+    if (!file->mapped || offset >= file->size) return;
+    if (length > file->size - offset) length = file->size - offset;
+    size_t pageSize = (size_t) sysconf (_SC_PAGESIZE);
+    size_t first = (offset + pageSize - 1) / pageSize * pageSize;
+    size_t last = offset + length == file->size ? offset + length : (offset + length) / pageSize * pageSize;
+    if (last > first) madvise (file->data + first, last - first, MADV_DONTNEED);
+#else
+    (void) file;
+    (void) offset;
+    (void) length;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// a whole file in memory: mapped where mmap exists, read into one heap block elsewhere
+typedef struct {
+    char * data; // private copy on write pages, NULL for an empty file
+    size_t size;
+    bool mapped; // false when the data is a heap copy (windows, empty files)
+} MappedFile;
+
+bool mapFile (const char * path, bool sequential, MappedFile * file); // sequential: read front to back once
+void unmapFile (MappedFile * file);
+
+// drops the pages wholly inside [offset, offset + length) from memory once they have been read; they
+// still read back the same if touched again. does nothing to a heap copy
+void releaseMappedRange (MappedFile * file, size_t offset, size_t length);
+
+#endif
\ No newline at end of file
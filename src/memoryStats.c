@@ -0,0 +1,43 @@
+#include "memoryStats.h"
+
+const char * getMemorySubsystemName (MemorySubsystem subsystem) {
+    switch (subsystem) {
+        case MEMORY_MESH: return "mesh";
+        case MEMORY_BVH: return "bvh";
+        case MEMORY_WIDE_BVH: return "wide bvh";
+        case MEMORY_LIGHTS: return "lights";
+        case MEMORY_BUILD_SCRATCH: return "build scratch";
+        default: return "unknown";
+    }
+}
+
+void addMemoryUsage (MemoryUsage * total, const MemoryUsage * usage) {
+    for (int i = 0; i < NUM_MEMORY_SUBSYSTEMS; ++ i) {
+        total->allocations[i] += usage->allocations[i];
+        total->bytes[i] += usage->bytes[i];
+    }
+}
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+
+size_t getPeakResidentBytes () {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!K32GetProcessMemoryInfo (GetCurrentProcess (), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+}
+#else
+#include <sys/resource.h>
+
+size_t getPeakResidentBytes () {
+    struct rusage usage;
+    if (getrusage (RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (size_t) usage.ru_maxrss;
+#else
+    //kilobytes everywhere but macOS
+    return (size_t) usage.ru_maxrss * 1024;
+#endif
+}
+#endif
\ No newline at end of file
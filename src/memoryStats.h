@@ -0,0 +1,25 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <stddef.h>
+
+typedef enum {
+    MEMORY_MESH, // vertices, triangles, spheres, materials
+    MEMORY_BVH,
+    MEMORY_WIDE_BVH,
+    MEMORY_LIGHTS,
+    MEMORY_BUILD_SCRATCH, // what the builds above use while they run
+    NUM_MEMORY_SUBSYSTEMS
+} MemorySubsystem;
+
+typedef struct {
+    size_t allocations[NUM_MEMORY_SUBSYSTEMS];
+    size_t bytes[NUM_MEMORY_SUBSYSTEMS];
+} MemoryUsage;
+
+const char * getMemorySubsystemName (MemorySubsystem subsystem);
+void addMemoryUsage (MemoryUsage * total, const MemoryUsage * usage);
+
+size_t getPeakResidentBytes (); // most memory the process has had resident so far, 0 where unknown
+
+#endif
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "mlt.h"
+#include "pathTracer.h"
+#include "threadPool.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* primary sample space metropolis light transport (Kelemen et al. 2002)
+ * a path is a function of the vector of uniform numbers it consumes, so mutating that vector
+ * explores path space without the integrator knowing. the first two numbers pick the film
+ * position and the rest feed traceRadiance through the sampler.
+ * many independent chains run on the thread pool, all started from one bootstrap cdf,
+ * and splat into a shared buffer with atomic adds. */
+
+typedef struct {
+    Vector color;
+    double pixelX;
+    double pixelY;
+    double contribution;
+} PathSample;
+
+typedef struct {
+    Sampler sampler;
+    Seed seed;
+    PathSample current;
+    long long numMutations;
+    long long mutationsDone;
+    long long accepted;
+} MarkovChain;
+
+typedef struct {
+    long long mutations;
+    char padding[56]; //one cache line per thread
+} ThreadStats;
+
+typedef struct {
+    Scene * scene;
+    Camera * cam;
+    const RenderSettings * settings;
+    SplatBuffer * splats;
+
+    double * bootstrapContributions;
+    int numBootstrap;
+
+    MarkovChain * chains;
+    int round;
+    int numRounds;
+    ThreadStats * threadStats;
+    long long totalMutations;
+    _Atomic long long mutationsDone;
+} MLTJob;
+
+SplatBuffer * createSplatBuffer (int width, int height) {
+    SplatBuffer * buffer = malloc (sizeof(SplatBuffer));
+    buffer->width = width;
+    buffer->height = height;
+    buffer->channels = calloc ((size_t)width * height * 3, sizeof(*buffer->channels));
+    return buffer;
+}
+
+static inline void atomicAddDouble (_Atomic uint64_t * target, double value) {
+    uint64_t expected = atomic_load_explicit (target, memory_order_relaxed);
+    for (;;) {
+        double current;
+        memcpy (&current, &expected, sizeof(double));
+        double sum = current + value;
+        uint64_t desired;
+        memcpy (&desired, &sum, sizeof(double));
+        if (atomic_compare_exchange_weak_explicit (target, &expected, desired, memory_order_relaxed, memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+static inline double loadDouble (_Atomic uint64_t * source) {
+    uint64_t bits = atomic_load_explicit (source, memory_order_relaxed);
+    double value;
+    memcpy (&value, &bits, sizeof(double));
+    return value;
+}
+
+void addSplat (SplatBuffer * buffer, double pixelX, double pixelY, Vector value) {
+    int x = (int) pixelX;
+    int y = (int) pixelY;
+    if (x < 0 || y < 0 || x >= buffer->width || y >= buffer->height) return;
+
+    _Atomic uint64_t * pixel = &buffer->channels[(x + y * (size_t)buffer->width) * 3];
+    atomicAddDouble (&pixel[0], value.x);
+    atomicAddDouble (&pixel[1], value.y);
+    atomicAddDouble (&pixel[2], value.z);
+}
+
+void resolveSplatBuffer (SplatBuffer * buffer, double scale, Film * film) {
+    for (int y = 0; y < buffer->height; ++ y) {
+        for (int x = 0; x < buffer->width; ++ x) {
+            _Atomic uint64_t * pixel = &buffer->channels[(x + y * (size_t)buffer->width) * 3];
+            Vector color = {loadDouble (&pixel[0]), loadDouble (&pixel[1]), loadDouble (&pixel[2])};
+            setFilmPixel (film, x, y, scaleVector (color, scale));
+        }
+    }
+}
+
+void freeSplatBuffer (SplatBuffer * buffer) {
+    if (!buffer) return;
+    free (buffer->channels);
+    free (buffer);
+}
+
+static PathSample evaluatePathSample (Scene * scene, Camera * cam, const PathSettings * settings, Sampler * sampler) {
+    PathSample sample;
+    sample.pixelX = nextSample(sampler) * cam->imageWidth;
+    sample.pixelY = nextSample(sampler) * cam->imageHeight;
+
+    //getCameraRay samples at px + 0.5
+    Ray cameraRay = getCameraRay(cam, sample.pixelX - 0.5, sample.pixelY - 0.5);
+    sample.color = traceRadiance(&cameraRay, settings, scene, sampler);
+    sample.contribution = luminance(sample.color);
+    return sample;
+}
+
+static Seed getBootstrapSeed (uint64_t baseSeed, int index) {
+    Seed seed;
+    initSeed (&seed, baseSeed ^ ((uint64_t)(index + 1) * 0x9E3779B97F4A7C15ULL));
+    return seed;
+}
+
+static int sampleBootstrapIndex (const double * cdf, int count, double u) {
+    double target = u * cdf[count - 1];
+    int low = 0, high = count - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (cdf[mid] <= target) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+static void evaluateBootstrap (void * context, int index, int threadIndex) {
+    MLTJob * job = (MLTJob *) context;
+    Sampler sampler = createPrimarySampleSampler (getBootstrapSeed (job->settings->seed, index),
+                                                  job->settings->largeStepProbability, MLT_MUTATION_SIGMA);
+    job->bootstrapContributions[index] = evaluatePathSample (job->scene, job->cam, &job->settings->path, &sampler).contribution;
+    freeSampler (&sampler);
+}
+
+static void runChain (void * context, int chainIndex, int threadIndex) {
+    MLTJob * job = (MLTJob *) context;
+    MarkovChain * chain = &job->chains[chainIndex];
+
+    long long target = chain->numMutations * (job->round + 1) / job->numRounds;
+    long long start = chain->mutationsDone;
+
+    for (; chain->mutationsDone < target; ++ chain->mutationsDone) {
+        startIteration (&chain->sampler);
+        PathSample proposed = evaluatePathSample (job->scene, job->cam, &job->settings->path, &chain->sampler);
+        PathSample * current = &chain->current;
+
+        double acceptance = (current->contribution > 0) ? fmin (1.0, proposed.contribution / current->contribution) : 1.0;
+
+        //expected value splatting: both states contribute in proportion to their acceptance odds
+        if (proposed.contribution > 0) {
+            addSplat (job->splats, proposed.pixelX, proposed.pixelY, scaleVector (proposed.color, acceptance / proposed.contribution));
+        }
+        if (current->contribution > 0) {
+            addSplat (job->splats, current->pixelX, current->pixelY, scaleVector (current->color, (1.0 - acceptance) / current->contribution));
+        }
+
+        if (randomDouble (&chain->seed) < acceptance) {
+            *current = proposed;
+            acceptMutation (&chain->sampler);
+            chain->accepted ++;
+        } else {
+            rejectMutation (&chain->sampler);
+        }
+    }
+
+    long long ran = chain->mutationsDone - start;
+    job->threadStats[threadIndex].mutations += ran;
+
+    long long step = job->totalMutations / 100 > 0 ? job->totalMutations / 100 : 1;
+    long long before = atomic_fetch_add (&job->mutationsDone, ran);
+    if ((before + ran) / step != before / step) {
+        fprintf(stderr, "\033[1A\033[2K%.3f percent of the way there\n", ((double)(before + ran))/job->totalMutations * 100);
+    }
+}
+
+Film * renderMLT (Scene * scene, Camera * cam, const RenderSettings * settings) {
+    //chains splat into a double precision buffer with atomic adds; the film receives the resolved image
+    Film * film = createFilm (settings->width, settings->height, getPixelFilter (FILTER_BOX));
+
+    MLTJob job;
+    memset (&job, 0, sizeof(job));
+    job.scene = scene;
+    job.cam = cam;
+    job.settings = settings;
+    job.splats = createSplatBuffer (settings->width, settings->height);
+
+    /* bootstrap: independent paths estimate the normalization constant b (mean luminance over
+     * the image plane) and give a luminance weighted cdf every chain starts from */
+    job.numBootstrap = settings->bootstrapSamples > 0 ? settings->bootstrapSamples : 1;
+    job.bootstrapContributions = malloc (job.numBootstrap * sizeof(double));
+    parallelFor (settings->numThreads, job.numBootstrap, evaluateBootstrap, &job);
+
+    double * bootstrapCdf = job.bootstrapContributions;
+    for (int i = 1; i < job.numBootstrap; ++ i) {
+        bootstrapCdf[i] += bootstrapCdf[i - 1];
+    }
+    double bootstrapSum = bootstrapCdf[job.numBootstrap - 1];
+    double normalization = bootstrapSum / job.numBootstrap;
+
+    int numChains = settings->numChains > 0 ? settings->numChains : 1;
+    fprintf (stderr, "MLT bootstrap: %d samples, b = %f, %d chains\n\n", job.numBootstrap, normalization, numChains);
+
+    if (bootstrapSum <= 0) {
+        resolveSplatBuffer (job.splats, 0, film);
+        freeSplatBuffer (job.splats);
+        free (bootstrapCdf);
+        return film;
+    }
+
+    long long numPixels = (long long)settings->width * settings->height;
+    job.totalMutations = numPixels * settings->samplesPerPixel;
+    atomic_init (&job.mutationsDone, 0);
+
+    /* every chain has its own jump-ahead stream for its start choice and accept tests, and
+     * replays its bootstrap path from that sample's seed, so chains never share random state */
+    job.chains = malloc (numChains * sizeof(MarkovChain));
+    Seed chainSeed;
+    initSeed (&chainSeed, settings->seed);
+    for (int i = 0; i < numChains; ++ i) {
+        MarkovChain * chain = &job.chains[i];
+        jumpSeed (&chainSeed);
+        chain->seed = chainSeed;
+
+        int startIndex = sampleBootstrapIndex (bootstrapCdf, job.numBootstrap, randomDouble (&chain->seed));
+        chain->sampler = createPrimarySampleSampler (getBootstrapSeed (settings->seed, startIndex),
+                                                     settings->largeStepProbability, MLT_MUTATION_SIGMA);
+        chain->current = evaluatePathSample (scene, cam, &settings->path, &chain->sampler);
+        chain->numMutations = job.totalMutations / numChains + (i < job.totalMutations % numChains ? 1 : 0);
+        chain->mutationsDone = 0;
+        chain->accepted = 0;
+    }
+
+    job.threadStats = calloc (settings->numThreads, sizeof(ThreadStats));
+    job.numRounds = MLT_CHECKPOINTS;
+
+    //chains run in rounds; between rounds the shared buffer is resolved so the film always holds a usable image
+    double start = getTimeSeconds ();
+    for (job.round = 0; job.round < job.numRounds; ++ job.round) {
+        parallelFor (settings->numThreads, numChains, runChain, &job);
+
+        long long done = atomic_load (&job.mutationsDone);
+        resolveSplatBuffer (job.splats, normalization * numPixels / (double)(done > 0 ? done : 1), film);
+    }
+    double elapsed = fmax (getTimeSeconds () - start, 1e-9);
+
+    long long accepted = 0;
+    for (int i = 0; i < numChains; ++ i) {
+        accepted += job.chains[i].accepted;
+        freeSampler (&job.chains[i].sampler);
+    }
+
+    long long minThread = -1, maxThread = 0;
+    int activeThreads = 0;
+    for (int i = 0; i < settings->numThreads; ++ i) {
+        long long mutations = job.threadStats[i].mutations;
+        if (mutations == 0) continue;
+        activeThreads ++;
+        if (minThread < 0 || mutations < minThread) minThread = mutations;
+        if (mutations > maxThread) maxThread = mutations;
+    }
+
+    fprintf (stderr, "MLT: %lld mutations, %.1f%% accepted\n", job.totalMutations, 100.0 * accepted / fmax (1.0, (double)job.totalMutations));
+    fprintf (stderr, "MLT throughput: %.0f mutations/sec over %d threads, per thread %.0f avg (%.0f min, %.0f max)\n",
+             job.totalMutations / elapsed, activeThreads, job.totalMutations / elapsed / (activeThreads ? activeThreads : 1),
+             (minThread < 0 ? 0 : minThread) / elapsed, maxThread / elapsed);
+
+    freeSplatBuffer (job.splats);
+    free (job.chains);
+    free (job.threadStats);
+    free (bootstrapCdf);
+    return film;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef MLT_H
+#define MLT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "renderer.h"
+
+typedef struct {
+    int width;
+    int height;
+    _Atomic uint64_t * channels; // rgb doubles stored as bits so chains can add without a lock
+} SplatBuffer;
+
+SplatBuffer * createSplatBuffer (int width, int height);
+void addSplat (SplatBuffer * buffer, double pixelX, double pixelY, Vector value);
+void resolveSplatBuffer (SplatBuffer * buffer, double scale, Film * film);
+void freeSplatBuffer (SplatBuffer * buffer);
+
+Film * renderMLT (Scene * scene, Camera * cam, const RenderSettings * settings);
+
+#endif
\ No newline at end of file
@@ -1,130 +1,214 @@
 #include "pathTracer.h"
+#include "lights.h"
+#include "sampling.h"
 #include <stdlib.h>
 
-static Ray mirrorReflection (Vector incoming, Vector normal, Point intersection) {
-    Ray reflectedRay;
-    reflectedRay.vector = subtractVector(incoming, scaleVector(normal, 2 * dotProduct(normal, incoming)));
-    reflectedRay.vector = normalizeVector(reflectedRay.vector);
-    reflectedRay.origin = movePoint(intersection, scaleVector(normal, RAY_EPSILON));
-    return reflectedRay;
+PathSettings defaultPathSettings () {
+    PathSettings settings;
+    settings.lightSamples = DEFAULT_LIGHT_SAMPLES;
+    settings.multipleImportance = true;
+    settings.maxDepth = MAX_BOUNCES;
+    settings.rouletteDepth = DEFAULT_ROULETTE_DEPTH;
+    return settings;
 }
 
-static Ray diffuseReflection (Vector normal, Point intersection, Seed * seed) {
-    Vector randVec;
-    randVec.x = (randomDouble(seed)) * 2.0 - 1.0;
-    randVec.y = (randomDouble(seed)) * 2.0 - 1.0;
-    randVec.z = (randomDouble(seed)) * 2.0 - 1.0;
+static inline void mirrorReflection (const Vector * incoming, Vector normal, const Point * intersection, Ray * reflectedRay) {
+    reflectedRay->vector = subtractVector(*incoming, scaleVector(normal, 2 * dotProduct(normal, *incoming)));
+    reflectedRay->vector = normalizeVector(reflectedRay->vector);
+    reflectedRay->origin = movePoint(*intersection, scaleVector(normal, RAY_EPSILON));
+}
 
-    Ray reflectedRay;
-    reflectedRay.vector = normalizeVector(addVector(normal, randVec));
-    reflectedRay.origin = movePoint (intersection, scaleVector(normal, RAY_EPSILON));
+static void diffuseReflection (Vector normal, const Point * intersection, Sampler * sampler, Ray * reflectedRay) {
+    double u = nextSample(sampler);
+    double v = nextSample(sampler);
+    OrthonormalBasis basis = createBasis (normal);
 
-    return reflectedRay;
+    reflectedRay->vector = normalizeVector(basisToWorld (&basis, sampleCosineHemisphere (u, v)));
+    reflectedRay->origin = movePoint (*intersection, scaleVector(normal, RAY_EPSILON));
 }
 
-int tracePath (Ray ray, HitRecord * path, int totalBounces, Scene * scene, Seed * seed) {
-    if (totalBounces >= MAX_BOUNCES) return totalBounces;
-    
-    HitRecord currentHit;
-    if (!getSceneHit(scene, ray, &currentHit)) {
-        return totalBounces;
+static void glassScattering (const Material * mat, const Vector * incoming, const HitRecord * hit, Sampler * sampler, Ray * reflectedRay) {
+    double indexOfRefraction = mat->indexOfRefraction;
+    double cosTheta = dotProduct (*incoming, hit->normal);
+    Vector glassNormal = hit->normal;
+    double refractionRatio = 1.0/indexOfRefraction; //Assuming index of air is 1.0
+
+    if (cosTheta > 0) {
+        glassNormal = scaleVector(hit->normal, -1);
+        refractionRatio = indexOfRefraction; 
     } else {
-        path[totalBounces]  = currentHit;
+        cosTheta = -cosTheta;  
     }
 
-    Material mat = scene->materials[currentHit.materialId];
-
-    Ray reflectedRay;
-    
-    if (mat.type == MATERIAL_MIRROR) {
-        reflectedRay = mirrorReflection(ray.vector, currentHit.normal, currentHit.intersection);
-    } else if (mat.type == MATERIAL_DIFFUSE){
-        reflectedRay = diffuseReflection(currentHit.normal, currentHit.intersection, seed);
-    } else if (mat.type == MATERIAL_GLASS) {
-        double indexOfRefraction = mat.indexOfRefraction;
-        double cosTheta = dotProduct (ray.vector, currentHit.normal);
-        Vector glassNormal = currentHit.normal;
-        double refractionRatio = 1.0/indexOfRefraction; //Assuming index of air is 1.0
-
-        if (cosTheta > 0) {
-            glassNormal = scaleVector(currentHit.normal, -1);
-            refractionRatio = indexOfRefraction; 
-        } else {
-            cosTheta = -cosTheta;  
-        }
+    double internalReflectionCheck = 1.0 - refractionRatio * refractionRatio * (1.0 - cosTheta * cosTheta);
 
-        double internalReflectionCheck = 1.0 - refractionRatio * refractionRatio * (1.0 - cosTheta * cosTheta);
-
-        if (internalReflectionCheck < 0) {
-            //it behaves like a mirror due to total Internal Reflection
-            reflectedRay = mirrorReflection(ray.vector, glassNormal, currentHit.intersection);
-        } else {
-            //schlick approximation
-            double reflectionCoefficient = (1.0 - indexOfRefraction) / (1.0 + indexOfRefraction);
-            reflectionCoefficient = reflectionCoefficient * reflectionCoefficient;
+    if (internalReflectionCheck < 0) {
+        //it behaves like a mirror due to total Internal Reflection
+        mirrorReflection(incoming, glassNormal, &hit->intersection, reflectedRay);
+        return;
+    }
 
-            double fresnelProbability = reflectionCoefficient + (1 - reflectionCoefficient) * pow((1 - cosTheta), 5);
+    //schlick approximation
+    double reflectionCoefficient = (1.0 - indexOfRefraction) / (1.0 + indexOfRefraction);
+    reflectionCoefficient = reflectionCoefficient * reflectionCoefficient;
 
+    double fresnelProbability = reflectionCoefficient + (1 - reflectionCoefficient) * pow((1 - cosTheta), 5);
 
-            if (randomDouble(seed) < fresnelProbability) {
-                //reflection
-                reflectedRay = mirrorReflection(ray.vector, glassNormal, currentHit.intersection);
-            } else {
-                //refraction
-                Vector term1 = scaleVector(ray.vector, refractionRatio);
-                Vector term2 = scaleVector(glassNormal, refractionRatio * cosTheta - sqrt(internalReflectionCheck));
+    if (nextSample(sampler) < fresnelProbability) {
+        //reflection
+        mirrorReflection(incoming, glassNormal, &hit->intersection, reflectedRay);
+    } else {
+        //refraction
+        Vector term1 = scaleVector(*incoming, refractionRatio);
+        Vector term2 = scaleVector(glassNormal, refractionRatio * cosTheta - sqrt(internalReflectionCheck));
 
-                reflectedRay.vector = normalizeVector(addVector(term1, term2));
-                reflectedRay.origin = movePoint(currentHit.intersection, scaleVector(glassNormal, -1 * RAY_EPSILON));
-            }
-        }
+        reflectedRay->vector = normalizeVector(addVector(term1, term2));
+        reflectedRay->origin = movePoint(hit->intersection, scaleVector(glassNormal, -1 * RAY_EPSILON));
+    }
+}
 
+/* picks the next direction. the throughput weight is f * cos / pdf: cosine sampling cancels the
+ * lambertian cos / pi down to the albedo, and the specular materials carry their colour.
+ * pdf is the solid angle density multiple importance sampling needs, 0 for specular bounces */
+void sampleBsdf (const Material * mat, const Vector * incoming, const HitRecord * hit, Vector facingNormal,
+                 Sampler * sampler, Ray * scattered, double * pdf) {
+    switch (mat->type) {
+        case MATERIAL_MIRROR:
+            mirrorReflection(incoming, facingNormal, &hit->intersection, scattered);
+            *pdf = 0;
+            break;
+        case MATERIAL_GLASS:
+            glassScattering (mat, incoming, hit, sampler, scattered);
+            *pdf = 0;
+            break;
+        case MATERIAL_DIFFUSE:
+        default:
+            diffuseReflection(facingNormal, &hit->intersection, sampler, scattered);
+            *pdf = getCosineHemispherePdf (dotProduct (facingNormal, scattered->vector));
+            break;
     }
+}
 
-    return tracePath (reflectedRay, path, totalBounces + 1, scene, seed);
+bool sampleLightRay (Scene * scene, const PathSettings * settings, const Point * origin, Vector normal, const Material * mat,
+                     Sampler * sampler, Ray * shadowRay, double * maxDistance, Vector * contribution) {
+    double uLight = nextSample(sampler);
+    double u = nextSample(sampler);
+    double v = nextSample(sampler);
+    LightSample light;
+    if (!sampleLight (scene, *origin, uLight, u, v, &light) || light.distance <= RAY_EPSILON) return false;
+
+    double cosThetaSurface = dotProduct (normal, light.direction);
+    if (cosThetaSurface <= 0) return false;
+
+    //lambertian brdf albedo / pi; its cosine sampled bounce competes for the same light
+    double bsdfPdf = getCosineHemispherePdf (cosThetaSurface);
+    double weight = settings->multipleImportance ? powerHeuristic (settings->lightSamples * light.pdf, bsdfPdf) : 1.0;
+    double intensity = cosThetaSurface / M_PI * weight / light.pdf / settings->lightSamples;
+
+    *shadowRay = (Ray){*origin, light.direction};
+    *maxDistance = light.distance - RAY_EPSILON;
+    *contribution = scaleVector(multiplyVector(light.emission, mat->color), intensity);
+    return true;
 }
 
-Vector calculatePathColor (HitRecord * path, int numHits, Scene * scene, Seed * seed) {
+static Vector sampleDirectLight (const Point * origin, Vector normal, const Material * mat,
+                                 const PathSettings * settings, Scene * scene, Sampler * sampler) {
     Vector color = {0, 0, 0};
+
+    for (int i = 0; i < settings->lightSamples; ++ i) {
+        Ray shadowRay;
+        double maxDistance;
+        Vector contribution;
+        if (!sampleLightRay (scene, settings, origin, normal, mat, sampler, &shadowRay, &maxDistance, &contribution)) continue;
+        if (getSceneOcclusion(scene, shadowRay, maxDistance)) continue;
+        color = addVector(color, contribution);
+    }
+
+    return color;
+}
+
+Vector getEmittedRadiance (Scene * scene, const PathSettings * settings, const HitRecord * hit, Vector direction,
+                           Point bounceOrigin, double bouncePdf) {
+    const Material * mat = &scene->materials[hit->materialId];
+
+    //emitters shine from their front side only, matching what the light sampler assumes
+    if (maxComponent (mat->emission) <= 0 || dotProduct (hit->normal, direction) >= 0) return (Vector){0, 0, 0};
+
+    double weight = 1.0;
+    bool useLights = scene->numLights > 0 && settings->lightSamples > 0;
+    int primitive = hit->primitive;
+    int light = (useLights && primitive >= 0 && primitive < scene->numTriangles) ? scene->triangleLights[primitive] : -1;
+
+    //a diffuse bounce onto a sampled light competes with the shadow rays of the vertex it left from
+    if (light >= 0 && bouncePdf > 0) {
+        double lightPdf = getLightPdf (scene, bounceOrigin, light, direction, hit->distance);
+        weight = settings->multipleImportance ? powerHeuristic (bouncePdf, settings->lightSamples * lightPdf) : 0.0;
+    }
+    return scaleVector (mat->emission, weight);
+}
+
+bool applyRoulette (const PathSettings * settings, int depth, Vector * throughput, Sampler * sampler) {
+    /* russian roulette: past rouletteDepth vertices a path survives with probability equal to its
+     * largest throughput channel and is divided by that probability, so dim paths end early and
+     * the estimate stays unbiased */
+    if (settings->rouletteDepth <= 0 || depth + 1 < settings->rouletteDepth) return true;
+
+    double survival = fmin (1.0, maxComponent (*throughput));
+    if (nextSample(sampler) >= survival) return false;
+    *throughput = scaleVector (*throughput, 1.0 / survival);
+    return true;
+}
+
+/* one pass from the camera outwards: each vertex adds its emission and direct light to the
+ * radiance through the current throughput, samples the next direction and multiplies the
+ * throughput by its weight. only the previous bounce's origin and pdf are kept for the MIS
+ * weight of emission it runs into, so depth is bounded by the settings and nothing else. */
+static Vector integratePath (Ray ray, HitRecord hit, const PathSettings * settings, Scene * scene, Sampler * sampler) {
+    Vector radiance = {0, 0, 0};
     Vector throughput = {1, 1, 1};
+    bool useLights = scene->numLights > 0 && settings->lightSamples > 0;
 
-    for (int i = 0; i < numHits; ++ i) {
-        HitRecord * currentHit = &(path [i]);
-        Material mat = scene->materials [currentHit->materialId];
+    //where the previous bounce left from and its pdf, 0 after a specular bounce or at the camera
+    Point bounceOrigin = ray.origin;
+    double bouncePdf = 0;
 
-        if (i == 0) {
-            color = addVector(color, multiplyVector (throughput, mat.emission));
-        }
+    for (int depth = 0; ; ++ depth) {
+        const Material * mat = &scene->materials[hit.materialId];
+
+        radiance = addVector (radiance, multiplyVector (throughput, getEmittedRadiance (scene, settings, &hit, ray.vector, bounceOrigin, bouncePdf)));
+
+        Vector facingNormal = (mat->type == MATERIAL_GLASS) ? hit.normal : getFacingNormal (hit.normal, ray.vector);
 
-        if (scene->hasLight) {
-            Vector directionToLight = getVector (currentHit->intersection, scene->lightVertex);
-            double distanceToLight = vectorLength(directionToLight);
-            directionToLight = normalizeVector(directionToLight);
-            Vector directionFromLight = scaleVector(directionToLight, -1.0);
-
-            double cosThetaLight = dotProduct(scene->lightNormal, directionFromLight);
-            double cosThetaSurface = dotProduct (currentHit->normal, directionToLight);
-
-            if(cosThetaLight > 0 && cosThetaSurface >0) {
-                Point origin = movePoint(currentHit->intersection, scaleVector(currentHit->normal, RAY_EPSILON));
-                Ray directLightRay = {origin, directionToLight};
-
-                HitRecord directLightHit;
-                if (!getSceneHit(scene, directLightRay, &directLightHit) || directLightHit.distance > (distanceToLight - RAY_EPSILON)) {
-                    if (cosThetaSurface > 0) {
-                        double falloff = 1.0/(distanceToLight * distanceToLight + 1);
-                        double intensity = cosThetaSurface * cosThetaLight * falloff;
-
-                        Vector directLightContribution = scaleVector(scene->materials[scene->lightMaterialId].emission, intensity);
-                        Vector reflectedLight = multiplyVector(directLightContribution, mat.color);
-                        color = addVector(color, multiplyVector(throughput, reflectedLight));
-                    }
-                }
-            }
+        if (useLights && mat->type == MATERIAL_DIFFUSE) {
+            Point origin = movePoint (hit.intersection, scaleVector (facingNormal, RAY_EPSILON));
+            Vector directLight = sampleDirectLight (&origin, facingNormal, mat, settings, scene, sampler);
+            radiance = addVector (radiance, multiplyVector (throughput, directLight));
         }
 
-        throughput = multiplyVector (throughput, mat.color);
+        if (depth + 1 >= settings->maxDepth) break;
+
+        throughput = multiplyVector (throughput, mat->color);
+
+        if (!applyRoulette (settings, depth, &throughput, sampler)) break;
+
+        Ray scattered;
+        sampleBsdf (mat, &ray.vector, &hit, facingNormal, sampler, &scattered, &bouncePdf);
+        bounceOrigin = scattered.origin;
+        ray = scattered;
+
+        if (!getSceneHit (scene, ray, &hit)) break;
     }
 
-    return color;
+    return radiance;
+}
+
+Vector traceRadiance (const Ray * cameraRay, const PathSettings * settings, Scene * scene, Sampler * sampler) {
+    HitRecord hit;
+    if (!getSceneHit (scene, *cameraRay, &hit)) return (Vector){0, 0, 0};
+    return integratePath (*cameraRay, hit, settings, scene, sampler);
+}
+
+Vector traceRadianceFromHit (const Ray * cameraRay, const HitRecord * firstHit, const PathSettings * settings, Scene * scene, Sampler * sampler) {
+    //the first hit came from a ray packet, the bounces after it are traced one ray at a time
+    return integratePath (*cameraRay, *firstHit, settings, scene, sampler);
 }
\ No newline at end of file
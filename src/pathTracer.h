@@ -2,11 +2,38 @@
 #define PATH_TRACER_H
 
 #include "ray.h"
-#include "rand.h"
+#include "sampler.h"
 #include "constants.h"
 
+typedef struct {
+    int lightSamples;        // shadow rays towards the area light at every diffuse vertex
+    bool multipleImportance; // weight light and bsdf samples of the light with the power heuristic
+    int maxDepth;            // vertices at most
+    int rouletteDepth;       // vertices every path keeps before russian roulette may end it, 0 for never
+} PathSettings;
 
-int tracePath (Ray ray, HitRecord * path, int totalBounces, Scene * scene, Seed * seed);
-Vector calculatePathColor (HitRecord * path, int numHits, Scene * scene, Seed * seed);
+PathSettings defaultPathSettings ();
+
+// radiance arriving along the camera ray, estimated by one path
+Vector traceRadiance (const Ray * cameraRay, const PathSettings * settings, Scene * scene, Sampler * sampler);
+Vector traceRadianceFromHit (const Ray * cameraRay, const HitRecord * firstHit, const PathSettings * settings, Scene * scene, Sampler * sampler);
+
+/* the steps of one path vertex, shared by traceRadiance and the wavefront engine */
+
+// glass needs the geometric side to tell entering from leaving, everything else shades the side the ray came from
+static inline Vector getFacingNormal (Vector normal, Vector incoming) {
+    return dotProduct (normal, incoming) > 0 ? scaleVector (normal, -1) : normal;
+}
+
+// emission seen along direction, MIS weighted against the shadow rays of the vertex the bounce left from
+Vector getEmittedRadiance (Scene * scene, const PathSettings * settings, const HitRecord * hit, Vector direction,
+                           Point bounceOrigin, double bouncePdf);
+// one shadow ray towards a light and what it adds if unoccluded, already divided by lightSamples
+bool sampleLightRay (Scene * scene, const PathSettings * settings, const Point * origin, Vector normal, const Material * mat,
+                     Sampler * sampler, Ray * shadowRay, double * maxDistance, Vector * contribution);
+// false when russian roulette ends the path, otherwise the throughput is divided by the survival odds
+bool applyRoulette (const PathSettings * settings, int depth, Vector * throughput, Sampler * sampler);
+void sampleBsdf (const Material * mat, const Vector * incoming, const HitRecord * hit, Vector facingNormal,
+                 Sampler * sampler, Ray * scattered, double * pdf);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,26 @@
+#include "pixelMap.h"
+#include <stdlib.h>
+
+PixelMap * createPixelMap (int width, int height) {
+    PixelMap * map = malloc(sizeof(PixelMap));
+    map->width = width;
+    map->height = height;
+    map->size = width * height * sizeof(unsigned char) * 4;
+    map->data = malloc (map->size);
+    return map;
+}
+
+void setPixelColor (PixelMap * map, int x, int y, Vector color) {
+    int index = (x + y * map->width) * 4;
+    double gamma = 1.0/2.2;
+    map->data[index + 0] = (unsigned char)(fmin(1.0, pow(color.x, gamma)) * 255.0); 
+    map->data[index + 1] = (unsigned char)(fmin(1.0, pow(color.y, gamma)) * 255.0); 
+    map->data[index + 2] = (unsigned char)(fmin(1.0, pow(color.z, gamma)) * 255.0); 
+    map->data[index + 3] = 255; 
+}
+
+void freePixelMap (PixelMap * map) {
+    if (!map) return;
+    free (map->data);
+    free (map);
+}
\ No newline at end of file
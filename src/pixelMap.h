@@ -0,0 +1,17 @@
+#ifndef PIXEL_MAP_H
+#define PIXEL_MAP_H
+
+#include "vectorMath.h"
+
+typedef struct {
+    int width;
+    int height;
+    unsigned char * data;
+    int size;
+} PixelMap;
+
+PixelMap * createPixelMap (int width, int height);
+void setPixelColor (PixelMap * map, int x, int y, Vector color);
+void freePixelMap (PixelMap * map);
+
+#endif
\ No newline at end of file
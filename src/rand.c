@@ -17,4 +17,41 @@ Seed * generateSeed(){
     }
 
     return newSeed;
+}
+
+static uint64_t splitMix64 (uint64_t * state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void initSeed (Seed * seed, uint64_t value) {
+    //splitmix64 expands a single user seed into a full xoshiro state (never all zero)
+    for (int index = 0; index < 4; ++ index) {
+        seed->state[index] = splitMix64 (&value);
+    }
+}
+
+void jumpSeed (Seed * seed) {
+    //advances the state by 2^128 steps, giving non-overlapping streams for parallel work
+    static const uint64_t jump[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < 4; ++ i) {
+        for (int bit = 0; bit < 64; ++ bit) {
+            if (jump[i] & ((uint64_t)1 << bit)) {
+                s0 ^= seed->state[0];
+                s1 ^= seed->state[1];
+                s2 ^= seed->state[2];
+                s3 ^= seed->state[3];
+            }
+            advanceState (seed->state);
+        }
+    }
+
+    seed->state[0] = s0;
+    seed->state[1] = s1;
+    seed->state[2] = s2;
+    seed->state[3] = s3;
 }
\ No newline at end of file
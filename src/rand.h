@@ -8,6 +8,8 @@ typedef struct {
 } Seed;
 
 Seed * generateSeed();
+void initSeed (Seed * seed, uint64_t value);
+void jumpSeed (Seed * seed);
 
 static inline uint64_t rotate (uint64_t number, int rotationDistance) {
     return (number << rotationDistance) |  (number >> (64- rotationDistance));
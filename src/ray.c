@@ -1,152 +1,584 @@
 #include "ray.h"
 #include "bvh.h"
-#include <float.h>
+#include "wideBvh.h"
+#include "rayPacket.h"
 #include <stdio.h>
-
-bool getTriangleHit (Triangle triangle, Ray ray, double minDist, double maxDist, HitRecord * record) {
-    //Moller Trumbore intersection algorithm
-    Vector rayCrossE2 = crossProduct (ray.vector, triangle.edge2);
-    double det = dotProduct (triangle.edge1, rayCrossE2);
-
-    if (det > -DBL_EPSILON && det < DBL_EPSILON) {
-        return false;
+#include <string.h>
+
+TriangleRay createTriangleRay (Ray ray) {
+    double direction[3] = {ray.vector.x, ray.vector.y, ray.vector.z};
+    TriangleRay prepared;
+    prepared.origin = ray.origin;
+
+    prepared.kz = 0;
+    if (fabs (direction[1]) > fabs (direction[prepared.kz])) prepared.kz = 1;
+    if (fabs (direction[2]) > fabs (direction[prepared.kz])) prepared.kz = 2;
+    prepared.kx = (prepared.kz + 1) % 3;
+    prepared.ky = (prepared.kx + 1) % 3;
+    //looking down a negative axis mirrors the plane, which swapping x and y undoes
+    if (direction[prepared.kz] < 0) {
+        int swap = prepared.kx;
+        prepared.kx = prepared.ky;
+        prepared.ky = swap;
     }
 
-    double inverseDet = 1.0 / det;
+    prepared.shearX = direction[prepared.kx] / direction[prepared.kz];
+    prepared.shearY = direction[prepared.ky] / direction[prepared.kz];
+    prepared.shearZ = 1.0 / direction[prepared.kz];
+    return prepared;
+}
 
-    Vector s = getVector (triangle.p1, ray.origin);
-    double u = dotProduct (s, rayCrossE2) * inverseDet;
+bool intersectTriangle (const Scene * scene, const Triangle * triangle, const TriangleRay * ray, double minDist, double maxDist, double * distance) {
+    /* watertight test: the vertices move into a space where the ray runs down +z from the origin,
+     * so the hit is a 2d point in triangle test on the xy plane. an edge shared by two triangles
+     * yields the same edge function with opposite signs in both, so a ray can not slip between them */
+    Point origin = ray->origin;
+    double a[3], b[3], c[3];
+    const Vertex * v1 = &scene->vertices[triangle->vertices[0]];
+    const Vertex * v2 = &scene->vertices[triangle->vertices[1]];
+    const Vertex * v3 = &scene->vertices[triangle->vertices[2]];
+    a[0] = v1->x - origin.x; a[1] = v1->y - origin.y; a[2] = v1->z - origin.z;
+    b[0] = v2->x - origin.x; b[1] = v2->y - origin.y; b[2] = v2->z - origin.z;
+    c[0] = v3->x - origin.x; c[1] = v3->y - origin.y; c[2] = v3->z - origin.z;
+
+    double ax = a[ray->kx] - ray->shearX * a[ray->kz];
+    double ay = a[ray->ky] - ray->shearY * a[ray->kz];
+    double bx = b[ray->kx] - ray->shearX * b[ray->kz];
+    double by = b[ray->ky] - ray->shearY * b[ray->kz];
+    double cx = c[ray->kx] - ray->shearX * c[ray->kz];
+    double cy = c[ray->ky] - ray->shearY * c[ray->kz];
+
+    //scaled barycentrics; a hit exactly on an edge or vertex counts for every triangle sharing it
+    double u = cx * by - cy * bx;
+    double v = ax * cy - ay * cx;
+    double w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+
+    double det = u + v + w;
+    if (det == 0) return false;
+
+    double t = u * (ray->shearZ * a[ray->kz]) + v * (ray->shearZ * b[ray->kz]) + w * (ray->shearZ * c[ray->kz]);
+    *distance = t / det;
+
+    //written so a NaN distance is rejected too
+    return *distance >= minDist && *distance <= maxDist;
+}
+
+bool intersectSphere (const Sphere * sphere, Ray ray, double minDist, double maxDist, double * distance) {
+    Vector originToCenter = getVector (sphere->center, ray.origin);
+    double a = dotProduct (ray.vector, ray.vector);
+    double halfB = dotProduct (originToCenter, ray.vector);
+    double c = dotProduct (originToCenter, originToCenter) - sphere->radius * sphere->radius;
+    double discriminant = halfB * halfB - a * c;
 
-    if ((u < 0 && fabs (u) > DBL_EPSILON) || (u > 1 && fabs (u - 1) > DBL_EPSILON)) {
+    if (discriminant < 0.0) {
         return false;
     }
 
-    Vector sCrossE1 = crossProduct (s, triangle.edge1);
-    double v = inverseDet * dotProduct (ray.vector, sCrossE1);
+    double sqrtDisc = sqrt (discriminant);
+    *distance = (-halfB - sqrtDisc) / a;
 
-    if ((v < 0 && fabs (v) > DBL_EPSILON) || ((u + v) > 1 && fabs (u + v - 1) > DBL_EPSILON)) {
-        return false;
+    if (*distance < minDist || *distance > maxDist) {
+        *distance = (-halfB + sqrtDisc) / a;
+        if (*distance < minDist || *distance > maxDist) {
+            return false;
+        }
     }
 
-    double distance = inverseDet * dotProduct (triangle.edge2, sCrossE1);
+    return true;
+}
 
-    if (distance < minDist || distance > maxDist) {
+bool getTriangleHit (const Scene * scene, const Triangle * triangle, Ray ray, double minDist, double maxDist, HitRecord * record) {
+    double distance;
+    TriangleRay prepared = createTriangleRay (ray);
+    if (!intersectTriangle (scene, triangle, &prepared, minDist, maxDist, &distance)) {
         return false;
     }
 
     record->distance = distance;
     record->intersection = movePoint (ray.origin, scaleVector (ray.vector, distance));
-    record->normal = triangle.normal;
-    record->materialId = triangle.materialId;
+    record->normal = getTriangleNormal (scene, triangle);
+    record->materialId = triangle->materialId;
+    record->primitive = -1;
     return true;
 }
 
 bool getSphereHit (Sphere sphere, Ray ray, double minDist, double maxDist, HitRecord * record){
-    Vector originToCenter = getVector (sphere.center, ray.origin);
-    double a = dotProduct (ray.vector, ray.vector);
-    double halfB = dotProduct (originToCenter, ray.vector);
-    double c = dotProduct (originToCenter, originToCenter) - sphere.radius * sphere.radius;
-    double discriminant = halfB * halfB - a * c;
-
-    if (discriminant < 0.0) {
+    double distance;
+    if (!intersectSphere (&sphere, ray, minDist, maxDist, &distance)) {
         return false;
     }
 
-    double sqrtDisc = sqrt (discriminant);
-    double distance = (-halfB - sqrtDisc) / a;
-
-    if (distance < minDist || distance > maxDist) {
-        distance = (-halfB + sqrtDisc) / a;
-        if (distance < minDist || distance > maxDist) {
-            return false;
-        }
-    }
-
     record->distance = distance;
     record->intersection = movePoint (ray.origin, scaleVector (ray.vector, distance));
     record->normal = scaleVector (getVector (sphere.center, record->intersection), 1.0 / sphere.radius);
     record->materialId = sphere.materialId;
+    record->primitive = -1;
     return true;
 }
 
-static bool boundingBoxHit (BoundingBox * box, Ray ray) {
-    //slab method
+typedef struct {
+    double origin[3];
+    double inverseDirection[3];
+    int directionIsNegative[3];
+} TraversalRay;
+
+static inline TraversalRay createTraversalRay (Ray ray) {
+    //the reciprocal direction and its signs are computed once per ray instead of once per node
+    TraversalRay traversal;
+    traversal.origin[0] = ray.origin.x;
+    traversal.origin[1] = ray.origin.y;
+    traversal.origin[2] = ray.origin.z;
+    traversal.inverseDirection[0] = 1.0 / ray.vector.x;
+    traversal.inverseDirection[1] = 1.0 / ray.vector.y;
+    traversal.inverseDirection[2] = 1.0 / ray.vector.z;
+    for (int axis = 0; axis < 3; ++ axis) {
+        traversal.directionIsNegative[axis] = traversal.inverseDirection[axis] < 0;
+    }
+    return traversal;
+}
+
+static inline bool nodeBoxHit (const BVHNode * node, const TraversalRay * ray, double maxDist) {
+    //slab method; comparisons involving NaN (ray origin on a slab with a parallel direction) never reject
     double close = -INFINITY, far = INFINITY;
-    double tempTLow, tempTHigh;
 
-    double invX = 1.0/ ray.vector.x;
-    double invY = 1.0/ ray.vector.y;
-    double invZ = 1.0/ ray.vector.z;
+    for (int axis = 0; axis < 3; ++ axis) {
+        const float * nearPlane = ray->directionIsNegative[axis] ? node->max : node->min;
+        const float * farPlane = ray->directionIsNegative[axis] ? node->min : node->max;
+        double tNear = (nearPlane[axis] - ray->origin[axis]) * ray->inverseDirection[axis];
+        double tFar = (farPlane[axis] - ray->origin[axis]) * ray->inverseDirection[axis];
 
-    tempTLow = (box->min.x - ray.origin.x) * invX;
-    tempTHigh = (box->max.x - ray.origin.x) * invX;
-    close = fmax(close, fmin(tempTLow, tempTHigh));
-    far = fmin(far, fmax(tempTLow, tempTHigh));
-    
-    tempTLow = (box->min.y - ray.origin.y) * invY;
-    tempTHigh = (box->max.y - ray.origin.y) * invY;
-    close = fmax(close, fmin(tempTLow, tempTHigh));
-    far = fmin(far, fmax(tempTLow, tempTHigh));
+        if (close > tFar || tNear > far) return false;
+        if (tNear > close) close = tNear;
+        if (tFar < far) far = tFar;
+    }
+
+    return !(far < RAY_EPSILON || close > maxDist);
+}
+
+static void fillHitRecord (Scene * scene, int primitive, Ray ray, double distance, HitRecord * record) {
+    record->distance = distance;
+    record->intersection = movePoint (ray.origin, scaleVector (ray.vector, distance));
+    record->primitive = primitive;
+
+    if (primitive < scene->numTriangles) {
+        Triangle * triangle = &scene->triangles[primitive];
+        record->normal = getTriangleNormal (scene, triangle);
+        record->materialId = triangle->materialId;
+    } else {
+        Sphere * sphere = &scene->spheres[primitive - scene->numTriangles];
+        record->normal = scaleVector (getVector (sphere->center, record->intersection), 1.0 / sphere->radius);
+        record->materialId = sphere->materialId;
+    }
+}
 
-    tempTLow = (box->min.z - ray.origin.z) * invZ;
-    tempTHigh = (box->max.z - ray.origin.z) * invZ;
-    close = fmax(close, fmin(tempTLow, tempTHigh));
-    far = fmin(far, fmax(tempTLow, tempTHigh));
+static inline bool intersectPrimitive (Scene * scene, int primitive, Ray ray, const TriangleRay * triangleRay,
+                                       double minDist, double maxDist, double * distance) {
+    if (primitive < scene->numTriangles) {
+        return intersectTriangle (scene, &(scene->triangles[primitive]), triangleRay, minDist, maxDist, distance);
+    }
+    return intersectSphere (&(scene->spheres[primitive - scene->numTriangles]), ray, minDist, maxDist, distance);
+}
 
-    if (close > far || far < RAY_EPSILON) return false;
+/* iterative traversal over the flattened tree: the nearer child (by the sign of the ray along the
+ * node's split axis) is visited next and the farther one is pushed on a fixed stack. */
+
+static bool getBVHHit (Scene * scene, Ray ray, double minDist, double maxDist, HitRecord * record, int * visits) {
+    if (scene->numBVHNodes == 0) return false;
+
+    TraversalRay traversal = createTraversalRay (ray);
+    TriangleRay triangleRay = createTriangleRay (ray);
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int current = 0;
+    int closestPrimitive = -1;
+    double closest = maxDist;
+
+    for (;;) {
+        const BVHNode * node = &scene->bvhNodes[current];
+        if (visits) (*visits) ++;
+
+        if (nodeBoxHit (node, &traversal, closest)) {
+            if (node->numPrimitives > 0) {
+                int end = node->offset + node->numPrimitives;
+                for (int i = node->offset; i < end; ++ i) {
+                    double distance;
+                    if (intersectPrimitive (scene, scene->bvhPrimitives[i], ray, &triangleRay, minDist, closest, &distance)) {
+                        closest = distance;
+                        closestPrimitive = scene->bvhPrimitives[i];
+                    }
+                }
+            } else if (traversal.directionIsNegative[node->axis]) {
+                stack[stackSize ++] = current + 1;
+                current = node->offset;
+                continue;
+            } else {
+                stack[stackSize ++] = node->offset;
+                current = current + 1;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) break;
+        current = stack[-- stackSize];
+    }
+
+    if (closestPrimitive < 0) return false;
+
+    //only the winning primitive pays for building the record
+    fillHitRecord (scene, closestPrimitive, ray, closest, record);
     return true;
 }
 
-static bool getBVHHit (Scene * scene, BVHNode * currentNode, Ray ray, double minDist, double maxDist, HitRecord * record) {
-    if (currentNode == NULL) return false;
-    if (!boundingBoxHit (&(currentNode->bounds), ray)) return false;
+static bool getBVHOcclusion (Scene * scene, Ray ray, double minDist, double maxDist) {
+    if (scene->numBVHNodes == 0) return false;
+
+    TraversalRay traversal = createTraversalRay (ray);
+    TriangleRay triangleRay = createTriangleRay (ray);
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int current = 0;
+
+    for (;;) {
+        const BVHNode * node = &scene->bvhNodes[current];
+
+        if (nodeBoxHit (node, &traversal, maxDist)) {
+            if (node->numPrimitives > 0) {
+                int end = node->offset + node->numPrimitives;
+                for (int i = node->offset; i < end; ++ i) {
+                    double distance;
+                    //any hit inside the segment is enough
+                    if (intersectPrimitive (scene, scene->bvhPrimitives[i], ray, &triangleRay, minDist, maxDist, &distance)) return true;
+                }
+            } else if (traversal.directionIsNegative[node->axis]) {
+                stack[stackSize ++] = current + 1;
+                current = node->offset;
+                continue;
+            } else {
+                stack[stackSize ++] = node->offset;
+                current = current + 1;
+                continue;
+            }
+        }
 
-    if (currentNode->left || currentNode->right) {
-        bool leftResult = getBVHHit(scene, currentNode->left, ray, minDist, maxDist, record);
-        
-        if (leftResult) maxDist = record->distance;
+        if (stackSize == 0) break;
+        current = stack[-- stackSize];
+    }
 
-        bool rightResult = getBVHHit(scene, currentNode->right, ray, minDist, maxDist, record);
+    return false;
+}
 
-        return leftResult || rightResult;
+/* wide traversal: one box test covers every child of a node. leaf children are intersected straight
+ * away in near to far order, interior children are pushed far to near so the nearest is popped next.
+ * entries remember their entry distance and are dropped once a closer hit has been found. */
+
+typedef struct {
+    int node;
+    float distance;
+} WideStackEntry;
+
+static inline int sortWideLanes (int mask, const float * tNear, int * lanes) {
+    int count = 0;
+    while (mask) {
+        int lane = __builtin_ctz (mask);
+        mask &= mask - 1;
+
+        int i = count ++;
+        while (i > 0 && tNear[lanes[i - 1]] > tNear[lane]) {
+            lanes[i] = lanes[i - 1];
+            -- i;
+        }
+        lanes[i] = lane;
     }
+    return count;
+}
 
-    if (currentNode->type == TRIANGLE) {
-        return getTriangleHit (scene->triangles[currentNode->index], ray, minDist, maxDist, record);
-    } else if (currentNode->type == SPHERE) {
-        return getSphereHit (scene->spheres[currentNode->index], ray, minDist, maxDist, record);
+static bool getWideBVHHit (Scene * scene, Ray ray, double minDist, double maxDist, HitRecord * record) {
+    if (scene->numWideBVHNodes == 0) return false;
+
+    WideRay wideRay = createWideRay (ray.origin, ray.vector);
+    TriangleRay triangleRay = createTriangleRay (ray);
+    WideStackEntry stack[WIDE_BVH_STACK_SIZE];
+    int stackSize = 0;
+    int closestPrimitive = -1;
+    double closest = maxDist;
+
+    stack[stackSize ++] = (WideStackEntry){0, -INFINITY};
+
+    while (stackSize > 0) {
+        WideStackEntry entry = stack[-- stackSize];
+        if (entry.distance > closest) continue;
+
+        const WideBVHNode * node = &scene->wideBVHNodes[entry.node];
+        float tNear[WIDE_BVH_LANES];
+        //rounded up so a box touching the current closest hit is never dropped
+        int mask = testWideNode (node, &wideRay, scene->wideBVHWidth, scene->simdLevel,
+                                 nextafterf ((float) closest, INFINITY), tNear);
+
+        int lanes[WIDE_BVH_LANES];
+        int count = sortWideLanes (mask, tNear, lanes);
+
+        for (int i = 0; i < count; ++ i) {
+            int lane = lanes[i];
+            if (node->numPrimitives[lane] == 0 || tNear[lane] > closest) continue;
+
+            int end = node->offset[lane] + node->numPrimitives[lane];
+            for (int j = node->offset[lane]; j < end; ++ j) {
+                double distance;
+                if (intersectPrimitive (scene, scene->bvhPrimitives[j], ray, &triangleRay, minDist, closest, &distance)) {
+                    closest = distance;
+                    closestPrimitive = scene->bvhPrimitives[j];
+                }
+            }
+        }
+
+        for (int i = count - 1; i >= 0; -- i) {
+            int lane = lanes[i];
+            if (node->numPrimitives[lane] > 0 || tNear[lane] > closest) continue;
+            stack[stackSize ++] = (WideStackEntry){node->offset[lane], tNear[lane]};
+        }
+    }
+
+    if (closestPrimitive < 0) return false;
+
+    fillHitRecord (scene, closestPrimitive, ray, closest, record);
+    return true;
+}
+
+static bool getWideBVHOcclusion (Scene * scene, Ray ray, double minDist, double maxDist) {
+    if (scene->numWideBVHNodes == 0) return false;
+
+    WideRay wideRay = createWideRay (ray.origin, ray.vector);
+    TriangleRay triangleRay = createTriangleRay (ray);
+    float boxLimit = nextafterf ((float) maxDist, INFINITY);
+    int stack[WIDE_BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    stack[stackSize ++] = 0;
+
+    while (stackSize > 0) {
+        const WideBVHNode * node = &scene->wideBVHNodes[stack[-- stackSize]];
+        float tNear[WIDE_BVH_LANES];
+        int mask = testWideNode (node, &wideRay, scene->wideBVHWidth, scene->simdLevel, boxLimit, tNear);
+
+        //order does not matter for an any-hit query
+        while (mask) {
+            int lane = __builtin_ctz (mask);
+            mask &= mask - 1;
+
+            if (node->numPrimitives[lane] == 0) {
+                stack[stackSize ++] = node->offset[lane];
+                continue;
+            }
+
+            int end = node->offset[lane] + node->numPrimitives[lane];
+            for (int j = node->offset[lane]; j < end; ++ j) {
+                double distance;
+                if (intersectPrimitive (scene, scene->bvhPrimitives[j], ray, &triangleRay, minDist, maxDist, &distance)) return true;
+            }
+        }
     }
 
     return false;
+}
+
+/* packet traversal: a group of coherent rays walks the binary tree together. each node is tested
+ * against every ray still active there, and only the rays that hit it go on to its children, so
+ * node fetches and leaf triangles are shared by the whole packet. children are ordered by the
+ * direction of the first active ray, which is close enough for rays leaving one camera pixel block. */
+
+typedef struct {
+    int node;
+    int mask;
+} PacketStackEntry;
+
+static void getBVHPacketHits (Scene * scene, RayPacket * packet) {
+    if (scene->numBVHNodes == 0) return;
+
+    SimdLevel level = (SimdLevel) scene->simdLevel;
+    PacketStackEntry stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int current = 0;
+    int mask = packet->activeMask;
+
+    for (;;) {
+        const BVHNode * node = &scene->bvhNodes[current];
+        int hitMask = testPacketNode (node, packet, mask, level);
+
+        if (hitMask) {
+            if (node->numPrimitives > 0) {
+                int end = node->offset + node->numPrimitives;
+                for (int i = node->offset; i < end; ++ i) {
+                    int primitive = scene->bvhPrimitives[i];
+                    if (primitive < scene->numTriangles) {
+                        intersectPacketTriangle (packet, scene, &scene->triangles[primitive], primitive, hitMask, level);
+                        continue;
+                    }
+
+                    for (int lanes = hitMask; lanes; lanes &= lanes - 1) {
+                        int lane = __builtin_ctz (lanes);
+                        double distance;
+                        if (intersectSphere (&scene->spheres[primitive - scene->numTriangles], packet->rays[lane],
+                                             packet->minDist, packet->closest[lane], &distance)) {
+                            packet->closest[lane] = distance;
+                            packet->primitive[lane] = primitive;
+                        }
+                    }
+                }
+            } else {
+                int lead = __builtin_ctz (hitMask);
+                double direction[3] = {packet->directionX[lead], packet->directionY[lead], packet->directionZ[lead]};
+                int nearChild = (direction[node->axis] < 0) ? node->offset : current + 1;
+                int farChild = (direction[node->axis] < 0) ? current + 1 : node->offset;
+
+                stack[stackSize ++] = (PacketStackEntry){farChild, hitMask};
+                current = nearChild;
+                mask = hitMask;
+                continue;
+            }
+        }
 
+        if (stackSize == 0) break;
+        -- stackSize;
+        current = stack[stackSize].node;
+        mask = stack[stackSize].mask;
+    }
+}
+
+void getScenePacketHits (Scene * scene, const Ray * rays, int numRays, HitRecord * records, bool * hits) {
+    //without SIMD a packet only adds work over single rays, which stop at the first missed slab
+    if (scene->backend == BACKEND_BRUTE_FORCE || scene->simdLevel == SIMD_SCALAR) {
+        for (int i = 0; i < numRays; ++ i) {
+            hits[i] = getSceneHit (scene, rays[i], &records[i]);
+        }
+        return;
+    }
+
+    for (int start = 0; start < numRays; start += RAY_PACKET_SIZE) {
+        int count = (numRays - start < RAY_PACKET_SIZE) ? numRays - start : RAY_PACKET_SIZE;
+        RayPacket packet;
+        initRayPacket (&packet, rays + start, count, RAY_EPSILON, 1e20);
+        getBVHPacketHits (scene, &packet);
+
+        for (int i = 0; i < count; ++ i) {
+            hits[start + i] = packet.primitive[i] >= 0;
+            if (hits[start + i]) {
+                fillHitRecord (scene, packet.primitive[i], rays[start + i], packet.closest[i], &records[start + i]);
+            }
+        }
+    }
 }
 
 bool getSceneHitBVH (Scene * scene, Ray ray, HitRecord * record) {
     double maxDistance = 1e20;
     
-    return getBVHHit(scene, scene->root, ray, RAY_EPSILON, maxDistance, record);
+    return getBVHHit(scene, ray, RAY_EPSILON, maxDistance, record, NULL);
 }
 
-bool getSceneHit (Scene * scene, Ray ray, HitRecord * record) {
+bool getSceneHitBruteForce (Scene * scene, Ray ray, HitRecord * record) {
     double closest = 1e20;
-    bool hit = false;
-    HitRecord temp;
+    int closestPrimitive = -1;
+    TriangleRay triangleRay = createTriangleRay (ray);
 
     for (int i = 0; i < scene->numSpheres; ++ i) {
-        if (getSphereHit (scene->spheres[i], ray, RAY_EPSILON, closest, &temp)) {
-            closest = temp.distance;
-            *record = temp;
-            hit = true;
+        double distance;
+        if (intersectSphere (&scene->spheres[i], ray, RAY_EPSILON, closest, &distance)) {
+            closest = distance;
+            closestPrimitive = scene->numTriangles + i;
         }
     }
 
     for (int i = 0; i < scene->numTriangles; ++ i) {
-        if (getTriangleHit (scene->triangles[i], ray, RAY_EPSILON, closest, &temp)) {
-            closest = temp.distance;
-            *record = temp;
-            hit = true;
+        double distance;
+        if (intersectTriangle (scene, &scene->triangles[i], &triangleRay, RAY_EPSILON, closest, &distance)) {
+            closest = distance;
+            closestPrimitive = i;
         }
     }
 
-    return hit;
+    if (closestPrimitive < 0) return false;
+
+    fillHitRecord (scene, closestPrimitive, ray, closest, record);
+    return true;
+}
+
+int countBVHNodeVisits (Scene * scene, Ray ray) {
+    HitRecord record;
+    int visits = 0;
+    getBVHHit(scene, ray, RAY_EPSILON, 1e20, &record, &visits);
+    return visits;
+}
+
+bool getSceneHitWideBVH (Scene * scene, Ray ray, HitRecord * record) {
+    return getWideBVHHit (scene, ray, RAY_EPSILON, 1e20, record);
+}
+
+bool getSceneOcclusionWideBVH (Scene * scene, Ray ray, double maxDist) {
+    return getWideBVHOcclusion (scene, ray, RAY_EPSILON, maxDist);
+}
+
+bool getSceneOcclusionBVH (Scene * scene, Ray ray, double maxDist) {
+    return getBVHOcclusion (scene, ray, RAY_EPSILON, maxDist);
+}
+
+bool getSceneOcclusionBruteForce (Scene * scene, Ray ray, double maxDist) {
+    double distance;
+    TriangleRay triangleRay = createTriangleRay (ray);
+
+    for (int i = 0; i < scene->numSpheres; ++ i) {
+        if (intersectSphere (&(scene->spheres[i]), ray, RAY_EPSILON, maxDist, &distance)) return true;
+    }
+
+    for (int i = 0; i < scene->numTriangles; ++ i) {
+        if (intersectTriangle (scene, &(scene->triangles[i]), &triangleRay, RAY_EPSILON, maxDist, &distance)) return true;
+    }
+
+    return false;
+}
+
+bool getSceneHit (Scene * scene, Ray ray, HitRecord * record) {
+    //every ray query goes through here so the backend can be swapped at runtime
+    switch (scene->backend) {
+        case BACKEND_WIDE_BVH:
+            return getSceneHitWideBVH (scene, ray, record);
+        case BACKEND_BVH:
+            return getSceneHitBVH (scene, ray, record);
+        case BACKEND_BRUTE_FORCE:
+        default:
+            return getSceneHitBruteForce (scene, ray, record);
+    }
+}
+
+bool getSceneOcclusion (Scene * scene, Ray ray, double maxDist) {
+    switch (scene->backend) {
+        case BACKEND_WIDE_BVH:
+            return getSceneOcclusionWideBVH (scene, ray, maxDist);
+        case BACKEND_BVH:
+            return getSceneOcclusionBVH (scene, ray, maxDist);
+        case BACKEND_BRUTE_FORCE:
+        default:
+            return getSceneOcclusionBruteForce (scene, ray, maxDist);
+    }
+}
+
+const char * getBackendName (IntersectionBackend backend) {
+    switch (backend) {
+        case BACKEND_WIDE_BVH: return "wide";
+        case BACKEND_BVH: return "bvh";
+        case BACKEND_BRUTE_FORCE: return "brute";
+        default: return "unknown";
+    }
+}
+
+bool parseBackendName (const char * name, IntersectionBackend * backend) {
+    if (strcmp (name, "wide") == 0) {
+        *backend = BACKEND_WIDE_BVH;
+    } else if (strcmp (name, "bvh") == 0) {
+        *backend = BACKEND_BVH;
+    } else if (strcmp (name, "brute") == 0) {
+        *backend = BACKEND_BRUTE_FORCE;
+    } else {
+        return false;
+    }
+    return true;
 }
\ No newline at end of file
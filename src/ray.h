@@ -10,16 +10,39 @@ typedef struct {
     Vector vector;
 } Ray;
 
+// a ray prepared for the watertight triangle test (Woop, Benthin and Wald 2013)
+typedef struct {
+    Point origin;
+    int kx, ky, kz;  // kz is the axis the direction is largest along; kx and ky keep the winding
+    double shearX, shearY, shearZ;
+} TriangleRay;
+
 typedef struct {
     double distance;
     Point intersection;
     Vector normal;
     int materialId;
+    int primitive; // triangle index, or numTriangles + sphere index
 } HitRecord;
 
-bool getTriangleHit (Triangle triangle, Ray ray, double minDist, double maxDist, HitRecord * record);
+TriangleRay createTriangleRay (Ray ray);
+bool intersectTriangle (const Scene * scene, const Triangle * triangle, const TriangleRay * ray, double minDist, double maxDist, double * distance);
+bool intersectSphere (const Sphere * sphere, Ray ray, double minDist, double maxDist, double * distance);
+bool getTriangleHit (const Scene * scene, const Triangle * triangle, Ray ray, double minDist, double maxDist, HitRecord * record);
 bool getSphereHit (Sphere sphere, Ray ray, double minDist, double maxDist, HitRecord * record);
 bool getSceneHitBVH (Scene * scene, Ray ray, HitRecord * record);
+int countBVHNodeVisits (Scene * scene, Ray ray);
+bool getSceneHitWideBVH (Scene * scene, Ray ray, HitRecord * record);
+bool getSceneHitBruteForce (Scene * scene, Ray ray, HitRecord * record);
 bool getSceneHit (Scene * scene, Ray ray, HitRecord * record);
+void getScenePacketHits (Scene * scene, const Ray * rays, int numRays, HitRecord * records, bool * hits);
+
+bool getSceneOcclusionBVH (Scene * scene, Ray ray, double maxDist);
+bool getSceneOcclusionWideBVH (Scene * scene, Ray ray, double maxDist);
+bool getSceneOcclusionBruteForce (Scene * scene, Ray ray, double maxDist);
+bool getSceneOcclusion (Scene * scene, Ray ray, double maxDist);
+
+const char * getBackendName (IntersectionBackend backend);
+bool parseBackendName (const char * name, IntersectionBackend * backend);
 
 #endif
@@ -0,0 +1,346 @@
+#include "rayPacket.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RAY_PACKET_X86
+#include <immintrin.h>
+#endif
+
+/* ray packets
+ * the kernels below repeat the scalar watertight triangle test operation for operation (same order, no
+ * fused multiply add), so a packet finds bit-identical distances to tracing its rays one at a time.
+ * each lane permutes the vertex axes its own way, which the kernels do with per lane select masks.
+ * AVX2 covers four rays per instruction and SSE2 two. the box test uses a finite stand-in for 1/0
+ * instead of relying on NaN comparisons, which SIMD min and max do not order the way the scalar test does. */
+
+void initRayPacket (RayPacket * packet, const Ray * rays, int numRays, double minDist, double maxDist) {
+    packet->numRays = numRays;
+    packet->minDist = minDist;
+    packet->activeMask = (1 << numRays) - 1;
+
+    for (int i = 0; i < RAY_PACKET_SIZE; ++ i) {
+        //unused lanes repeat the first ray so the SIMD loads stay well defined; the mask keeps them out
+        Ray ray = rays[i < numRays ? i : 0];
+        double direction[3] = {ray.vector.x, ray.vector.y, ray.vector.z};
+        double inverse[3];
+        for (int axis = 0; axis < 3; ++ axis) {
+            inverse[axis] = (fabs (direction[axis]) > 1e-300) ? 1.0 / direction[axis] : copysign (1e300, direction[axis]);
+        }
+
+        packet->rays[i] = ray;
+        packet->originX[i] = ray.origin.x;
+        packet->originY[i] = ray.origin.y;
+        packet->originZ[i] = ray.origin.z;
+        packet->directionX[i] = direction[0];
+        packet->directionY[i] = direction[1];
+        packet->directionZ[i] = direction[2];
+        packet->inverseX[i] = inverse[0];
+        packet->inverseY[i] = inverse[1];
+        packet->inverseZ[i] = inverse[2];
+        packet->closest[i] = maxDist;
+        packet->primitive[i] = -1;
+
+        TriangleRay prepared = createTriangleRay (ray);
+        int axes[3] = {prepared.kx, prepared.ky, prepared.kz};
+        packet->triangleRays[i] = prepared;
+        packet->shearX[i] = prepared.shearX;
+        packet->shearY[i] = prepared.shearY;
+        packet->shearZ[i] = prepared.shearZ;
+        for (int k = 0; k < 3; ++ k) {
+            packet->axisIsX[k][i] = (axes[k] == 0) ? ~0ULL : 0;
+            packet->axisIsY[k][i] = (axes[k] == 1) ? ~0ULL : 0;
+        }
+    }
+}
+
+static int testPacketNodeScalar (const BVHNode * node, const RayPacket * packet, int mask) {
+    int hitMask = 0;
+    while (mask) {
+        int lane = __builtin_ctz (mask);
+        mask &= mask - 1;
+
+        double t0 = (node->min[0] - packet->originX[lane]) * packet->inverseX[lane];
+        double t1 = (node->max[0] - packet->originX[lane]) * packet->inverseX[lane];
+        double close = fmin (t0, t1), far = fmax (t0, t1);
+
+        t0 = (node->min[1] - packet->originY[lane]) * packet->inverseY[lane];
+        t1 = (node->max[1] - packet->originY[lane]) * packet->inverseY[lane];
+        close = fmax (close, fmin (t0, t1));
+        far = fmin (far, fmax (t0, t1));
+
+        t0 = (node->min[2] - packet->originZ[lane]) * packet->inverseZ[lane];
+        t1 = (node->max[2] - packet->originZ[lane]) * packet->inverseZ[lane];
+        close = fmax (close, fmin (t0, t1));
+        far = fmin (far, fmax (t0, t1));
+
+        if (close <= far && far >= RAY_EPSILON && close <= packet->closest[lane]) hitMask |= 1 << lane;
+    }
+    return hitMask;
+}
+
+static void intersectPacketTriangleScalar (RayPacket * packet, const Scene * scene, const Triangle * triangle, int primitive, int mask) {
+    while (mask) {
+        int lane = __builtin_ctz (mask);
+        mask &= mask - 1;
+
+        double distance;
+        if (intersectTriangle (scene, triangle, &packet->triangleRays[lane], packet->minDist, packet->closest[lane], &distance)) {
+            packet->closest[lane] = distance;
+            packet->primitive[lane] = primitive;
+        }
+    }
+}
+
+#ifdef RAY_PACKET_X86
+__attribute__((target("sse2")))
+static int testPacketNodeSSE (const BVHNode * node, const RayPacket * packet, int mask) {
+    __m128d minX = _mm_set1_pd (node->min[0]), maxX = _mm_set1_pd (node->max[0]);
+    __m128d minY = _mm_set1_pd (node->min[1]), maxY = _mm_set1_pd (node->max[1]);
+    __m128d minZ = _mm_set1_pd (node->min[2]), maxZ = _mm_set1_pd (node->max[2]);
+    __m128d epsilon = _mm_set1_pd (RAY_EPSILON);
+
+    int hitMask = 0;
+    for (int lane = 0; lane < packet->numRays; lane += 2) {
+        if (!((mask >> lane) & 0x3)) continue;
+
+        __m128d origin = _mm_loadu_pd (packet->originX + lane);
+        __m128d inverse = _mm_loadu_pd (packet->inverseX + lane);
+        __m128d t0 = _mm_mul_pd (_mm_sub_pd (minX, origin), inverse);
+        __m128d t1 = _mm_mul_pd (_mm_sub_pd (maxX, origin), inverse);
+        __m128d close = _mm_min_pd (t0, t1), far = _mm_max_pd (t0, t1);
+
+        origin = _mm_loadu_pd (packet->originY + lane);
+        inverse = _mm_loadu_pd (packet->inverseY + lane);
+        t0 = _mm_mul_pd (_mm_sub_pd (minY, origin), inverse);
+        t1 = _mm_mul_pd (_mm_sub_pd (maxY, origin), inverse);
+        close = _mm_max_pd (close, _mm_min_pd (t0, t1));
+        far = _mm_min_pd (far, _mm_max_pd (t0, t1));
+
+        origin = _mm_loadu_pd (packet->originZ + lane);
+        inverse = _mm_loadu_pd (packet->inverseZ + lane);
+        t0 = _mm_mul_pd (_mm_sub_pd (minZ, origin), inverse);
+        t1 = _mm_mul_pd (_mm_sub_pd (maxZ, origin), inverse);
+        close = _mm_max_pd (close, _mm_min_pd (t0, t1));
+        far = _mm_min_pd (far, _mm_max_pd (t0, t1));
+
+        __m128d hit = _mm_and_pd (_mm_cmple_pd (close, far), _mm_cmpge_pd (far, epsilon));
+        hit = _mm_and_pd (hit, _mm_cmple_pd (close, _mm_loadu_pd (packet->closest + lane)));
+        hitMask |= _mm_movemask_pd (hit) << lane;
+    }
+    return hitMask & mask;
+}
+
+__attribute__((target("sse2")))
+static inline __m128d selectAxisSSE (const RayPacket * packet, int axis, int lane, __m128d x, __m128d y, __m128d z) {
+    __m128d isX = _mm_castsi128_pd (_mm_loadu_si128 ((const __m128i *) (packet->axisIsX[axis] + lane)));
+    __m128d isY = _mm_castsi128_pd (_mm_loadu_si128 ((const __m128i *) (packet->axisIsY[axis] + lane)));
+    __m128d yOrZ = _mm_or_pd (_mm_and_pd (isY, y), _mm_andnot_pd (isY, z));
+    return _mm_or_pd (_mm_and_pd (isX, x), _mm_andnot_pd (isX, yOrZ));
+}
+
+__attribute__((target("sse2")))
+static void intersectPacketTriangleSSE (RayPacket * packet, const Scene * scene, const Triangle * triangle, int primitive, int mask) {
+    const Vertex * v1 = &scene->vertices[triangle->vertices[0]];
+    const Vertex * v2 = &scene->vertices[triangle->vertices[1]];
+    const Vertex * v3 = &scene->vertices[triangle->vertices[2]];
+    __m128d p1x = _mm_set1_pd (v1->x), p1y = _mm_set1_pd (v1->y), p1z = _mm_set1_pd (v1->z);
+    __m128d p2x = _mm_set1_pd (v2->x), p2y = _mm_set1_pd (v2->y), p2z = _mm_set1_pd (v2->z);
+    __m128d p3x = _mm_set1_pd (v3->x), p3y = _mm_set1_pd (v3->y), p3z = _mm_set1_pd (v3->z);
+    __m128d zero = _mm_setzero_pd ();
+    __m128d minDist = _mm_set1_pd (packet->minDist);
+
+    for (int lane = 0; lane < packet->numRays; lane += 2) {
+        int groupMask = (mask >> lane) & 0x3;
+        if (!groupMask) continue;
+
+        __m128d ox = _mm_loadu_pd (packet->originX + lane);
+        __m128d oy = _mm_loadu_pd (packet->originY + lane);
+        __m128d oz = _mm_loadu_pd (packet->originZ + lane);
+        __m128d ax0 = _mm_sub_pd (p1x, ox), ay0 = _mm_sub_pd (p1y, oy), az0 = _mm_sub_pd (p1z, oz);
+        __m128d bx0 = _mm_sub_pd (p2x, ox), by0 = _mm_sub_pd (p2y, oy), bz0 = _mm_sub_pd (p2z, oz);
+        __m128d cx0 = _mm_sub_pd (p3x, ox), cy0 = _mm_sub_pd (p3y, oy), cz0 = _mm_sub_pd (p3z, oz);
+
+        __m128d aKx = selectAxisSSE (packet, 0, lane, ax0, ay0, az0);
+        __m128d aKy = selectAxisSSE (packet, 1, lane, ax0, ay0, az0);
+        __m128d aKz = selectAxisSSE (packet, 2, lane, ax0, ay0, az0);
+        __m128d bKx = selectAxisSSE (packet, 0, lane, bx0, by0, bz0);
+        __m128d bKy = selectAxisSSE (packet, 1, lane, bx0, by0, bz0);
+        __m128d bKz = selectAxisSSE (packet, 2, lane, bx0, by0, bz0);
+        __m128d cKx = selectAxisSSE (packet, 0, lane, cx0, cy0, cz0);
+        __m128d cKy = selectAxisSSE (packet, 1, lane, cx0, cy0, cz0);
+        __m128d cKz = selectAxisSSE (packet, 2, lane, cx0, cy0, cz0);
+
+        __m128d shearX = _mm_loadu_pd (packet->shearX + lane);
+        __m128d shearY = _mm_loadu_pd (packet->shearY + lane);
+        __m128d shearZ = _mm_loadu_pd (packet->shearZ + lane);
+        __m128d ax = _mm_sub_pd (aKx, _mm_mul_pd (shearX, aKz)), ay = _mm_sub_pd (aKy, _mm_mul_pd (shearY, aKz));
+        __m128d bx = _mm_sub_pd (bKx, _mm_mul_pd (shearX, bKz)), by = _mm_sub_pd (bKy, _mm_mul_pd (shearY, bKz));
+        __m128d cx = _mm_sub_pd (cKx, _mm_mul_pd (shearX, cKz)), cy = _mm_sub_pd (cKy, _mm_mul_pd (shearY, cKz));
+
+        __m128d u = _mm_sub_pd (_mm_mul_pd (cx, by), _mm_mul_pd (cy, bx));
+        __m128d v = _mm_sub_pd (_mm_mul_pd (ax, cy), _mm_mul_pd (ay, cx));
+        __m128d w = _mm_sub_pd (_mm_mul_pd (bx, ay), _mm_mul_pd (by, ax));
+
+        __m128d negative = _mm_or_pd (_mm_or_pd (_mm_cmplt_pd (u, zero), _mm_cmplt_pd (v, zero)), _mm_cmplt_pd (w, zero));
+        __m128d positive = _mm_or_pd (_mm_or_pd (_mm_cmpgt_pd (u, zero), _mm_cmpgt_pd (v, zero)), _mm_cmpgt_pd (w, zero));
+        __m128d det = _mm_add_pd (_mm_add_pd (u, v), w);
+        __m128d reject = _mm_or_pd (_mm_and_pd (negative, positive), _mm_cmpeq_pd (det, zero));
+
+        __m128d t = _mm_add_pd (_mm_add_pd (_mm_mul_pd (u, _mm_mul_pd (shearZ, aKz)), _mm_mul_pd (v, _mm_mul_pd (shearZ, bKz))),
+                                _mm_mul_pd (w, _mm_mul_pd (shearZ, cKz)));
+        __m128d distance = _mm_div_pd (t, det);
+        __m128d inRange = _mm_and_pd (_mm_cmpge_pd (distance, minDist), _mm_cmple_pd (distance, _mm_loadu_pd (packet->closest + lane)));
+
+        int hits = _mm_movemask_pd (_mm_andnot_pd (reject, inRange)) & groupMask;
+        if (!hits) continue;
+
+        double distances[2];
+        _mm_storeu_pd (distances, distance);
+        for (int i = 0; i < 2; ++ i) {
+            if (hits & (1 << i)) {
+                packet->closest[lane + i] = distances[i];
+                packet->primitive[lane + i] = primitive;
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static int testPacketNodeAVX2 (const BVHNode * node, const RayPacket * packet, int mask) {
+    __m256d minX = _mm256_set1_pd (node->min[0]), maxX = _mm256_set1_pd (node->max[0]);
+    __m256d minY = _mm256_set1_pd (node->min[1]), maxY = _mm256_set1_pd (node->max[1]);
+    __m256d minZ = _mm256_set1_pd (node->min[2]), maxZ = _mm256_set1_pd (node->max[2]);
+    __m256d epsilon = _mm256_set1_pd (RAY_EPSILON);
+
+    int hitMask = 0;
+    for (int lane = 0; lane < packet->numRays; lane += 4) {
+        if (!((mask >> lane) & 0xF)) continue;
+
+        __m256d origin = _mm256_loadu_pd (packet->originX + lane);
+        __m256d inverse = _mm256_loadu_pd (packet->inverseX + lane);
+        __m256d t0 = _mm256_mul_pd (_mm256_sub_pd (minX, origin), inverse);
+        __m256d t1 = _mm256_mul_pd (_mm256_sub_pd (maxX, origin), inverse);
+        __m256d close = _mm256_min_pd (t0, t1), far = _mm256_max_pd (t0, t1);
+
+        origin = _mm256_loadu_pd (packet->originY + lane);
+        inverse = _mm256_loadu_pd (packet->inverseY + lane);
+        t0 = _mm256_mul_pd (_mm256_sub_pd (minY, origin), inverse);
+        t1 = _mm256_mul_pd (_mm256_sub_pd (maxY, origin), inverse);
+        close = _mm256_max_pd (close, _mm256_min_pd (t0, t1));
+        far = _mm256_min_pd (far, _mm256_max_pd (t0, t1));
+
+        origin = _mm256_loadu_pd (packet->originZ + lane);
+        inverse = _mm256_loadu_pd (packet->inverseZ + lane);
+        t0 = _mm256_mul_pd (_mm256_sub_pd (minZ, origin), inverse);
+        t1 = _mm256_mul_pd (_mm256_sub_pd (maxZ, origin), inverse);
+        close = _mm256_max_pd (close, _mm256_min_pd (t0, t1));
+        far = _mm256_min_pd (far, _mm256_max_pd (t0, t1));
+
+        __m256d hit = _mm256_and_pd (_mm256_cmp_pd (close, far, _CMP_LE_OQ), _mm256_cmp_pd (far, epsilon, _CMP_GE_OQ));
+        hit = _mm256_and_pd (hit, _mm256_cmp_pd (close, _mm256_loadu_pd (packet->closest + lane), _CMP_LE_OQ));
+        hitMask |= _mm256_movemask_pd (hit) << lane;
+    }
+    return hitMask & mask;
+}
+
+__attribute__((target("avx2")))
+static inline __m256d selectAxisAVX2 (const RayPacket * packet, int axis, int lane, __m256d x, __m256d y, __m256d z) {
+    __m256d isX = _mm256_castsi256_pd (_mm256_loadu_si256 ((const __m256i *) (packet->axisIsX[axis] + lane)));
+    __m256d isY = _mm256_castsi256_pd (_mm256_loadu_si256 ((const __m256i *) (packet->axisIsY[axis] + lane)));
+    return _mm256_blendv_pd (_mm256_blendv_pd (z, y, isY), x, isX);
+}
+
+__attribute__((target("avx2")))
+static void intersectPacketTriangleAVX2 (RayPacket * packet, const Scene * scene, const Triangle * triangle, int primitive, int mask) {
+    const Vertex * v1 = &scene->vertices[triangle->vertices[0]];
+    const Vertex * v2 = &scene->vertices[triangle->vertices[1]];
+    const Vertex * v3 = &scene->vertices[triangle->vertices[2]];
+    __m256d p1x = _mm256_set1_pd (v1->x), p1y = _mm256_set1_pd (v1->y), p1z = _mm256_set1_pd (v1->z);
+    __m256d p2x = _mm256_set1_pd (v2->x), p2y = _mm256_set1_pd (v2->y), p2z = _mm256_set1_pd (v2->z);
+    __m256d p3x = _mm256_set1_pd (v3->x), p3y = _mm256_set1_pd (v3->y), p3z = _mm256_set1_pd (v3->z);
+    __m256d zero = _mm256_setzero_pd ();
+    __m256d minDist = _mm256_set1_pd (packet->minDist);
+
+    for (int lane = 0; lane < packet->numRays; lane += 4) {
+        int groupMask = (mask >> lane) & 0xF;
+        if (!groupMask) continue;
+
+        __m256d ox = _mm256_loadu_pd (packet->originX + lane);
+        __m256d oy = _mm256_loadu_pd (packet->originY + lane);
+        __m256d oz = _mm256_loadu_pd (packet->originZ + lane);
+        __m256d ax0 = _mm256_sub_pd (p1x, ox), ay0 = _mm256_sub_pd (p1y, oy), az0 = _mm256_sub_pd (p1z, oz);
+        __m256d bx0 = _mm256_sub_pd (p2x, ox), by0 = _mm256_sub_pd (p2y, oy), bz0 = _mm256_sub_pd (p2z, oz);
+        __m256d cx0 = _mm256_sub_pd (p3x, ox), cy0 = _mm256_sub_pd (p3y, oy), cz0 = _mm256_sub_pd (p3z, oz);
+
+        __m256d aKx = selectAxisAVX2 (packet, 0, lane, ax0, ay0, az0);
+        __m256d aKy = selectAxisAVX2 (packet, 1, lane, ax0, ay0, az0);
+        __m256d aKz = selectAxisAVX2 (packet, 2, lane, ax0, ay0, az0);
+        __m256d bKx = selectAxisAVX2 (packet, 0, lane, bx0, by0, bz0);
+        __m256d bKy = selectAxisAVX2 (packet, 1, lane, bx0, by0, bz0);
+        __m256d bKz = selectAxisAVX2 (packet, 2, lane, bx0, by0, bz0);
+        __m256d cKx = selectAxisAVX2 (packet, 0, lane, cx0, cy0, cz0);
+        __m256d cKy = selectAxisAVX2 (packet, 1, lane, cx0, cy0, cz0);
+        __m256d cKz = selectAxisAVX2 (packet, 2, lane, cx0, cy0, cz0);
+
+        __m256d shearX = _mm256_loadu_pd (packet->shearX + lane);
+        __m256d shearY = _mm256_loadu_pd (packet->shearY + lane);
+        __m256d shearZ = _mm256_loadu_pd (packet->shearZ + lane);
+        __m256d ax = _mm256_sub_pd (aKx, _mm256_mul_pd (shearX, aKz)), ay = _mm256_sub_pd (aKy, _mm256_mul_pd (shearY, aKz));
+        __m256d bx = _mm256_sub_pd (bKx, _mm256_mul_pd (shearX, bKz)), by = _mm256_sub_pd (bKy, _mm256_mul_pd (shearY, bKz));
+        __m256d cx = _mm256_sub_pd (cKx, _mm256_mul_pd (shearX, cKz)), cy = _mm256_sub_pd (cKy, _mm256_mul_pd (shearY, cKz));
+
+        __m256d u = _mm256_sub_pd (_mm256_mul_pd (cx, by), _mm256_mul_pd (cy, bx));
+        __m256d v = _mm256_sub_pd (_mm256_mul_pd (ax, cy), _mm256_mul_pd (ay, cx));
+        __m256d w = _mm256_sub_pd (_mm256_mul_pd (bx, ay), _mm256_mul_pd (by, ax));
+
+        __m256d negative = _mm256_or_pd (_mm256_or_pd (_mm256_cmp_pd (u, zero, _CMP_LT_OQ), _mm256_cmp_pd (v, zero, _CMP_LT_OQ)),
+                                         _mm256_cmp_pd (w, zero, _CMP_LT_OQ));
+        __m256d positive = _mm256_or_pd (_mm256_or_pd (_mm256_cmp_pd (u, zero, _CMP_GT_OQ), _mm256_cmp_pd (v, zero, _CMP_GT_OQ)),
+                                         _mm256_cmp_pd (w, zero, _CMP_GT_OQ));
+        __m256d det = _mm256_add_pd (_mm256_add_pd (u, v), w);
+        __m256d reject = _mm256_or_pd (_mm256_and_pd (negative, positive), _mm256_cmp_pd (det, zero, _CMP_EQ_OQ));
+
+        __m256d t = _mm256_add_pd (_mm256_add_pd (_mm256_mul_pd (u, _mm256_mul_pd (shearZ, aKz)), _mm256_mul_pd (v, _mm256_mul_pd (shearZ, bKz))),
+                                   _mm256_mul_pd (w, _mm256_mul_pd (shearZ, cKz)));
+        __m256d distance = _mm256_div_pd (t, det);
+        __m256d inRange = _mm256_and_pd (_mm256_cmp_pd (distance, minDist, _CMP_GE_OQ),
+                                         _mm256_cmp_pd (distance, _mm256_loadu_pd (packet->closest + lane), _CMP_LE_OQ));
+
+        int hits = _mm256_movemask_pd (_mm256_andnot_pd (reject, inRange)) & groupMask;
+        if (!hits) continue;
+
+        double distances[4];
+        _mm256_storeu_pd (distances, distance);
+        for (int i = 0; i < 4; ++ i) {
+            if (hits & (1 << i)) {
+                packet->closest[lane + i] = distances[i];
+                packet->primitive[lane + i] = primitive;
+            }
+        }
+    }
+}
+#endif
+
+int testPacketNode (const BVHNode * node, const RayPacket * packet, int mask, SimdLevel level) {
+#ifdef RAY_PACKET_X86
+    if (level == SIMD_AVX2) return testPacketNodeAVX2 (node, packet, mask);
+    if (level == SIMD_SSE) return testPacketNodeSSE (node, packet, mask);
+#endif
+    (void) level;
+    return testPacketNodeScalar (node, packet, mask);
+}
+
+void intersectPacketTriangle (RayPacket * packet, const Scene * scene, const Triangle * triangle, int primitive, int mask, SimdLevel level) {
+#ifdef RAY_PACKET_X86
+    if (level == SIMD_AVX2) {
+        intersectPacketTriangleAVX2 (packet, scene, triangle, primitive, mask);
+        return;
+    }
+    if (level == SIMD_SSE) {
+        intersectPacketTriangleSSE (packet, scene, triangle, primitive, mask);
+        return;
+    }
+#endif
+    (void) level;
+    intersectPacketTriangleScalar (packet, scene, triangle, primitive, mask);
+}
\ No newline at end of file
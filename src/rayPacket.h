@@ -0,0 +1,40 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <stdint.h>
+#include "ray.h"
+#include "wideBvh.h"
+
+#define RAY_PACKET_SIZE 16
+
+// up to 16 rays stored as structure of arrays so one instruction works on several of them
+typedef struct {
+    double originX[RAY_PACKET_SIZE];
+    double originY[RAY_PACKET_SIZE];
+    double originZ[RAY_PACKET_SIZE];
+    double directionX[RAY_PACKET_SIZE];
+    double directionY[RAY_PACKET_SIZE];
+    double directionZ[RAY_PACKET_SIZE];
+    double inverseX[RAY_PACKET_SIZE];
+    double inverseY[RAY_PACKET_SIZE];
+    double inverseZ[RAY_PACKET_SIZE];
+    //watertight triangle setup: shears, and all ones masks for which axis kx, ky and kz pick
+    double shearX[RAY_PACKET_SIZE];
+    double shearY[RAY_PACKET_SIZE];
+    double shearZ[RAY_PACKET_SIZE];
+    uint64_t axisIsX[3][RAY_PACKET_SIZE];
+    uint64_t axisIsY[3][RAY_PACKET_SIZE];
+    TriangleRay triangleRays[RAY_PACKET_SIZE];
+    double closest[RAY_PACKET_SIZE];
+    int primitive[RAY_PACKET_SIZE]; // closest primitive so far, -1 while a ray has no hit
+    Ray rays[RAY_PACKET_SIZE];
+    double minDist;
+    int numRays;
+    int activeMask;
+} RayPacket;
+
+void initRayPacket (RayPacket * packet, const Ray * rays, int numRays, double minDist, double maxDist);
+int testPacketNode (const BVHNode * node, const RayPacket * packet, int mask, SimdLevel level);
+void intersectPacketTriangle (RayPacket * packet, const Scene * scene, const Triangle * triangle, int primitive, int mask, SimdLevel level);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,570 @@
+#include "renderer.h"
+#include "pathTracer.h"
+#include "threadPool.h"
+#include "mlt.h"
+#include "wavefront.h"
+#include "timer.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* adaptive sampling
+ * every pixel keeps a running mean and variance (Welford) of the luminance of its own samples.
+ * after each pass of one sample per active pixel a tile re-tests its pixels: one whose standard
+ * error relative to its mean is under the threshold stops, the rest carry on until they reach
+ * maxSamples or the total budget of samplesPerPixel * pixels is spent. */
+
+typedef struct {
+    double threshold;
+    int minSamples;
+    int maxSamples;
+    long long budget;
+
+    double * mean;
+    double * m2;
+    uint32_t * counts;
+    unsigned char * active;
+
+    //written by the tile's own task, summed between passes
+    int * tileActive;
+    long long * tileSamples;
+} AdaptiveState;
+
+typedef struct {
+    Scene * scene;
+    Camera * cam;
+    const RenderSettings * settings;
+    Film * film;
+
+    Seed * tileSeeds; // advanced by each pass, so the next pass continues the tile's stream
+    int * tileList;   // tiles of the current phase
+    int tilesX;
+    int numTiles;
+    int samplesPerPass;
+    bool reportProgress;
+    AdaptiveState * adaptive; // NULL when every pixel gets samplesPerPass
+    _Atomic bool * cancelled;
+    _Atomic int tilesDone;
+    pthread_mutex_t progressLock; // orders the progress lines, so a late thread never prints an older count
+    int stepsPrinted;
+} TileJob;
+
+struct _ProgressiveRender {
+    RenderSettings settings;
+    TileJob job;
+    double exposure;
+
+    //the controller tone maps into the back frame, then swaps it to the front under the lock
+    PixelMap * frames[2];
+    int front;
+    bool frameReady;
+    int framePasses;
+    pthread_mutex_t lock;
+
+    pthread_t thread;
+    _Atomic bool cancelled;
+    _Atomic bool finished;
+    _Atomic int passesDone;
+};
+
+RenderSettings defaultRenderSettings (int width, int height) {
+    RenderSettings settings;
+    settings.integrator = INTEGRATOR_PATH;
+    settings.engine = ENGINE_TILES;
+    settings.width = width;
+    settings.height = height;
+    settings.samplesPerPixel = TOTAL_SAMPLES;
+    settings.numThreads = getProcessorCount();
+    settings.tileSize = DEFAULT_TILE_SIZE;
+    settings.seed = DEFAULT_SEED;
+    settings.primaryPackets = true;
+    settings.filter = getPixelFilter (FILTER_BOX);
+    settings.path = defaultPathSettings ();
+    settings.wavefrontSize = 0;
+    settings.adaptiveThreshold = 0;
+    settings.minSamples = 0;
+    settings.maxSamples = 0;
+    settings.bootstrapSamples = MLT_BOOTSTRAP_SAMPLES;
+    settings.numChains = MLT_DEFAULT_CHAINS;
+    settings.largeStepProbability = MLT_LARGE_STEP_PROBABILITY;
+    return settings;
+}
+
+// sample variance of the pixel's luminance, over the brightness it is judged against squared
+static double getRelativeVariance (const AdaptiveState * adaptive, size_t pixel) {
+    double reference = fmax (adaptive->mean[pixel], ADAPTIVE_LUMINANCE_FLOOR);
+    return adaptive->m2[pixel] / (adaptive->counts[pixel] - 1) / (reference * reference);
+}
+
+// standard error of the pixel's mean relative to its brightness; pixels short of minSamples come first
+static double getRelativeError (const AdaptiveState * adaptive, size_t pixel) {
+    uint32_t count = adaptive->counts[pixel];
+    if (count < (uint32_t) adaptive->minSamples) return INFINITY;
+    return sqrt (getRelativeVariance (adaptive, pixel) / count);
+}
+
+static bool isPixelActive (const AdaptiveState * adaptive, size_t pixel) {
+    uint32_t count = adaptive->counts[pixel];
+    if (count < (uint32_t) adaptive->minSamples) return true;
+    if (count >= (uint32_t) adaptive->maxSamples) return false;
+    return getRelativeError (adaptive, pixel) > adaptive->threshold;
+}
+
+static void addPixelSample (AdaptiveState * adaptive, size_t pixel, double value) {
+    uint32_t count = ++ adaptive->counts[pixel];
+    double delta = value - adaptive->mean[pixel];
+    adaptive->mean[pixel] += delta / count;
+    adaptive->m2[pixel] += delta * (value - adaptive->mean[pixel]);
+}
+
+static void renderTile (void * context, int itemIndex, int threadIndex) {
+    TileJob * job = (TileJob *) context;
+    int tileIndex = job->tileList[itemIndex];
+    const RenderSettings * settings = job->settings;
+    AdaptiveState * adaptive = job->adaptive;
+    if (job->cancelled && atomic_load_explicit (job->cancelled, memory_order_relaxed)) return;
+
+    //each tile owns its random stream, so the image does not depend on which thread renders it
+    Sampler sampler = createIndependentSampler (job->tileSeeds[tileIndex]);
+
+    int startX = (tileIndex % job->tilesX) * settings->tileSize;
+    int startY = (tileIndex / job->tilesX) * settings->tileSize;
+    int endX = startX + settings->tileSize < settings->width ? startX + settings->tileSize : settings->width;
+    int endY = startY + settings->tileSize < settings->height ? startY + settings->tileSize : settings->height;
+
+    //camera rays leave in 4x4 pixel packets, one sample of every pixel in the block at a time
+    for (int blockY = startY; blockY < endY; blockY += PACKET_BLOCK_SIZE) {
+        for (int blockX = startX; blockX < endX; blockX += PACKET_BLOCK_SIZE) {
+            int blockEndX = blockX + PACKET_BLOCK_SIZE < endX ? blockX + PACKET_BLOCK_SIZE : endX;
+            int blockEndY = blockY + PACKET_BLOCK_SIZE < endY ? blockY + PACKET_BLOCK_SIZE : endY;
+
+            for (int samples = 0; samples < job->samplesPerPass; ++ samples) {
+                Ray cameraRays [PACKET_BLOCK_SIZE * PACKET_BLOCK_SIZE];
+                HitRecord primaryHits [PACKET_BLOCK_SIZE * PACKET_BLOCK_SIZE];
+                bool didHit [PACKET_BLOCK_SIZE * PACKET_BLOCK_SIZE];
+                double filmX [PACKET_BLOCK_SIZE * PACKET_BLOCK_SIZE];
+                double filmY [PACKET_BLOCK_SIZE * PACKET_BLOCK_SIZE];
+                size_t pixels [PACKET_BLOCK_SIZE * PACKET_BLOCK_SIZE];
+                int numRays = 0;
+
+                for (int y = blockY; y < blockEndY; ++ y) {
+                    for (int x = blockX; x < blockEndX; ++ x) {
+                        size_t pixel = (size_t)y * settings->width + x;
+                        if (adaptive && !adaptive->active[pixel]) continue;
+
+                        double jitterX = (double)x + (nextSample(&sampler) - 0.5);
+                        double jitterY = (double)y + (nextSample(&sampler) - 0.5);
+                        //getCameraRay aims at px + 0.5, which is where the sample sits on the film
+                        filmX[numRays] = jitterX + 0.5;
+                        filmY[numRays] = jitterY + 0.5;
+                        pixels[numRays] = pixel;
+                        cameraRays[numRays ++] = getCameraRay(job->cam, jitterX, jitterY);
+                    }
+                }
+                if (numRays == 0) continue;
+
+                if (settings->primaryPackets) {
+                    getScenePacketHits (job->scene, cameraRays, numRays, primaryHits, didHit);
+                } else {
+                    for (int i = 0; i < numRays; ++ i) {
+                        didHit[i] = getSceneHit (job->scene, cameraRays[i], &primaryHits[i]);
+                    }
+                }
+
+                for (int i = 0; i < numRays; ++ i) {
+                    Vector tempColor = {0, 0, 0};
+                    if (didHit[i]) tempColor = traceRadianceFromHit(&cameraRays[i], &primaryHits[i], &settings->path, job->scene, &sampler);
+                    splatFilmSample (job->film, filmX[i], filmY[i], tempColor, 1.0);
+                    if (adaptive) addPixelSample (adaptive, pixels[i], luminance (tempColor));
+                }
+            }
+        }
+    }
+
+    job->tileSeeds[tileIndex] = sampler.seed;
+
+    if (adaptive) {
+        int active = 0;
+        long long samples = 0;
+        for (int y = startY; y < endY; ++ y) {
+            for (int x = startX; x < endX; ++ x) {
+                size_t pixel = (size_t)y * settings->width + x;
+                adaptive->active[pixel] = isPixelActive (adaptive, pixel);
+                active += adaptive->active[pixel];
+                samples += adaptive->counts[pixel];
+            }
+        }
+        adaptive->tileActive[tileIndex] = active;
+        adaptive->tileSamples[tileIndex] = samples;
+    }
+
+    if (!job->reportProgress) return;
+    int done = atomic_fetch_add (&job->tilesDone, 1) + 1;
+    int step = job->numTiles / 100 > 0 ? job->numTiles / 100 : 1;
+    if (done % step != 0 && done != job->numTiles) return;
+    int steps = done / step + (done == job->numTiles);
+    pthread_mutex_lock (&job->progressLock);
+    if (steps > job->stepsPrinted) {
+        job->stepsPrinted = steps;
+        fprintf(stderr, "\033[1A\033[2K%.3f percent of the way there\n", ((double)done)/job->numTiles * 100);
+    }
+    pthread_mutex_unlock (&job->progressLock);
+}
+
+static void initAdaptiveState (TileJob * job) {
+    const RenderSettings * settings = job->settings;
+    size_t numPixels = (size_t)settings->width * settings->height;
+
+    AdaptiveState * adaptive = malloc (sizeof(AdaptiveState));
+    adaptive->threshold = settings->adaptiveThreshold;
+    adaptive->budget = (long long)numPixels * settings->samplesPerPixel;
+
+    //two samples at least, or there is no variance to test
+    int minSamples = settings->minSamples > 0 ? settings->minSamples : ADAPTIVE_MIN_SAMPLES;
+    if (settings->minSamples <= 0 && minSamples > settings->samplesPerPixel) minSamples = settings->samplesPerPixel;
+    adaptive->minSamples = minSamples > 2 ? minSamples : 2;
+    int maxSamples = settings->maxSamples > 0 ? settings->maxSamples : settings->samplesPerPixel * ADAPTIVE_MAX_SCALE;
+    adaptive->maxSamples = maxSamples > adaptive->minSamples ? maxSamples : adaptive->minSamples;
+
+    adaptive->mean = calloc (numPixels, sizeof(double));
+    adaptive->m2 = calloc (numPixels, sizeof(double));
+    adaptive->counts = calloc (numPixels, sizeof(uint32_t));
+    adaptive->active = malloc (numPixels);
+    memset (adaptive->active, 1, numPixels);
+
+    adaptive->tileActive = malloc (job->numTiles * sizeof(int));
+    adaptive->tileSamples = calloc (job->numTiles, sizeof(long long));
+    for (int i = 0; i < job->numTiles; ++ i) {
+        adaptive->tileActive[i] = 1;
+    }
+
+    job->adaptive = adaptive;
+    job->samplesPerPass = 1;
+}
+
+static void freeAdaptiveState (AdaptiveState * adaptive) {
+    if (!adaptive) return;
+    free (adaptive->mean);
+    free (adaptive->m2);
+    free (adaptive->counts);
+    free (adaptive->active);
+    free (adaptive->tileActive);
+    free (adaptive->tileSamples);
+    free (adaptive);
+}
+
+typedef struct {
+    double error;
+    size_t pixel;
+} PixelError;
+
+// noisiest first, then in pixel order, so the pick does not depend on anything but the samples
+static int comparePixelErrors (const void * a, const void * b) {
+    const PixelError * first = a;
+    const PixelError * second = b;
+    if (first->error != second->error) return first->error > second->error ? -1 : 1;
+    return first->pixel < second->pixel ? -1 : first->pixel > second->pixel;
+}
+
+/* the pass that would overshoot the budget samples only the noisiest pixels that fit in it; the others
+ * are left out of the pass, and since the budget is spent after it they never come back */
+static void limitPassToBudget (TileJob * job, long long remaining) {
+    AdaptiveState * adaptive = job->adaptive;
+    const RenderSettings * settings = job->settings;
+    size_t numPixels = (size_t)settings->width * settings->height;
+
+    size_t numActive = 0;
+    PixelError * errors = malloc (numPixels * sizeof(PixelError));
+    if (!errors) return;
+    for (size_t i = 0; i < numPixels; ++ i) {
+        if (adaptive->active[i]) errors[numActive ++] = (PixelError){getRelativeError (adaptive, i), i};
+    }
+    qsort (errors, numActive, sizeof(PixelError), comparePixelErrors);
+
+    for (size_t i = (size_t) remaining; i < numActive; ++ i) {
+        size_t pixel = errors[i].pixel;
+        adaptive->active[pixel] = 0;
+        int x = (int)(pixel % settings->width), y = (int)(pixel / settings->width);
+        adaptive->tileActive[(y / settings->tileSize) * job->tilesX + x / settings->tileSize] --;
+    }
+    free (errors);
+}
+
+// true while some pixel is still active and the budget is not spent
+static bool prepareAdaptivePass (TileJob * job) {
+    AdaptiveState * adaptive = job->adaptive;
+    long long active = 0, samples = 0;
+    for (int i = 0; i < job->numTiles; ++ i) {
+        active += adaptive->tileActive[i];
+        samples += adaptive->tileSamples[i];
+    }
+    if (active == 0 || samples >= adaptive->budget) return false;
+    if (active > adaptive->budget - samples) limitPassToBudget (job, adaptive->budget - samples);
+    return true;
+}
+
+static void reportAdaptiveSampling (const TileJob * job) {
+    const AdaptiveState * adaptive = job->adaptive;
+    size_t numPixels = (size_t)job->settings->width * job->settings->height;
+
+    long long samples = 0, converged = 0, convergedSamples = 0;
+    uint32_t fewest = UINT32_MAX, most = 0;
+    double uniformSpp = 0;
+    for (size_t i = 0; i < numPixels; ++ i) {
+        uint32_t count = adaptive->counts[i];
+        samples += count;
+        if (count < fewest) fewest = count;
+        if (count > most) most = count;
+        //converged means the pixel stopped on the threshold, not on maxSamples or the budget
+        if (count < (uint32_t) adaptive->minSamples || count >= (uint32_t) adaptive->maxSamples) continue;
+        if (getRelativeError (adaptive, i) > adaptive->threshold) continue;
+        converged ++;
+        convergedSamples += count;
+        //samples this pixel needs for its relative standard error to reach the threshold, from its variance
+        double needed = getRelativeVariance (adaptive, i) / (adaptive->threshold * adaptive->threshold);
+        if (needed > uniformSpp) uniformSpp = needed;
+    }
+
+    fprintf (stderr, "Adaptive sampling: %lld of %lld budgeted samples, %.2f spp average (%u min, %u max), %lld of %zu pixels converged below %g\n",
+             samples, adaptive->budget, (double)samples / numPixels, fewest, most, converged, numPixels, adaptive->threshold);
+    if (converged == 0) return;
+
+    /* a uniform render gives every pixel the same count, so for all the converged pixels to reach the
+     * threshold it needs what the noisiest of them needs; pixels that stopped on maxSamples or the
+     * budget never reached it and are left out on both sides */
+    uniformSpp = fmax (ceil (uniformSpp), adaptive->minSamples);
+    double uniform = uniformSpp * converged;
+    fprintf (stderr, "Converged pixels: %lld samples adaptive, about %.0f spp (%.0f samples) uniform for the same threshold; %.1f%% saved\n",
+             convergedSamples, uniformSpp, uniform, 100.0 * (uniform - convergedSamples) / uniform);
+}
+
+static void initTileJob (TileJob * job, Scene * scene, Camera * cam, const RenderSettings * settings, Film * film) {
+    job->scene = scene;
+    job->cam = cam;
+    job->settings = settings;
+    job->film = film;
+    job->tilesX = (settings->width + settings->tileSize - 1) / settings->tileSize;
+    int tilesY = (settings->height + settings->tileSize - 1) / settings->tileSize;
+    job->numTiles = job->tilesX * tilesY;
+    job->samplesPerPass = settings->samplesPerPixel;
+    job->reportProgress = true;
+    job->adaptive = NULL;
+    job->cancelled = NULL;
+    atomic_init (&job->tilesDone, 0);
+    pthread_mutex_init (&job->progressLock, NULL);
+    job->stepsPrinted = 0;
+
+    //tile i starts i jumps (2^128 steps each) after the base seed
+    job->tileSeeds = malloc (job->numTiles * sizeof(Seed));
+    initSeed (&job->tileSeeds[0], settings->seed);
+    for (int i = 1; i < job->numTiles; ++ i) {
+        job->tileSeeds[i] = job->tileSeeds[i - 1];
+        jumpSeed (&job->tileSeeds[i]);
+    }
+    job->tileList = malloc (job->numTiles * sizeof(int));
+
+    if (settings->adaptiveThreshold > 0 && settings->integrator == INTEGRATOR_PATH) {
+        initAdaptiveState (job);
+    }
+}
+
+static void runTilePass (TileJob * job) {
+    /* a filter wider than a pixel splats into neighbouring tiles, so tiles then run in four
+     * checkerboard phases: tiles of one phase are a whole tile apart and never write the same
+     * pixel, and every pixel receives its splats in the same order whatever the thread count */
+    int numPhases = (job->settings->filter.radius > 0.5) ? 4 : 1;
+
+    for (int phase = 0; phase < numPhases; ++ phase) {
+        int numItems = 0;
+        for (int i = 0; i < job->numTiles; ++ i) {
+            int tilePhase = (numPhases == 1) ? 0 : ((i % job->tilesX) % 2) + 2 * ((i / job->tilesX) % 2);
+            if (tilePhase != phase) continue;
+            //tiles whose pixels have all converged drop out of the pass
+            if (job->adaptive && job->adaptive->tileActive[i] == 0) continue;
+            job->tileList[numItems ++] = i;
+        }
+        parallelFor (job->settings->numThreads, numItems, renderTile, job);
+    }
+}
+
+static void freeTileJob (TileJob * job) {
+    pthread_mutex_destroy (&job->progressLock);
+    freeAdaptiveState (job->adaptive);
+    free (job->tileList);
+    free (job->tileSeeds);
+}
+
+Film * renderImage (Scene * scene, Camera * cam, const RenderSettings * settings) {
+    if (settings->integrator == INTEGRATOR_MLT) {
+        return renderMLT (scene, cam, settings);
+    }
+    if (settings->engine == ENGINE_WAVEFRONT) {
+        return renderWavefront (scene, cam, settings);
+    }
+
+    Film * film = createFilm (settings->width, settings->height, settings->filter);
+
+    TileJob job;
+    initTileJob (&job, scene, cam, settings, film);
+    if (job.adaptive) {
+        //progress is reported per pass here, since the number of passes is not known up front
+        job.reportProgress = false;
+        int passes = 0;
+        while (prepareAdaptivePass (&job)) {
+            runTilePass (&job);
+            ++ passes;
+        }
+        fprintf (stderr, "Adaptive sampling finished after %d passes\n", passes);
+        reportAdaptiveSampling (&job);
+    } else {
+        runTilePass (&job);
+    }
+    freeTileJob (&job);
+
+    return film;
+}
+
+/* progressive rendering
+ * a controller thread runs one sample per pixel per pass over all tiles and publishes a tone mapped
+ * frame at most PROGRESSIVE_FRAME_RATE times a second. the viewer only ever takes the lock to copy
+ * the front frame, so neither side waits on the other for longer than that copy. */
+
+static void publishFrame (ProgressiveRender * render, int passes) {
+    int back = 1 - render->front;
+    toneMapFilm (render->job.film, render->exposure, render->frames[back]);
+
+    pthread_mutex_lock (&render->lock);
+    render->front = back;
+    render->frameReady = true;
+    render->framePasses = passes;
+    pthread_mutex_unlock (&render->lock);
+}
+
+static void * runProgressiveRender (void * context) {
+    ProgressiveRender * render = (ProgressiveRender *) context;
+    double lastPublish = -1;
+    double frameInterval = 1.0 / PROGRESSIVE_FRAME_RATE;
+
+    int published = 0;
+
+    for (int pass = 1; ; ++ pass) {
+        bool more = render->job.adaptive ? prepareAdaptivePass (&render->job) : pass <= render->settings.samplesPerPixel;
+        if (!more) break;
+
+        runTilePass (&render->job);
+        if (atomic_load (&render->cancelled)) break;
+        atomic_store (&render->passesDone, pass);
+
+        double now = getTimeSeconds ();
+        if (lastPublish < 0 || now - lastPublish >= frameInterval) {
+            publishFrame (render, pass);
+            published = pass;
+            lastPublish = now;
+        }
+    }
+
+    //the last pass always reaches the viewer
+    int passes = atomic_load (&render->passesDone);
+    if (passes != published) publishFrame (render, passes);
+    if (render->job.adaptive) reportAdaptiveSampling (&render->job);
+
+    atomic_store (&render->finished, true);
+    return NULL;
+}
+
+ProgressiveRender * startProgressiveRender (Scene * scene, Camera * cam, const RenderSettings * settings, double exposure) {
+    ProgressiveRender * render = calloc (1, sizeof(ProgressiveRender));
+    render->settings = *settings;
+    render->exposure = exposure;
+
+    Film * film = createFilm (settings->width, settings->height, settings->filter);
+    initTileJob (&render->job, scene, cam, &render->settings, film);
+    render->job.samplesPerPass = 1;
+    render->job.reportProgress = false;
+    render->job.cancelled = &render->cancelled;
+
+    render->frames[0] = createPixelMap (settings->width, settings->height);
+    render->frames[1] = createPixelMap (settings->width, settings->height);
+    memset (render->frames[0]->data, 0, render->frames[0]->size);
+    pthread_mutex_init (&render->lock, NULL);
+    atomic_init (&render->cancelled, false);
+    atomic_init (&render->finished, false);
+    atomic_init (&render->passesDone, 0);
+
+    pthread_create (&render->thread, NULL, runProgressiveRender, render);
+    return render;
+}
+
+bool copyProgressiveFrame (ProgressiveRender * render, unsigned char * destination, int * passes) {
+    pthread_mutex_lock (&render->lock);
+    bool ready = render->frameReady;
+    if (ready) {
+        PixelMap * frame = render->frames[render->front];
+        memcpy (destination, frame->data, frame->size);
+        render->frameReady = false;
+        if (passes) *passes = render->framePasses;
+    }
+    pthread_mutex_unlock (&render->lock);
+    return ready;
+}
+
+bool isProgressiveRenderFinished (ProgressiveRender * render) {
+    return atomic_load (&render->finished);
+}
+
+int getProgressivePasses (ProgressiveRender * render) {
+    return atomic_load (&render->passesDone);
+}
+
+Film * finishProgressiveRender (ProgressiveRender * render, bool cancel) {
+    if (cancel) atomic_store (&render->cancelled, true);
+    pthread_join (render->thread, NULL);
+
+    Film * film = render->job.film;
+    freeTileJob (&render->job);
+    freePixelMap (render->frames[0]);
+    freePixelMap (render->frames[1]);
+    pthread_mutex_destroy (&render->lock);
+    free (render);
+    return film;
+}
+
+const char * getIntegratorName (Integrator integrator) {
+    switch (integrator) {
+        case INTEGRATOR_PATH: return "path";
+        case INTEGRATOR_MLT: return "mlt";
+        default: return "unknown";
+    }
+}
+
+bool parseIntegratorName (const char * name, Integrator * integrator) {
+    if (strcmp (name, "path") == 0) {
+        *integrator = INTEGRATOR_PATH;
+    } else if (strcmp (name, "mlt") == 0) {
+        *integrator = INTEGRATOR_MLT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char * getEngineName (RenderEngine engine) {
+    switch (engine) {
+        case ENGINE_TILES: return "tiles";
+        case ENGINE_WAVEFRONT: return "wavefront";
+        default: return "unknown";
+    }
+}
+
+bool parseEngineName (const char * name, RenderEngine * engine) {
+    if (strcmp (name, "tiles") == 0) {
+        *engine = ENGINE_TILES;
+    } else if (strcmp (name, "wavefront") == 0) {
+        *engine = ENGINE_WAVEFRONT;
+    } else {
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stdint.h>
+#include "camera.h"
+#include "film.h"
+#include "pathTracer.h"
+
+typedef enum {
+    INTEGRATOR_PATH,
+    INTEGRATOR_MLT
+} Integrator;
+
+typedef enum {
+    ENGINE_TILES,    // each sample's path traced to its end, tile by tile
+    ENGINE_WAVEFRONT // batches of paths advanced a stage at a time, see wavefront.c
+} RenderEngine;
+
+typedef struct {
+    Integrator integrator;
+    RenderEngine engine; // path integrator only
+    int width;
+    int height;
+    int samplesPerPixel;
+    int numThreads;
+    int tileSize;
+    uint64_t seed;
+    bool primaryPackets; // trace camera rays as 4x4 pixel packets
+    PixelFilter filter;
+    PathSettings path;
+    int wavefrontSize; // paths per wavefront batch, 0 for WAVEFRONT_PATHS_PER_THREAD per thread
+
+    //adaptive sampling spends samplesPerPixel * pixels where the estimate is noisiest; path integrator only
+    double adaptiveThreshold; // relative standard error a pixel stops at, 0 samples every pixel equally
+    int minSamples;           // 0 picks a default from samplesPerPixel
+    int maxSamples;
+
+    int bootstrapSamples;
+    int numChains;
+    double largeStepProbability;
+} RenderSettings;
+
+typedef struct _ProgressiveRender ProgressiveRender;
+
+RenderSettings defaultRenderSettings (int width, int height);
+Film * renderImage (Scene * scene, Camera * cam, const RenderSettings * settings);
+
+// renders passes of one sample each on a background thread, samplesPerPixel of them unless adaptive
+ProgressiveRender * startProgressiveRender (Scene * scene, Camera * cam, const RenderSettings * settings, double exposure);
+bool copyProgressiveFrame (ProgressiveRender * render, unsigned char * destination, int * passes); // false if no new frame
+bool isProgressiveRenderFinished (ProgressiveRender * render);
+int getProgressivePasses (ProgressiveRender * render);
+Film * finishProgressiveRender (ProgressiveRender * render, bool cancel); // joins the thread and hands back the film
+
+const char * getIntegratorName (Integrator integrator);
+bool parseIntegratorName (const char * name, Integrator * integrator);
+const char * getEngineName (RenderEngine engine);
+bool parseEngineName (const char * name, RenderEngine * engine);
+
+#endif
\ No newline at end of file
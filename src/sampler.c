@@ -0,0 +1,108 @@
+#include "sampler.h"
+#include "constants.h"
+#include <math.h>
+#include <stdlib.h>
+
+Sampler createIndependentSampler (Seed seed) {
+    Sampler sampler = {0};
+    sampler.type = SAMPLER_INDEPENDENT;
+    sampler.seed = seed;
+    return sampler;
+}
+
+Sampler createPrimarySampleSampler (Seed seed, double largeStepProbability, double mutationSigma) {
+    Sampler sampler = {0};
+    sampler.type = SAMPLER_PRIMARY_SAMPLE;
+    sampler.seed = seed;
+    sampler.largeStepProbability = largeStepProbability;
+    sampler.mutationSigma = mutationSigma;
+    //the first path is drawn as a large step so it matches an independent sample from the same seed
+    sampler.largeStep = true;
+    return sampler;
+}
+
+void freeSampler (Sampler * sampler) {
+    free (sampler->samples);
+    sampler->samples = NULL;
+    sampler->numSamples = 0;
+    sampler->samplesCapacity = 0;
+}
+
+static double gaussianSample (Seed * seed) {
+    //box muller, 1 - u keeps the log argument away from zero
+    double u1 = 1.0 - randomDouble (seed);
+    double u2 = randomDouble (seed);
+    return sqrt (-2.0 * log (u1)) * cos (2.0 * M_PI * u2);
+}
+
+double nextPrimarySample (Sampler * sampler) {
+    int index = sampler->sampleIndex ++;
+
+    if (index >= sampler->samplesCapacity) {
+        int newCapacity = sampler->samplesCapacity ? sampler->samplesCapacity * 2 : 32;
+        while (newCapacity <= index) newCapacity *= 2;
+        PrimarySample * temp = realloc (sampler->samples, newCapacity * sizeof(PrimarySample));
+        if (temp == NULL) {
+            //out of memory, fall back to an unrecorded independent value
+            return randomDouble (&sampler->seed);
+        }
+        sampler->samples = temp;
+        sampler->samplesCapacity = newCapacity;
+    }
+
+    while (sampler->numSamples <= index) {
+        PrimarySample * fresh = &sampler->samples[sampler->numSamples ++];
+        fresh->value = 0;
+        fresh->lastModified = 0;
+        fresh->backupValue = 0;
+        fresh->backupModified = 0;
+    }
+
+    PrimarySample * sample = &sampler->samples[index];
+
+    //coordinates untouched since the last accepted large step are stale and get redrawn lazily
+    if (sample->lastModified < sampler->lastLargeStepIteration) {
+        sample->value = randomDouble (&sampler->seed);
+        sample->lastModified = sampler->lastLargeStepIteration;
+    }
+
+    sample->backupValue = sample->value;
+    sample->backupModified = sample->lastModified;
+
+    if (sampler->largeStep) {
+        sample->value = randomDouble (&sampler->seed);
+    } else {
+        //catch up on every small step this coordinate missed in one gaussian of combined variance
+        long long missedSteps = sampler->currentIteration - sample->lastModified;
+        double sigma = sampler->mutationSigma * sqrt ((double) missedSteps);
+        sample->value += gaussianSample (&sampler->seed) * sigma;
+        sample->value -= floor (sample->value);
+        if (sample->value >= 1.0) sample->value = nextafter (1.0, 0.0);
+    }
+
+    sample->lastModified = sampler->currentIteration;
+    return sample->value;
+}
+
+void startIteration (Sampler * sampler) {
+    sampler->currentIteration ++;
+    sampler->largeStep = randomDouble (&sampler->seed) < sampler->largeStepProbability;
+    sampler->sampleIndex = 0;
+}
+
+void acceptMutation (Sampler * sampler) {
+    if (sampler->largeStep) {
+        sampler->lastLargeStepIteration = sampler->currentIteration;
+    }
+}
+
+void rejectMutation (Sampler * sampler) {
+    for (int i = 0; i < sampler->numSamples; ++ i) {
+        PrimarySample * sample = &sampler->samples[i];
+        if (sample->lastModified == sampler->currentIteration) {
+            sample->value = sample->backupValue;
+            sample->lastModified = sample->backupModified;
+        }
+    }
+    sampler->currentIteration --;
+}
\ No newline at end of file
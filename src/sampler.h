@@ -0,0 +1,49 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+#include "rand.h"
+
+typedef enum {
+    SAMPLER_INDEPENDENT,
+    SAMPLER_PRIMARY_SAMPLE
+} SamplerType;
+
+typedef struct {
+    double value;
+    double backupValue;
+    long long lastModified;
+    long long backupModified;
+} PrimarySample;
+
+typedef struct {
+    SamplerType type;
+    Seed seed;
+
+    // primary sample space state used by Metropolis, unused by the independent sampler
+    PrimarySample * samples;
+    int numSamples;
+    int samplesCapacity;
+    int sampleIndex;
+    long long currentIteration;
+    long long lastLargeStepIteration;
+    bool largeStep;
+    double largeStepProbability;
+    double mutationSigma;
+} Sampler;
+
+Sampler createIndependentSampler (Seed seed);
+Sampler createPrimarySampleSampler (Seed seed, double largeStepProbability, double mutationSigma);
+void freeSampler (Sampler * sampler);
+
+double nextPrimarySample (Sampler * sampler);
+void startIteration (Sampler * sampler);
+void acceptMutation (Sampler * sampler);
+void rejectMutation (Sampler * sampler);
+
+static inline double nextSample (Sampler * sampler) {
+    if (sampler->type == SAMPLER_INDEPENDENT) return randomDouble (&sampler->seed);
+    return nextPrimarySample (sampler);
+}
+
+#endif
\ No newline at end of file
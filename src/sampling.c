@@ -0,0 +1,63 @@
+#include "sampling.h"
+
+OrthonormalBasis createBasis (Vector normal) {
+    //Duff et al. 2017: no branch on which axis the normal is closest to, only on its sign
+    OrthonormalBasis basis;
+    double sign = copysign (1.0, normal.z);
+    double a = -1.0 / (sign + normal.z);
+    double b = normal.x * normal.y * a;
+    basis.tangent = (Vector){1.0 + sign * normal.x * normal.x * a, sign * b, -sign * normal.x};
+    basis.bitangent = (Vector){b, sign + normal.y * normal.y * a, -normal.y};
+    basis.normal = normal;
+    return basis;
+}
+
+Vector basisToWorld (const OrthonormalBasis * basis, Vector local) {
+    return addVector (addVector (scaleVector (basis->tangent, local.x), scaleVector (basis->bitangent, local.y)),
+                      scaleVector (basis->normal, local.z));
+}
+
+void sampleConcentricDisk (double u, double v, double * x, double * y) {
+    //Shirley and Chiu: squares map to rings, so strata of the unit square stay compact on the disk
+    double a = 2.0 * u - 1.0;
+    double b = 2.0 * v - 1.0;
+    if (a == 0 && b == 0) {
+        *x = *y = 0;
+        return;
+    }
+
+    double radius, angle;
+    if (fabs (a) > fabs (b)) {
+        radius = a;
+        angle = (M_PI / 4.0) * (b / a);
+    } else {
+        radius = b;
+        angle = (M_PI / 2.0) - (M_PI / 4.0) * (a / b);
+    }
+    *x = radius * cos (angle);
+    *y = radius * sin (angle);
+}
+
+Vector sampleCosineHemisphere (double u, double v) {
+    //Malley: project a uniform disk point up onto the hemisphere
+    double x, y;
+    sampleConcentricDisk (u, v, &x, &y);
+    double z = sqrt (fmax (0.0, 1.0 - x * x - y * y));
+    return (Vector){x, y, z};
+}
+
+double getCosineHemispherePdf (double cosTheta) {
+    return cosTheta > 0 ? cosTheta / M_PI : 0;
+}
+
+void sampleUniformTriangle (double u, double v, double * b1, double * b2) {
+    //sqrt keeps the density uniform when the unit square is folded onto the triangle
+    double root = sqrt (u);
+    *b1 = root * (1.0 - v);
+    *b2 = root * v;
+}
+
+double powerHeuristic (double pdf, double otherPdf) {
+    double a = pdf * pdf, b = otherPdf * otherPdf;
+    return (a + b > 0) ? a / (a + b) : 0;
+}
\ No newline at end of file
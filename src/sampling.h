@@ -0,0 +1,23 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include "vectorMath.h"
+
+// right handed frame with the normal as its z axis
+typedef struct {
+    Vector tangent;
+    Vector bitangent;
+    Vector normal;
+} OrthonormalBasis;
+
+OrthonormalBasis createBasis (Vector normal);
+Vector basisToWorld (const OrthonormalBasis * basis, Vector local);
+
+void sampleConcentricDisk (double u, double v, double * x, double * y);
+Vector sampleCosineHemisphere (double u, double v); // local frame, z up
+double getCosineHemispherePdf (double cosTheta);
+void sampleUniformTriangle (double u, double v, double * b1, double * b2); // barycentrics of the 2nd and 3rd vertex
+
+double powerHeuristic (double pdf, double otherPdf);
+
+#endif
\ No newline at end of file
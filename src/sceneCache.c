@@ -0,0 +1,269 @@
+#include "sceneCache.h"
+#include "sceneLoader.h"
+#include "bvh.h"
+#include "wideBvh.h"
+#include "lights.h"
+#include "rand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define SCENE_CACHE_MAGIC "MLTSCENE"
+#define SCENE_CACHE_VERSION 1
+#define SCENE_CACHE_ALIGNMENT 64 // every section starts on a cache line, so mapped arrays are as aligned as malloc'd ones
+
+typedef enum {
+    SECTION_VERTICES,
+    SECTION_TRIANGLES,
+    SECTION_SPHERES,
+    SECTION_MATERIALS,
+    SECTION_BVH_NODES,
+    SECTION_BVH_PRIMITIVES,
+    SECTION_WIDE_BVH_NODES,
+    SECTION_LIGHTS,
+    SECTION_TRIANGLE_LIGHTS,
+    SECTION_LIGHT_PMF,
+    SECTION_LIGHT_ALIAS_PROBABILITY,
+    SECTION_LIGHT_ALIAS,
+    SECTION_LIGHT_BVH_NODES,
+    NUM_CACHE_SECTIONS
+} CacheSection;
+
+static const size_t sectionElementSizes[NUM_CACHE_SECTIONS] = {
+    sizeof(Vertex), sizeof(Triangle), sizeof(Sphere), sizeof(Material),
+    sizeof(BVHNode), sizeof(int), sizeof(WideBVHNode),
+    sizeof(Light), sizeof(int), sizeof(double), sizeof(double), sizeof(int), sizeof(LightBVHNode)
+};
+
+// the file starts with this, followed by the sections at the offsets it lists
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t sourceHash;
+    uint64_t fileSize; // catches a truncated file without reading it
+    BoundingBox boundingBox;
+    int32_t wideBVHWidth;
+    int32_t simdLevel;
+    int32_t lightSampler;
+    int32_t numSections;
+    uint64_t offsets[NUM_CACHE_SECTIONS];
+    uint64_t counts[NUM_CACHE_SECTIONS];
+} SceneCacheHeader;
+
+static void getSceneSections (const Scene * scene, const void * arrays[NUM_CACHE_SECTIONS], uint64_t counts[NUM_CACHE_SECTIONS]) {
+    int numTriangleLights = scene->numLights > 0 ? scene->numTriangles : 0;
+    const void * sceneArrays[NUM_CACHE_SECTIONS] = {
+        scene->vertices, scene->triangles, scene->spheres, scene->materials,
+        scene->bvhNodes, scene->bvhPrimitives, scene->wideBVHNodes,
+        scene->lights, scene->triangleLights, scene->lightPmf, scene->lightAliasProbability, scene->lightAlias, scene->lightBVHNodes
+    };
+    const int sceneCounts[NUM_CACHE_SECTIONS] = {
+        scene->numVertices, scene->numTriangles, scene->numSpheres, scene->numMaterials,
+        scene->numBVHNodes, scene->numBVHPrimitives, scene->numWideBVHNodes,
+        scene->numLights, numTriangleLights, scene->numLights, scene->numLights, scene->numLights, scene->numLightBVHNodes
+    };
+    for (int i = 0; i < NUM_CACHE_SECTIONS; ++ i) {
+        arrays[i] = sceneArrays[i];
+        counts[i] = sceneCounts[i];
+    }
+}
+
+/* hashing */
+
+// four independent multiply-rotate lanes over 8 byte words, so hashing a large OBJ runs near memory speed
+static uint64_t hashBytes (uint64_t hash, const void * data, size_t size) {
+    const unsigned char * bytes = data;
+    uint64_t lanes[4] = {hash, hash ^ 0x9E3779B97F4A7C15ULL, hash ^ 0xC2B2AE3D27D4EB4FULL, hash ^ 0x165667B19E3779F9ULL};
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int lane = 0; lane < 4; ++ lane) {
+            uint64_t word;
+            memcpy (&word, bytes + i + lane * 8, sizeof(word));
+            lanes[lane] = rotate (lanes[lane] ^ (word * 0x87C37B91114253D5ULL), 31) * 0x4CF5AD432745937FULL;
+        }
+    }
+    hash = rotate (lanes[0], 1) + rotate (lanes[1], 7) + rotate (lanes[2], 12) + rotate (lanes[3], 18);
+    for (; i < size; ++ i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    //splitmix64 finalizer, so a change anywhere flips about half the bits
+    hash ^= size;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+static uint64_t hashFile (uint64_t hash, const char * path, bool * found) {
+    MappedFile file;
+    *found = path && path[0] && mapFile (path, true, &file);
+    if (!*found) return hashBytes (hash, "missing", 7);
+    hash = hashBytes (hash, file.data, file.size);
+    unmapFile (&file);
+    return hash;
+}
+
+uint64_t getSceneSourceHash (const Scene * scene, const char * objPath, const char * mtlPath) {
+    SimdLevel level;
+    int width;
+    resolveWideBVHLayout (&scene->bvhSettings, &level, &width);
+
+    //explicit values rather than the settings struct, whose padding bytes are not guaranteed
+    const BVHBuildSettings * settings = &scene->bvhSettings;
+    uint64_t traversalCost;
+    memcpy (&traversalCost, &settings->traversalCost, sizeof(traversalCost));
+    uint64_t key[8 + NUM_CACHE_SECTIONS] = {
+        SCENE_CACHE_VERSION, sizeof(Real), sizeof(SceneCacheHeader),
+        settings->numBins, settings->maxLeafSize, traversalCost,
+        (uint64_t) settings->splitAllAxes | (uint64_t) width << 8 | (uint64_t) level << 16,
+        (uint64_t)(int64_t) scene->lightSampler
+    };
+    for (int i = 0; i < NUM_CACHE_SECTIONS; ++ i) {
+        key[8 + i] = sectionElementSizes[i];
+    }
+
+    bool found;
+    uint64_t hash = hashBytes (0, key, sizeof(key));
+    hash = hashFile (hash, objPath, &found);
+    if (!found) return 0;
+    //the MTL the loader will actually read, which may be the OBJ's mtllib rather than mtlPath
+    char materialPath[1024];
+    bool hasMaterials = resolveMaterialPath (objPath, mtlPath, materialPath, sizeof (materialPath));
+    hash = hashFile (hash, hasMaterials ? materialPath : NULL, &found);
+    return hash ? hash : 1;
+}
+
+/* reading */
+
+static uint64_t alignOffset (uint64_t offset) {
+    return (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+}
+
+static bool validateHeader (const SceneCacheHeader * header, size_t fileSize, uint64_t sourceHash) {
+    if (memcmp (header->magic, SCENE_CACHE_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != SCENE_CACHE_VERSION || header->headerSize != sizeof(SceneCacheHeader)) return false;
+    if (header->sourceHash != sourceHash || header->fileSize != fileSize) return false;
+    if (header->numSections != NUM_CACHE_SECTIONS) return false;
+
+    for (int i = 0; i < NUM_CACHE_SECTIONS; ++ i) {
+        uint64_t offset = header->offsets[i];
+        if (header->counts[i] > INT_MAX || offset % SCENE_CACHE_ALIGNMENT != 0 || offset > fileSize) return false;
+        if (header->counts[i] > (fileSize - offset) / sectionElementSizes[i]) return false;
+    }
+    return true;
+}
+
+bool loadSceneCache (Scene * scene, const char * cachePath, uint64_t sourceHash) {
+    if (sourceHash == 0 || scene->cacheFile) return false;
+
+    MappedFile * file = malloc (sizeof(MappedFile));
+    if (!file) return false;
+    if (!mapFile (cachePath, false, file)) {
+        free (file);
+        return false;
+    }
+    const SceneCacheHeader * header = (const SceneCacheHeader *) file->data;
+    if (file->size < sizeof(SceneCacheHeader) || !validateHeader (header, file->size, sourceHash)) {
+        unmapFile (file);
+        free (file);
+        return false;
+    }
+
+    //whatever initScene allocated stays in the scene's arena, unused, until the scene is freed
+    void * sections[NUM_CACHE_SECTIONS];
+    for (int i = 0; i < NUM_CACHE_SECTIONS; ++ i) {
+        sections[i] = header->counts[i] > 0 ? file->data + header->offsets[i] : NULL;
+    }
+    scene->vertices = sections[SECTION_VERTICES];
+    scene->numVertices = scene->verticesCapacity = (int) header->counts[SECTION_VERTICES];
+    scene->triangles = sections[SECTION_TRIANGLES];
+    scene->numTriangles = scene->trianglesCapacity = (int) header->counts[SECTION_TRIANGLES];
+    scene->spheres = sections[SECTION_SPHERES];
+    scene->numSpheres = scene->spheresCapacity = (int) header->counts[SECTION_SPHERES];
+    scene->materials = sections[SECTION_MATERIALS];
+    scene->numMaterials = scene->materialsCapacity = (int) header->counts[SECTION_MATERIALS];
+
+    scene->bvhNodes = sections[SECTION_BVH_NODES];
+    scene->numBVHNodes = (int) header->counts[SECTION_BVH_NODES];
+    scene->bvhPrimitives = sections[SECTION_BVH_PRIMITIVES];
+    scene->numBVHPrimitives = (int) header->counts[SECTION_BVH_PRIMITIVES];
+    scene->wideBVHNodes = sections[SECTION_WIDE_BVH_NODES];
+    scene->numWideBVHNodes = (int) header->counts[SECTION_WIDE_BVH_NODES];
+    scene->wideBVHWidth = header->wideBVHWidth;
+    scene->simdLevel = header->simdLevel;
+
+    scene->lights = sections[SECTION_LIGHTS];
+    scene->numLights = (int) header->counts[SECTION_LIGHTS];
+    scene->triangleLights = sections[SECTION_TRIANGLE_LIGHTS];
+    scene->lightPmf = sections[SECTION_LIGHT_PMF];
+    scene->lightAliasProbability = sections[SECTION_LIGHT_ALIAS_PROBABILITY];
+    scene->lightAlias = sections[SECTION_LIGHT_ALIAS];
+    scene->lightBVHNodes = sections[SECTION_LIGHT_BVH_NODES];
+    scene->numLightBVHNodes = (int) header->counts[SECTION_LIGHT_BVH_NODES];
+    scene->lightSampler = header->lightSampler;
+
+    scene->boundingBox = header->boundingBox;
+    scene->bvhBuildTime = scene->wideBVHBuildTime = scene->lightBuildTime = 0;
+    //the arrays are not the arena's now, so nothing may grow them; freeScene releases the mapping as well
+    scene->cacheFile = file;
+    return true;
+}
+
+/* writing */
+
+static bool writePadding (FILE * file, uint64_t from, uint64_t to) {
+    static const char zeros[SCENE_CACHE_ALIGNMENT] = {0};
+    return to == from || fwrite (zeros, 1, to - from, file) == to - from;
+}
+
+bool saveSceneCache (const Scene * scene, const char * cachePath, uint64_t sourceHash) {
+    if (sourceHash == 0) return false;
+
+    SceneCacheHeader header;
+    memset (&header, 0, sizeof(header));
+    memcpy (header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_CACHE_VERSION;
+    header.headerSize = sizeof(SceneCacheHeader);
+    header.sourceHash = sourceHash;
+    header.boundingBox = scene->boundingBox;
+    header.wideBVHWidth = scene->wideBVHWidth;
+    header.simdLevel = scene->simdLevel;
+    header.lightSampler = scene->lightSampler;
+    header.numSections = NUM_CACHE_SECTIONS;
+
+    const void * arrays[NUM_CACHE_SECTIONS];
+    getSceneSections (scene, arrays, header.counts);
+    uint64_t offset = alignOffset (sizeof(header));
+    for (int i = 0; i < NUM_CACHE_SECTIONS; ++ i) {
+        header.offsets[i] = offset;
+        offset = alignOffset (offset + header.counts[i] * sectionElementSizes[i]);
+    }
+    header.fileSize = offset;
+
+    //written beside the target and renamed over it, so a reader never maps a half written file
+    char temporaryPath[4096];
+    snprintf (temporaryPath, sizeof(temporaryPath), "%s.tmp", cachePath);
+    FILE * file = fopen (temporaryPath, "wb");
+    if (!file) return false;
+
+    bool ok = fwrite (&header, sizeof(header), 1, file) == 1;
+    uint64_t position = sizeof(header);
+    for (int i = 0; i < NUM_CACHE_SECTIONS && ok; ++ i) {
+        ok = writePadding (file, position, header.offsets[i]);
+        size_t count = header.counts[i];
+        ok = ok && (count == 0 || fwrite (arrays[i], sectionElementSizes[i], count, file) == count);
+        position = header.offsets[i] + count * sectionElementSizes[i];
+    }
+    ok = ok && writePadding (file, position, header.fileSize);
+    ok = (fclose (file) == 0) && ok;
+
+#ifdef _WIN32
+    if (ok) remove (cachePath);
+#endif
+    if (!ok || rename (temporaryPath, cachePath) != 0) {
+        remove (temporaryPath);
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
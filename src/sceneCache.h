@@ -0,0 +1,18 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "geometry.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* compiled scenes: the triangles, spheres, materials, lights and both BVHs loadScene produces, in one file.
+ * a later run maps the file and points the scene's arrays into it, with no parsing and no builds. */
+
+// hash of everything a compiled scene depends on: the OBJ, the MTL the loader resolves for it, the scene's
+// build settings and the struct layouts of this binary. 0 if the OBJ can't be read; no MTL hashes as missing
+uint64_t getSceneSourceHash (const Scene * scene, const char * objPath, const char * mtlPath);
+
+bool loadSceneCache (Scene * scene, const char * cachePath, uint64_t sourceHash); // false when missing, stale or damaged
+bool saveSceneCache (const Scene * scene, const char * cachePath, uint64_t sourceHash);
+
+#endif
\ No newline at end of file
@@ -1,9 +1,16 @@
 #include "sceneLoader.h"
 #include "bvh.h"
+#include "wideBvh.h"
+#include "lights.h"
+#include "mappedFile.h"
+#include "blockArray.h"
+#include "threadPool.h"
+#include "constants.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
 
 #define MAX_PARSED_MATERIALS 64 /* temp, can modify if needed*/
 
@@ -20,15 +27,13 @@ typedef struct {
 static int containsIgnoreCase (const char * haystack, const char * needle) {
     size_t needleLength = strlen (needle);
     for (size_t i = 0; haystack[i]; ++ i) {
-        int match = 1;
-        for (size_t j = 0; j < needleLength && haystack[i + j]; ++ j) {
-            if (tolower ((unsigned char) haystack[i + j]) !=
-                tolower ((unsigned char) needle[j])) {
-                match = 0;
-                break;
-            }
+        size_t j = 0;
+        while (j < needleLength && haystack[i + j] &&
+               tolower ((unsigned char) haystack[i + j]) == tolower ((unsigned char) needle[j])) {
+            ++ j;
         }
-        if (match) return 1;
+        //the whole needle has to match, not just the part before the haystack runs out
+        if (j == needleLength) return 1;
     }
     return 0;
 }
@@ -44,39 +49,206 @@ static void getDirectoryFromPath (const char * path, char * directory, int direc
     else directory[0] = '\0';
 }
 
+/* tokenizer
+ * the loaders tokenize the mapped file where it lies instead of copying it out a line at a time.
+ * the data is not null terminated, so every scan below is bounded by an end pointer. */
+
+static inline bool isBlank (char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool isDigit (char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline const char * skipBlanks (const char * p, const char * end) {
+    while (p < end && isBlank (*p)) ++ p;
+    return p;
+}
+
+static inline const char * skipToken (const char * p, const char * end) {
+    while (p < end && !isBlank (*p)) ++ p;
+    return p;
+}
+
+static const char * findLineEnd (const char * p, const char * end) {
+    const char * newline = memchr (p, '\n', end - p);
+    return newline ? newline : end;
+}
+
+static bool tokenEquals (const char * token, const char * tokenEnd, const char * word) {
+    size_t length = strlen (word);
+    return (size_t)(tokenEnd - token) == length && memcmp (token, word, length) == 0;
+}
+
+// copies the next token, truncated to fit, and returns where it ended
+static const char * copyToken (const char * p, const char * end, char * out, size_t size) {
+    p = skipBlanks (p, end);
+    const char * tokenEnd = skipToken (p, end);
+    size_t length = tokenEnd - p;
+    if (length > size - 1) length = size - 1;
+    memcpy (out, p, length);
+    out[length] = '\0';
+    return tokenEnd;
+}
+
+static const double exactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// strtod on a copy of the token, for the numbers the fast path can't round exactly
+static const char * parseRealSlow (const char * token, const char * tokenEnd, double * value) {
+    char buffer[128];
+    size_t length = tokenEnd - token;
+    if (length == 0 || length >= sizeof(buffer)) return NULL;
+    memcpy (buffer, token, length);
+    buffer[length] = '\0';
+    char * parsedEnd;
+    *value = strtod (buffer, &parsedEnd);
+    return parsedEnd == buffer + length ? tokenEnd : NULL;
+}
+
+/* reads one whitespace separated decimal number, NULL if the token isn't one.
+ * up to 19 significant digits are gathered into an integer; when that integer and the power of ten
+ * are both exact doubles, one multiply or divide rounds correctly and gives what strtod would.
+ * anything else (long mantissas, big exponents, hex, inf, nan) goes through strtod itself. */
+static const char * parseReal (const char * p, const char * end, double * value) {
+    p = skipBlanks (p, end);
+    const char * token = p;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p ++ == '-';
+
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    bool exact = true;
+    bool anyDigits = false;
+
+    for (; p < end && isDigit (*p); ++ p) {
+        anyDigits = true;
+        if (mantissa == 0 && *p == '0') continue;
+        if (significantDigits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significantDigits ++;
+        } else {
+            exponent ++;
+            if (*p != '0') exact = false;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++ p; p < end && isDigit (*p); ++ p) {
+            anyDigits = true;
+            if (mantissa == 0 && *p == '0') {
+                exponent --;
+            } else if (significantDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significantDigits ++;
+                exponent --;
+            } else if (*p != '0') {
+                exact = false;
+            }
+        }
+    }
+    if (anyDigits && p < end && (*p == 'e' || *p == 'E')) {
+        const char * q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '-' || *q == '+')) negativeExponent = *q ++ == '-';
+        if (q < end && isDigit (*q)) {
+            int written = 0;
+            for (; q < end && isDigit (*q); ++ q) {
+                if (written < 100000) written = written * 10 + (*q - '0');
+            }
+            exponent += negativeExponent ? -written : written;
+            p = q;
+        }
+    }
+
+    const char * tokenEnd = skipToken (p, end);
+    if (!anyDigits || p != tokenEnd || !exact || mantissa > (1ull << 53) || exponent < -22 || exponent > 22) {
+        return parseRealSlow (token, tokenEnd, value);
+    }
+
+    double result = (double) mantissa;
+    if (exponent < 0) result /= exactPowersOfTen[-exponent];
+    else result *= exactPowersOfTen[exponent];
+    *value = negative ? -result : result;
+    return tokenEnd;
+}
+
+// reads the leading integer of a token like 12, -3, 4/7/1 or 5//2, NULL if there is none
+static const char * parseIndex (const char * p, const char * end, long * value) {
+    p = skipBlanks (p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p ++ == '-';
+    if (p >= end || !isDigit (*p)) return NULL;
+
+    long result = 0;
+    for (; p < end && isDigit (*p); ++ p) {
+        if (result < 1000000000000l) result = result * 10 + (*p - '0');
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+static const char * parseVector (const char * p, const char * end, Vector * vector) {
+    if (!(p = parseReal (p, end, &vector->x))) return NULL;
+    if (!(p = parseReal (p, end, &vector->y))) return NULL;
+    return parseReal (p, end, &vector->z);
+}
+
+static bool growArray (void ** array, int * capacity, int needed, size_t elementSize, int initialCapacity) {
+    if (needed <= *capacity) return true;
+    int newCapacity = *capacity ? *capacity : initialCapacity;
+    while (newCapacity < needed) newCapacity *= 2;
+    void * temp = realloc (*array, (size_t) newCapacity * elementSize);
+    if (temp == NULL) return false;
+    *array = temp;
+    *capacity = newCapacity;
+    return true;
+}
+
 /* MTL parser */
 
 static int parseMtlFile (const char * path, ParsedMaterial * materials, int maxMaterials) {
-    FILE * file = fopen (path, "r");
-    if (!file) return 0;
+    MappedFile file;
+    if (!mapFile (path, true, &file)) return 0;
 
     int count = -1;
-    char line[512];
-    while (fgets (line, sizeof (line), file)) {
-        if (line[0] == '#' || line[0] == '\n') continue;
-
-        if (strncmp (line, "newmtl ", 7) == 0) {
+    const char * end = file.data + file.size;
+    for (const char * line = file.data; line < end; ) {
+        const char * lineEnd = findLineEnd (line, end);
+        const char * keyword = skipBlanks (line, lineEnd);
+        const char * p = skipToken (keyword, lineEnd);
+        line = lineEnd + 1;
+        if (keyword == lineEnd || *keyword == '#') continue;
+
+        if (tokenEquals (keyword, p, "newmtl")) {
             count ++;
             if (count >= maxMaterials) { count --; continue; }
             memset (&materials[count], 0, sizeof (ParsedMaterial));
             materials[count].refractiveIndex = 1.0;
-            sscanf (line + 7, "%127s", materials[count].name);
+            copyToken (p, lineEnd, materials[count].name, sizeof (materials[count].name));
         } else if (count >= 0 && count < maxMaterials) {
-            double r, g, b;
-            if (sscanf (line, " Kd %lf %lf %lf", &r, &g, &b) == 3) {
-                materials[count].diffuseColor = (Vector){r, g, b};
-            } else if (sscanf (line, " Ks %lf %lf %lf", &r, &g, &b) == 3) {
-                materials[count].specularColor = (Vector){r, g, b};
-            } else if (sscanf (line, " Ke %lf %lf %lf", &r, &g, &b) == 3) {
-                materials[count].emissionColor = (Vector){r, g, b};
-            } else if (sscanf (line, " Ni %lf", &r) == 1) {
-                materials[count].refractiveIndex = r;
-            } else {
-                sscanf (line, " illum %d", &materials[count].illuminationModel);
+            ParsedMaterial * material = &materials[count];
+            Vector color;
+            double value;
+            long model;
+            if (tokenEquals (keyword, p, "Kd")) {
+                if (parseVector (p, lineEnd, &color)) material->diffuseColor = color;
+            } else if (tokenEquals (keyword, p, "Ks")) {
+                if (parseVector (p, lineEnd, &color)) material->specularColor = color;
+            } else if (tokenEquals (keyword, p, "Ke")) {
+                if (parseVector (p, lineEnd, &color)) material->emissionColor = color;
+            } else if (tokenEquals (keyword, p, "Ni")) {
+                if (parseReal (p, lineEnd, &value)) material->refractiveIndex = value;
+            } else if (tokenEquals (keyword, p, "illum")) {
+                if (parseIndex (p, lineEnd, &model)) material->illuminationModel = (int) model;
             }
         }
     }
-    fclose (file);
+    unmapFile (&file);
     return count + 1;
 }
 
@@ -89,8 +261,9 @@ static int findParsedMaterialIndex (const ParsedMaterial * materials, int count,
 
 /* material conversion */
 
-static int loadAndConvertMaterials (Scene * scene, const char * mtlPath,
-                                    ParsedMaterial * parsed, int * outCount) {
+// false only when out of memory; a missing MTL just converts nothing
+static bool loadAndConvertMaterials (Scene * scene, const char * mtlPath,
+                                     ParsedMaterial * parsed, int * outCount) {
     int numParsed = parseMtlFile (mtlPath, parsed, MAX_PARSED_MATERIALS);
     *outCount = numParsed;
 
@@ -113,21 +286,250 @@ static int loadAndConvertMaterials (Scene * scene, const char * mtlPath,
             color = parsed[i].diffuseColor;
         }
 
-        addMaterial (scene, createMaterial (color, parsed[i].emissionColor, type, indexOfRefraction));
+        if (!addMaterial (scene, createMaterial (color, parsed[i].emissionColor, type, indexOfRefraction))) return false;
     }
 
-    return numParsed;
+    return true;
 }
 
-/* sphere detection */
+/* OBJ loader
+ * the mapped file is cut at line boundaries into chunks that the thread pool parses on their own:
+ * vertices into a per chunk array, and faces, groups and material changes into a per chunk record list.
+ * nothing a chunk produces depends on the lines before it, so relative indices stay raw until the
+ * merge, which replays every chunk's records in file order exactly as one pass over the file would.
+ * chunks are parsed a window at a time and each window is merged before the next is parsed, so the face
+ * records, and the pages of the file they came from, are only ever held for one window. */
+
+typedef enum {
+    OBJ_RECORD_FACE,
+    OBJ_RECORD_GROUP,
+    OBJ_RECORD_USEMTL
+} ObjRecordType;
+
+typedef struct {
+    ObjRecordType type;
+    int localVertices; // vertices the chunk had read before this line, to resolve negative indices
+    int count; // face corners, or the length of the name
+    union {
+        const int * corners; // face indices as written, 1 based or negative
+        const char * name; // in the mapped file
+    };
+} ObjRecord;
+
+typedef struct {
+    const char * begin;
+    const char * end;
+
+    BlockArray vertices; // Point
+    BoundingBox bounds;
+    BlockArray corners; // int, one run per face
+    BlockArray records; // ObjRecord
+
+    int * face; // the face line being read
+    int faceCapacity;
+
+    int vertexBase; // OBJ index of the chunk's first vertex, set when it is merged
+    int * vertexMap; // scene vertex for each of the chunk's vertices, -1 until a face uses it
+    bool failed;
+} ObjChunk;
+
+static bool addObjRecord (ObjChunk * chunk, ObjRecord record) {
+    ObjRecord * added = appendBlockElements (&chunk->records, 1);
+    if (added == NULL) return false;
+    record.localVertices = (int) chunk->vertices.count;
+    *added = record;
+    return true;
+}
+
+static bool parseVertexLine (ObjChunk * chunk, const char * p, const char * lineEnd) {
+    Vector position;
+    if (!parseVector (p, lineEnd, &position)) return true;
+    Point vertex = {position.x, position.y, position.z};
+
+    Point * added = appendBlockElements (&chunk->vertices, 1);
+    if (added == NULL) return false;
+    *added = vertex;
+
+    BoundingBox * box = &chunk->bounds;
+    if (vertex.x < box->min.x) box->min.x = vertex.x;
+    if (vertex.y < box->min.y) box->min.y = vertex.y;
+    if (vertex.z < box->min.z) box->min.z = vertex.z;
+    if (vertex.x > box->max.x) box->max.x = vertex.x;
+    if (vertex.y > box->max.y) box->max.y = vertex.y;
+    if (vertex.z > box->max.z) box->max.z = vertex.z;
+    return true;
+}
+
+static bool parseFaceLine (ObjChunk * chunk, const char * p, const char * lineEnd) {
+    int count = 0;
+    long index;
+    //v, v/vt, v//vn and v/vt/vn all start with the position index, which is all the renderer uses
+    while ((p = parseIndex (p, lineEnd, &index)) && index != 0) {
+        p = skipToken (p, lineEnd);
+        if (!growArray ((void **) &chunk->face, &chunk->faceCapacity, count + 1, sizeof (int), 16)) return false;
+        //anything past the int range is out of range however it resolves
+        if (index > INT32_MAX) index = INT32_MAX;
+        if (index < -INT32_MAX) index = -INT32_MAX;
+        chunk->face[count ++] = (int) index;
+    }
+    int * corners = appendBlockElements (&chunk->corners, count > 0 ? count : 1);
+    if (corners == NULL) return false;
+    memcpy (corners, chunk->face, count * sizeof (int));
+    return addObjRecord (chunk, (ObjRecord){.type = OBJ_RECORD_FACE, .count = count, .corners = corners});
+}
+
+static bool addNameRecord (ObjChunk * chunk, ObjRecordType type, const char * p, const char * lineEnd) {
+    const char * name = skipBlanks (p, lineEnd);
+    return addObjRecord (chunk, (ObjRecord){.type = type, .count = (int)(skipToken (name, lineEnd) - name), .name = name});
+}
+
+static void parseObjChunk (void * context, int chunkIndex, int threadIndex) {
+    ObjChunk * chunk = &((ObjChunk *) context)[chunkIndex];
+    chunk->bounds.min = (Point){1e20, 1e20, 1e20};
+    chunk->bounds.max = (Point){-1e20, -1e20, -1e20};
+
+    bool ok = true;
+    for (const char * line = chunk->begin; line < chunk->end && ok; ) {
+        const char * lineEnd = findLineEnd (line, chunk->end);
+        const char * keyword = skipBlanks (line, lineEnd);
+        const char * p = skipToken (keyword, lineEnd);
+        line = lineEnd + 1;
+        if (keyword == lineEnd || *keyword == '#') continue;
+
+        if (tokenEquals (keyword, p, "v")) {
+            ok = parseVertexLine (chunk, p, lineEnd);
+        } else if (tokenEquals (keyword, p, "f")) {
+            ok = parseFaceLine (chunk, p, lineEnd);
+        } else if (tokenEquals (keyword, p, "g")) {
+            ok = addNameRecord (chunk, OBJ_RECORD_GROUP, p, lineEnd);
+        } else if (tokenEquals (keyword, p, "usemtl")) {
+            ok = addNameRecord (chunk, OBJ_RECORD_USEMTL, p, lineEnd);
+        }
+    }
+    free (chunk->face);
+    chunk->face = NULL;
+    chunk->failed = !ok;
+}
+
+// what a merged chunk holds on to until the end: its vertices, which any later face may index
+static void freeObjChunkRecords (ObjChunk * chunk) {
+    freeBlockArray (&chunk->corners);
+    freeBlockArray (&chunk->records);
+}
+
+static void freeObjChunk (ObjChunk * chunk) {
+    freeBlockArray (&chunk->vertices);
+    freeObjChunkRecords (chunk);
+    free (chunk->face);
+    free (chunk->vertexMap);
+}
+
+// splits [data, data + size) into pieces of about OBJ_CHUNK_BYTES that each end just after a newline
+static int splitObjChunks (const char * data, size_t size, ObjChunk * chunks) {
+    int numChunks = 0;
+    const char * end = data + size;
+    const char * begin = data;
+    while (begin < end) {
+        const char * chunkEnd = end;
+        if ((size_t)(end - begin) > OBJ_CHUNK_BYTES) {
+            const char * newline = memchr (begin + OBJ_CHUNK_BYTES, '\n', end - (begin + OBJ_CHUNK_BYTES));
+            chunkEnd = newline ? newline + 1 : end;
+        }
+        ObjChunk * chunk = &chunks[numChunks ++];
+        memset (chunk, 0, sizeof (ObjChunk));
+        chunk->begin = begin;
+        chunk->end = chunkEnd;
+        initBlockArray (&chunk->vertices, sizeof (Point));
+        initBlockArray (&chunk->corners, sizeof (int));
+        initBlockArray (&chunk->records, sizeof (ObjRecord));
+        begin = chunkEnd;
+    }
+    return numChunks;
+}
+
+/* merge */
+
+typedef struct {
+    Scene * scene;
+
+    ObjChunk * chunks; // the ones merged so far, with the one being merged last
+    int numChunks;
+    int lastChunk; // where the previous vertex lookup landed; faces mostly index nearby vertices
+
+    BlockArray vertices; // the scene's vertices, moved into one array once the file is read
+    BlockArray triangles;
+
+    int * corners; // the face being added, any number of corners
+    int cornersCapacity;
+
+    ParsedMaterial parsed[MAX_PARSED_MATERIALS];
+    int numParsed;
+
+    /* current parsing state */
+    int currentMaterial;
+    bool inSphere;
+    int sphereMaterial;
+    int * sphereVertices;
+    int numSphereVertices;
+    int sphereVerticesCapacity;
+} ObjMerge;
+
+// the merged chunk holding an OBJ vertex that is known to exist
+static ObjChunk * findVertexChunk (ObjMerge * merge, int index) {
+    ObjChunk * last = &merge->chunks[merge->lastChunk];
+    if (index >= last->vertexBase && index - last->vertexBase < (int) last->vertices.count) return last;
+
+    //the last chunk starting at or before the index; chunks without vertices share a base with the next one
+    int low = 0;
+    int high = merge->numChunks - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (merge->chunks[middle].vertexBase <= index) low = middle;
+        else high = middle - 1;
+    }
+    merge->lastChunk = low;
+    return &merge->chunks[low];
+}
+
+static Point getObjVertex (ObjMerge * merge, int index) {
+    ObjChunk * chunk = findVertexChunk (merge, index);
+    return *(const Point *) getBlockElement (&chunk->vertices, index - chunk->vertexBase);
+}
+
+// scene vertex for an OBJ vertex, added on first use so vertices only sphere groups read stay out of the mesh
+static int getMeshVertex (ObjMerge * merge, int index) {
+    ObjChunk * chunk = findVertexChunk (merge, index);
+    int local = index - chunk->vertexBase;
+    if (chunk->vertexMap[local] < 0) {
+        if (merge->vertices.count >= INT32_MAX) return -1;
+        Vertex * vertex = appendBlockElements (&merge->vertices, 1);
+        if (vertex == NULL) return -1;
+        Point point = *(const Point *) getBlockElement (&chunk->vertices, local);
+        *vertex = (Vertex){(Real) point.x, (Real) point.y, (Real) point.z};
+        chunk->vertexMap[local] = (int)(merge->vertices.count - 1);
+    }
+    return chunk->vertexMap[local];
+}
+
+static bool mergeTriangle (ObjMerge * merge, int a, int b, int c) {
+    if (merge->triangles.count >= INT32_MAX) return false;
+    Triangle * triangle = appendBlockElements (&merge->triangles, 1);
+    if (triangle == NULL) return false;
+    *triangle = createTriangle (a, b, c, merge->currentMaterial);
+    return true;
+}
 
 static int compareInts (const void * a, const void * b) {
     return *(const int *) a - *(const int *) b;
 }
 
-static void flushSphereGroup (Scene * scene, const Point * vertices,
-                              int * indices, int numIndices, int materialId) {
-    if (numIndices == 0 || materialId < 0) return;
+/* sphere detection */
+
+static bool flushSphereGroup (ObjMerge * merge) {
+    int * indices = merge->sphereVertices;
+    int numIndices = merge->numSphereVertices;
+    merge->numSphereVertices = 0;
+    if (numIndices == 0 || merge->sphereMaterial < 0) return true;
 
     qsort (indices, numIndices, sizeof (int), compareInts);
     int numUnique = 0;
@@ -139,9 +541,10 @@ static void flushSphereGroup (Scene * scene, const Point * vertices,
     int prev = -1;
     for (int i = 0; i < numIndices; ++ i) {
         if (indices[i] != prev) {
-            center.x += vertices[indices[i]].x;
-            center.y += vertices[indices[i]].y;
-            center.z += vertices[indices[i]].z;
+            Point vertex = getObjVertex (merge, indices[i]);
+            center.x += vertex.x;
+            center.y += vertex.y;
+            center.z += vertex.z;
             prev = indices[i];
         }
     }
@@ -153,158 +556,258 @@ static void flushSphereGroup (Scene * scene, const Point * vertices,
     prev = -1;
     for (int i = 0; i < numIndices; ++ i) {
         if (indices[i] != prev) {
-            radiusSum += vectorLength (getVector (center, vertices[indices[i]]));
+            radiusSum += vectorLength (getVector (center, getObjVertex (merge, indices[i])));
             prev = indices[i];
         }
     }
     double radius = radiusSum / numUnique;
 
     if (radius > 1e-6) {
-        addSphere (scene, createSphere (center, radius, materialId));
+        return addSphere (merge->scene, createSphere (center, radius, merge->sphereMaterial));
     }
+    return true;
 }
 
-/* OBJ loader */
+static bool mergeFace (ObjMerge * merge, const int * indices, int count, int vertexCount) {
+    if (!growArray ((void **) &merge->corners, &merge->cornersCapacity, count, sizeof (int), 16)) return false;
+    for (int i = 0; i < count; ++ i) {
+        long resolved = (indices[i] > 0) ? indices[i] - 1l : vertexCount + (long) indices[i];
+        if (resolved < 0 || resolved >= vertexCount) return true;
+        merge->corners[i] = (int) resolved;
+    }
 
-bool loadScene (Scene * scene, const char * objPath, const char * mtlPath) {
-    scene->boundingBox.min = (Point){1e20, 1e20, 1e20};
-    scene->boundingBox.max = (Point){-1e20, -1e20, -1e20};
+    if (merge->inSphere) {
+        if (!growArray ((void **) &merge->sphereVertices, &merge->sphereVerticesCapacity,
+                        merge->numSphereVertices + count, sizeof (int), 8192)) return false;
+        memcpy (merge->sphereVertices + merge->numSphereVertices, merge->corners, count * sizeof (int));
+        merge->numSphereVertices += count;
+    } else if (count >= 3 && merge->currentMaterial >= 0) {
+        int * corners = merge->corners;
+        for (int i = 0; i < count; ++ i) {
+            if ((corners[i] = getMeshVertex (merge, corners[i])) < 0) return false;
+        }
+        //fan around the first corner; a quad splits into 0 1 2 and 2 3 0 as it always has
+        if (!mergeTriangle (merge, corners[0], corners[1], corners[2])) return false;
+        for (int i = 2; i + 1 < count; ++ i) {
+            if (!mergeTriangle (merge, corners[i], corners[i + 1], corners[0])) return false;
+        }
+    }
+    return true;
+}
+
+static void copyName (const ObjRecord * record, char * out, size_t size) {
+    size_t length = record->count < (int) size - 1 ? (size_t) record->count : size - 1;
+    memcpy (out, record->name, length);
+    out[length] = '\0';
+}
 
-    char directory[512];
-    getDirectoryFromPath (objPath, directory, sizeof (directory));
+static bool mergeChunk (ObjMerge * merge, ObjChunk * chunk) {
+    chunk->vertexMap = malloc ((chunk->vertices.count > 0 ? chunk->vertices.count : 1) * sizeof (int));
+    if (chunk->vertexMap == NULL) return false;
+    for (size_t i = 0; i < chunk->vertices.count; ++ i) {
+        chunk->vertexMap[i] = -1;
+    }
 
-    FILE * file = fopen (objPath, "r");
-    if (!file) return false;
+    //strict comparisons keep the earlier of equal values, as one pass over the vertices would
+    BoundingBox * box = &merge->scene->boundingBox;
+    if (chunk->bounds.min.x < box->min.x) box->min.x = chunk->bounds.min.x;
+    if (chunk->bounds.min.y < box->min.y) box->min.y = chunk->bounds.min.y;
+    if (chunk->bounds.min.z < box->min.z) box->min.z = chunk->bounds.min.z;
+    if (chunk->bounds.max.x > box->max.x) box->max.x = chunk->bounds.max.x;
+    if (chunk->bounds.max.y > box->max.y) box->max.y = chunk->bounds.max.y;
+    if (chunk->bounds.max.z > box->max.z) box->max.z = chunk->bounds.max.z;
+
+    for (size_t i = 0; i < chunk->records.count; ++ i) {
+        const ObjRecord * record = getBlockElement (&chunk->records, i);
+        if (record->type == OBJ_RECORD_FACE) {
+            if (!mergeFace (merge, record->corners, record->count, chunk->vertexBase + record->localVertices)) return false;
+        } else if (record->type == OBJ_RECORD_GROUP) {
+            if (merge->inSphere && !flushSphereGroup (merge)) return false;
+            merge->numSphereVertices = 0;
+
+            char group[128];
+            copyName (record, group, sizeof (group));
+            merge->inSphere = containsIgnoreCase (group, "sphere");
+            if (merge->inSphere) merge->sphereMaterial = merge->currentMaterial;
+        } else if (record->type == OBJ_RECORD_USEMTL) {
+            char materialName[128];
+            copyName (record, materialName, sizeof (materialName));
+            int index = findParsedMaterialIndex (merge->parsed, merge->numParsed, materialName);
+            if (index >= 0) merge->currentMaterial = index;
+            if (merge->inSphere) merge->sphereMaterial = merge->currentMaterial;
+        }
+    }
+    return true;
+}
 
-    Point * vertices = NULL;
-    int numVertices = 0;
-    int verticesCapacity = 0;
+// parses the chunks a window at a time, merging each window and letting go of its records and file pages
+static bool mergeObjFile (ObjMerge * merge, MappedFile * file, ObjChunk * chunks, int numChunks, int numThreads) {
+    int windowSize = numThreads * OBJ_CHUNKS_PER_THREAD;
+    int vertexBase = 0;
+    for (int first = 0; first < numChunks; first += windowSize) {
+        int count = numChunks - first < windowSize ? numChunks - first : windowSize;
+        parallelFor (numThreads, count, parseObjChunk, chunks + first);
+
+        for (int i = first; i < first + count; ++ i) {
+            ObjChunk * chunk = &chunks[i];
+            if (chunk->failed || (size_t) vertexBase + chunk->vertices.count > INT32_MAX) return false;
+            chunk->vertexBase = vertexBase;
+            vertexBase += (int) chunk->vertices.count;
+            merge->numChunks = i + 1;
+            if (!mergeChunk (merge, chunk)) return false;
+            freeObjChunkRecords (chunk);
+        }
+        size_t begin = chunks[first].begin - file->data;
+        releaseMappedRange (file, begin, chunks[first + count - 1].end - chunks[first].begin);
+    }
 
-    ParsedMaterial parsed[MAX_PARSED_MATERIALS];
-    int numParsed = 0;
+    /* flush any sphere group stuff left */
+    if (merge->inSphere && !flushSphereGroup (merge)) return false;
+    return true;
+}
 
-    /* load MTL from path */
-    bool mtlLoaded = false;
-    if (mtlPath && mtlPath[0]) {
-        numParsed = loadAndConvertMaterials (scene, mtlPath, parsed, &numParsed);
-        mtlLoaded = true;
+// starts the staged mesh with whatever the scene already holds, so indices carry on from it
+static bool stageSceneMesh (ObjMerge * merge, const Scene * scene) {
+    initBlockArray (&merge->vertices, sizeof (Vertex));
+    initBlockArray (&merge->triangles, sizeof (Triangle));
+    for (int i = 0; i < scene->numVertices; ++ i) {
+        Vertex * vertex = appendBlockElements (&merge->vertices, 1);
+        if (vertex == NULL) return false;
+        *vertex = scene->vertices[i];
+    }
+    for (int i = 0; i < scene->numTriangles; ++ i) {
+        Triangle * triangle = appendBlockElements (&merge->triangles, 1);
+        if (triangle == NULL) return false;
+        *triangle = scene->triangles[i];
     }
+    return true;
+}
 
-    /* current parsing state */
-    int currentMaterial = 0;
-    char currentGroup[128] = "";
-    int inSphere = 0;
-    int sphereMaterial = -1;
-
-    int * sphereVertices = NULL;
-    int numSphereVertices = 0;
-    int sphereVerticesCapacity = 0;
-
-    char line[512];
-    while (fgets (line, sizeof (line), file)) {
-        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
-
-        /* mtllib to autoload MTL from OBJ directory */
-        if (!mtlLoaded && strncmp (line, "mtllib ", 7) == 0) {
-            char mtlName[256];
-            sscanf (line + 7, "%255s", mtlName);
-            char autoPath[768];
-            snprintf (autoPath, sizeof (autoPath), "%s%s", directory, mtlName);
-            numParsed = loadAndConvertMaterials (scene, autoPath, parsed, &numParsed);
-            mtlLoaded = true;
-        }
+// moves the staged mesh into the scene's arena, one exact allocation each
+static bool adoptMergedMesh (ObjMerge * merge, Scene * scene) {
+    size_t numVertices = merge->vertices.count;
+    size_t numTriangles = merge->triangles.count;
+    Vertex * vertices = arenaAlloc (&scene->arena, MEMORY_MESH, numVertices * sizeof (Vertex));
+    Triangle * triangles = arenaAlloc (&scene->arena, MEMORY_MESH, numTriangles * sizeof (Triangle));
+    if (vertices == NULL || triangles == NULL) return false;
+    moveBlockArray (&merge->vertices, vertices);
+    moveBlockArray (&merge->triangles, triangles);
+
+    //initScene's arrays stay behind in the arena, too small to matter
+    scene->vertices = vertices;
+    scene->numVertices = (int) numVertices;
+    scene->verticesCapacity = numVertices > 0 ? (int) numVertices : 1;
+    scene->triangles = triangles;
+    scene->numTriangles = (int) numTriangles;
+    scene->trianglesCapacity = numTriangles > 0 ? (int) numTriangles : 1;
+    return true;
+}
 
-        /* vertex */
-        else if (line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) {
-            Point vertex;
-            if (sscanf (line + 2, "%lf %lf %lf", &vertex.x, &vertex.y, &vertex.z) == 3) {
-                if (numVertices >= verticesCapacity) {
-                    verticesCapacity = verticesCapacity ? verticesCapacity * 2 : 4096;
-                    vertices = realloc (vertices, verticesCapacity * sizeof (Point));
-                }
-                vertices[numVertices ++] = vertex;
-
-                if (vertex.x < scene->boundingBox.min.x) scene->boundingBox.min.x = vertex.x;
-                if (vertex.y < scene->boundingBox.min.y) scene->boundingBox.min.y = vertex.y;
-                if (vertex.z < scene->boundingBox.min.z) scene->boundingBox.min.z = vertex.z;
-                if (vertex.x > scene->boundingBox.max.x) scene->boundingBox.max.x = vertex.x;
-                if (vertex.y > scene->boundingBox.max.y) scene->boundingBox.max.y = vertex.y;
-                if (vertex.z > scene->boundingBox.max.z) scene->boundingBox.max.z = vertex.z;
-            }
+static bool fileExists (const char * path) {
+    FILE * file = fopen (path, "rb");
+    if (file) fclose (file);
+    return file != NULL;
+}
+
+// the first mtllib line of the OBJ, resolved beside it
+static bool findMaterialLibrary (const char * objPath, const MappedFile * file, char * buffer, size_t size) {
+    const char * end = file->data + file->size;
+    for (const char * line = file->data; line < end; ) {
+        //only lines that mention it are tokenized, so an OBJ without one costs a memchr pass over the file
+        const char * match = memchr (line, 'm', end - line);
+        if (match == NULL) return false;
+        if (end - match < 6 || memcmp (match, "mtllib", 6) != 0) {
+            line = match + 1;
+            continue;
         }
+        while (match > file->data && match[-1] != '\n') -- match;
+        const char * lineEnd = findLineEnd (match, end);
+        const char * keyword = skipBlanks (match, lineEnd);
+        const char * p = skipToken (keyword, lineEnd);
+        line = lineEnd + 1;
+        if (!tokenEquals (keyword, p, "mtllib")) continue;
+
+        const char * name = skipBlanks (p, lineEnd);
+        int nameLength = (int)(skipToken (name, lineEnd) - name);
+        if (nameLength == 0) continue;
+        char directory[512];
+        getDirectoryFromPath (objPath, directory, sizeof (directory));
+        snprintf (buffer, size, "%s%.*s", directory, nameLength, name);
+        return true;
+    }
+    return false;
+}
 
-        /* group */
-        else if (line[0] == 'g' && (line[1] == ' ' || line[1] == '\t')) {
-            if (inSphere && numSphereVertices > 0) {
-                flushSphereGroup (scene, vertices, sphereVertices, numSphereVertices, sphereMaterial);
-            }
-            numSphereVertices = 0;
+static bool resolveMappedMaterialPath (const char * objPath, const MappedFile * file, const char * mtlPath, char * buffer, size_t size) {
+    if (mtlPath && mtlPath[0] && fileExists (mtlPath)) {
+        snprintf (buffer, size, "%s", mtlPath);
+        return true;
+    }
+    return findMaterialLibrary (objPath, file, buffer, size);
+}
 
-            sscanf (line + 2, "%127s", currentGroup);
-            inSphere = containsIgnoreCase (currentGroup, "sphere");
-            if (inSphere) sphereMaterial = currentMaterial;
-        }
+bool resolveMaterialPath (const char * objPath, const char * mtlPath, char * buffer, size_t size) {
+    MappedFile file;
+    if (!mapFile (objPath, true, &file)) return false;
+    bool found = resolveMappedMaterialPath (objPath, &file, mtlPath, buffer, size);
+    unmapFile (&file);
+    return found;
+}
 
-        /* matereial assignment */
-        else if (strncmp (line, "usemtl ", 7) == 0) {
-            char materialName[128];
-            sscanf (line + 7, "%127s", materialName);
-            int index = findParsedMaterialIndex (parsed, numParsed, materialName);
-            if (index >= 0) currentMaterial = index;
-            if (inSphere) sphereMaterial = currentMaterial;
-        }
+bool readSceneFile (Scene * scene, const char * objPath, const char * mtlPath, size_t * bytesRead) {
+    scene->boundingBox.min = (Point){1e20, 1e20, 1e20};
+    scene->boundingBox.max = (Point){-1e20, -1e20, -1e20};
+    if (bytesRead) *bytesRead = 0;
+
+    MappedFile file;
+    if (!mapFile (objPath, true, &file)) return false;
+    char materialPath[1024];
+    bool hasMaterials = resolveMappedMaterialPath (objPath, &file, mtlPath, materialPath, sizeof (materialPath));
+
+    int numThreads = scene->bvhSettings.numThreads > 0 ? scene->bvhSettings.numThreads : 1;
+    int maxChunks = (int) (file.size / OBJ_CHUNK_BYTES) + 1;
+    ObjChunk * chunks = malloc (maxChunks * sizeof (ObjChunk));
+    ObjMerge * merge = calloc (1, sizeof (ObjMerge));
+    if (!chunks || !merge) {
+        fprintf (stderr, "Out of memory reading %s\n", objPath);
+        free (chunks);
+        free (merge);
+        unmapFile (&file);
+        return false;
+    }
+    int numChunks = splitObjChunks (file.data, file.size, chunks);
 
-        /* face */
-        else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t')) {
-            int vertexIndices[8];
-            int count = 0;
-            const char * p = line + 2;
-
-            while (count < 8) {
-                while (*p == ' ' || *p == '\t') p ++;
-                if (!*p || *p == '\n' || *p == '\r') break;
-                int v = atoi (p);
-                if (v == 0) break;
-                vertexIndices[count ++] = (v > 0) ? v - 1 : numVertices + v;
-                while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p ++;
-            }
+    merge->scene = scene;
+    merge->chunks = chunks;
+    merge->sphereMaterial = -1;
+    bool ok = stageSceneMesh (merge, scene);
 
-            if (inSphere) {
-                for (int i = 0; i < count; ++ i) {
-                    if (numSphereVertices >= sphereVerticesCapacity) {
-                        sphereVerticesCapacity = sphereVerticesCapacity ? sphereVerticesCapacity * 2 : 8192;
-                        sphereVertices = realloc (sphereVertices, sphereVerticesCapacity * sizeof (int));
-                    }
-                    sphereVertices[numSphereVertices ++] = vertexIndices[i];
-                }
-            } else if (count >= 3 && currentMaterial >= 0) {
-                addTriangle (scene, createTriangle (
-                    vertices[vertexIndices[0]],
-                    vertices[vertexIndices[1]],
-                    vertices[vertexIndices[2]],
-                    currentMaterial));
-                if (count >= 4) {
-                    addTriangle (scene, createTriangle (
-                        vertices[vertexIndices[2]],
-                        vertices[vertexIndices[3]],
-                        vertices[vertexIndices[0]],
-                        currentMaterial));
-                }
-            }
-        }
+    //materials come first, so usemtl finds them wherever the OBJ names its library
+    if (ok && hasMaterials) {
+        ok = loadAndConvertMaterials (scene, materialPath, merge->parsed, &merge->numParsed);
     }
 
-    /* flush any sphere group stuff left */
-    if (inSphere && numSphereVertices > 0) {
-        flushSphereGroup (scene, vertices, sphereVertices, numSphereVertices, sphereMaterial);
+    ok = ok && mergeObjFile (merge, &file, chunks, numChunks, numThreads) && adoptMergedMesh (merge, scene);
+    if (!ok) fprintf (stderr, "Out of memory reading %s\n", objPath);
+    if (bytesRead) *bytesRead = file.size;
+
+    for (int i = 0; i < numChunks; ++ i) {
+        freeObjChunk (&chunks[i]);
     }
+    free (chunks);
+    unmapFile (&file);
+    freeBlockArray (&merge->vertices);
+    freeBlockArray (&merge->triangles);
+    free (merge->corners);
+    free (merge->sphereVertices);
+    free (merge);
+    return ok;
+}
 
-    fclose (file);
-    free (vertices);
-    free (sphereVertices);
+bool loadScene (Scene * scene, const char * objPath, const char * mtlPath) {
+    if (!readSceneFile (scene, objPath, mtlPath, NULL)) return false;
 
-    detectLight (scene);
-    createBVH (scene);
+    if (!buildLights (scene) || !createBVH (scene) || !createWideBVH (scene)) return false;
 
     return (scene->numTriangles > 0 || scene->numSpheres > 0);
-}
+}
\ No newline at end of file
@@ -4,7 +4,12 @@
 #include "geometry.h"
 #include "bvh.h"
 #include <stdbool.h>
+#include <stddef.h>
 
+// triangles, spheres and materials only, without lights or acceleration structures; bytesRead may be NULL
+bool readSceneFile (Scene * scene, const char * objPath, const char * mtlPath, size_t * bytesRead);
 bool loadScene (Scene * scene, const char * objPath, const char * mtlPath);
+// the MTL a load reads: mtlPath when that file exists, otherwise the OBJ's first mtllib; false when neither gives one
+bool resolveMaterialPath (const char * objPath, const char * mtlPath, char * buffer, size_t size);
 
 #endif
@@ -0,0 +1,190 @@
+#include "threadPool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* work stealing scheduler
+ * every worker owns a contiguous block of items packed as [begin, end) into one atomic word.
+ * the owner pops from the back, thieves take from the front, and both sides claim an item
+ * with a single compare and swap so no locks are needed. items are never pushed after start,
+ * so a worker can stop once every queue is empty. */
+
+typedef struct {
+    _Atomic uint64_t range;
+    char padding[56]; //keeps each queue on its own cache line
+} WorkQueue;
+
+/* persistent pool
+ * helper threads are started the first time a call wants them and then sleep between calls. a call
+ * publishes itself as an open job; sleeping helpers wake, take one of its thread slots each, and work
+ * it alongside the caller, which always holds slot 0 and waits for its helpers before returning.
+ * a task may call parallelFor itself (the bvh build does): the inner call is a job of its own that
+ * whichever helpers are idle join, and that its caller finishes alone when none are. */
+
+typedef struct Scheduler {
+    WorkQueue * queues;
+    int numThreads;
+    ParallelTask task;
+    void * context;
+    int nextSlot; // slots handed out so far; the pool lock guards this and the two below
+    int numHelpers; // helpers that took a slot and haven't finished with it
+    struct Scheduler * next; // in the pool's list of open jobs
+} Scheduler;
+
+typedef struct {
+    Scheduler * scheduler;
+    int threadIndex;
+} Worker;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t jobPosted; // helpers sleep on this between jobs
+    pthread_cond_t helperDone; // callers wait on this for their helpers to finish
+    Scheduler * openJobs; // jobs with slots left, newest first
+    int numHelpers;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0};
+
+static inline uint64_t packRange (uint32_t begin, uint32_t end) {
+    return ((uint64_t)begin << 32) | end;
+}
+
+static int popBack (WorkQueue * queue) {
+    uint64_t range = atomic_load (&queue->range);
+    for (;;) {
+        uint32_t begin = (uint32_t)(range >> 32);
+        uint32_t end = (uint32_t)range;
+        if (begin >= end) return -1;
+        if (atomic_compare_exchange_weak (&queue->range, &range, packRange (begin, end - 1))) {
+            return (int)(end - 1);
+        }
+    }
+}
+
+static int popFront (WorkQueue * queue) {
+    uint64_t range = atomic_load (&queue->range);
+    for (;;) {
+        uint32_t begin = (uint32_t)(range >> 32);
+        uint32_t end = (uint32_t)range;
+        if (begin >= end) return -1;
+        if (atomic_compare_exchange_weak (&queue->range, &range, packRange (begin + 1, end))) {
+            return (int)begin;
+        }
+    }
+}
+
+static int stealItem (Scheduler * scheduler, int threadIndex) {
+    for (int offset = 1; offset < scheduler->numThreads; ++ offset) {
+        int victim = (threadIndex + offset) % scheduler->numThreads;
+        int item = popFront (&scheduler->queues[victim]);
+        if (item >= 0) return item;
+    }
+    return -1;
+}
+
+static void runWorker (Worker * worker) {
+    Scheduler * scheduler = worker->scheduler;
+
+    for (;;) {
+        int item = popBack (&scheduler->queues[worker->threadIndex]);
+        if (item < 0) item = stealItem (scheduler, worker->threadIndex);
+        if (item < 0) break;
+        scheduler->task (scheduler->context, item, worker->threadIndex);
+    }
+}
+
+static void closeJob (Scheduler * scheduler) {
+    for (Scheduler ** link = &pool.openJobs; *link; link = &(*link)->next) {
+        if (*link == scheduler) {
+            *link = scheduler->next;
+            return;
+        }
+    }
+}
+
+static void * runHelper (void * data) {
+    pthread_mutex_lock (&pool.lock);
+    for (;;) {
+        Scheduler * scheduler = pool.openJobs;
+        if (scheduler == NULL) {
+            pthread_cond_wait (&pool.jobPosted, &pool.lock);
+            continue;
+        }
+        Worker worker = {scheduler, scheduler->nextSlot ++};
+        if (scheduler->nextSlot == scheduler->numThreads) closeJob (scheduler);
+        scheduler->numHelpers ++;
+        pthread_mutex_unlock (&pool.lock);
+
+        runWorker (&worker);
+
+        pthread_mutex_lock (&pool.lock);
+        if (-- scheduler->numHelpers == 0) pthread_cond_broadcast (&pool.helperDone);
+    }
+    return NULL;
+}
+
+// starts helpers until the pool has count of them, or as many as the system allows; call with the lock held
+static void growPool (int count) {
+    if (count > THREAD_POOL_MAX_THREADS - 1) count = THREAD_POOL_MAX_THREADS - 1;
+    while (pool.numHelpers < count) {
+        pthread_t thread;
+        if (pthread_create (&thread, NULL, runHelper, NULL) != 0) break;
+        pthread_detach (thread);
+        pool.numHelpers ++;
+    }
+}
+
+int getProcessorCount () {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo (&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long count = sysconf (_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int) count : 1;
+#endif
+}
+
+void parallelFor (int numThreads, int numItems, ParallelTask task, void * context) {
+    if (numItems <= 0) return;
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > THREAD_POOL_MAX_THREADS) numThreads = THREAD_POOL_MAX_THREADS;
+    if (numThreads > numItems) numThreads = numItems;
+
+    WorkQueue queues[numThreads];
+    Scheduler scheduler = {queues, numThreads, task, context, 1, 0, NULL};
+
+    //neighbouring items (e.g. adjacent tiles) start on the same worker
+    for (int i = 0; i < numThreads; ++ i) {
+        uint32_t begin = (uint32_t)((int64_t)numItems * i / numThreads);
+        uint32_t end = (uint32_t)((int64_t)numItems * (i + 1) / numThreads);
+        atomic_init (&queues[i].range, packRange (begin, end));
+    }
+
+    if (numThreads > 1) {
+        pthread_mutex_lock (&pool.lock);
+        growPool (numThreads - 1);
+        scheduler.next = pool.openJobs;
+        pool.openJobs = &scheduler;
+        pthread_cond_broadcast (&pool.jobPosted);
+        pthread_mutex_unlock (&pool.lock);
+    }
+
+    //the calling thread is worker 0, and runs every item no helper got to
+    Worker caller = {&scheduler, 0};
+    runWorker (&caller);
+
+    if (numThreads > 1) {
+        pthread_mutex_lock (&pool.lock);
+        closeJob (&scheduler);
+        while (scheduler.numHelpers > 0) {
+            pthread_cond_wait (&pool.helperDone, &pool.lock);
+        }
+        pthread_mutex_unlock (&pool.lock);
+    }
+}
\ No newline at end of file
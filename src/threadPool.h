@@ -0,0 +1,13 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#define THREAD_POOL_MAX_THREADS 256 // threads one parallelFor runs on at most, the caller included
+
+typedef void (* ParallelTask) (void * context, int itemIndex, int threadIndex);
+
+int getProcessorCount ();
+// runs task on every item using up to numThreads threads from a pool that lives as long as the process;
+// threadIndex is below numThreads and unique among the calls running at once for this loop
+void parallelFor (int numThreads, int numItems, ParallelTask task, void * context);
+
+#endif
\ No newline at end of file
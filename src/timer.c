@@ -0,0 +1,21 @@
+#include "timer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+double getTimeSeconds () {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+}
+#else
+#include <time.h>
+
+double getTimeSeconds () {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+#endif
\ No newline at end of file
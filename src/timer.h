@@ -0,0 +1,6 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+double getTimeSeconds ();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,559 @@
+#include "wavefront.h"
+#include "threadPool.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* wavefront path tracing
+ * instead of following each path to its end before starting the next, a batch of paths moves
+ * through the bounces together, one stage at a time over the whole batch:
+ *   generate   a camera ray for every (pixel, sample) of the batch
+ *   intersect  every live ray, in ray packets
+ *   sort       the hits by material type, incoming direction octant and a morton code of the hit
+ *              point, dropping the paths that missed or ended
+ *   shade      adds emission, queues shadow rays at diffuse vertices and samples the next bounce
+ *   shadow     traces the queued shadow rays and adds what they see
+ * sorting doubles as compaction, so every stage walks only live paths, and neighbours in the
+ * queue run the same material code and traverse the same part of the BVH. the maths of a
+ * vertex is the path tracer's own, so both engines estimate the same image. */
+
+#define MORTON_BITS 3 // per axis; a batch of a few thousand paths leaves finer cells nearly empty
+#define SORT_KEY_BITS (5 + 3 * MORTON_BITS)
+#define SORT_DEAD_KEY ((1u << SORT_KEY_BITS) - 1)
+
+typedef struct {
+    double * x;
+    double * y;
+    double * z;
+} VectorArray;
+
+// one slot per live path, every field its own array
+typedef struct {
+    int * path; // index into the batch
+    VectorArray origin;
+    VectorArray direction;
+    VectorArray throughput;
+    double * bouncePdf;
+    int * depth;
+    Seed * seeds;
+    unsigned char * alive;
+
+    //filled by the intersect stage
+    double * distance;
+    VectorArray point;
+    VectorArray normal;
+    int * material;
+    int * primitive;
+} PathQueue;
+
+// lightSamples slots per path queue slot; a negative maxDistance marks an empty one
+typedef struct {
+    VectorArray origin;
+    VectorArray direction;
+    double * maxDistance;
+    VectorArray contribution; // throughput already applied
+} ShadowQueue;
+
+typedef struct {
+    double intersect;
+    double sort;
+    double shade;
+    double shadow;
+    long long vertices;
+    long long shadowRays;
+} WavefrontStats;
+
+typedef struct {
+    Scene * scene;
+    Camera * cam;
+    const RenderSettings * settings;
+
+    PathQueue queues[2]; // the sort gathers from one into the other
+    int current;
+    int count;
+    ShadowQueue shadow;
+
+    //per batch path, in generation order so the film receives them in a fixed order
+    long long batchStart;
+    int batchSize;
+    double * filmX;
+    double * filmY;
+    Vector * radiance;
+
+    uint32_t * keys;
+    int * order;
+    uint32_t * sortKeys;
+    int * sortOrder;
+    Point sceneMin;
+    Vector mortonScale;
+    WavefrontStats stats;
+} WavefrontJob;
+
+static inline Vector loadVector (const VectorArray * array, int index) {
+    return (Vector){array->x[index], array->y[index], array->z[index]};
+}
+
+static inline Point loadPoint (const VectorArray * array, int index) {
+    return (Point){array->x[index], array->y[index], array->z[index]};
+}
+
+static inline void storeVector (VectorArray * array, int index, double x, double y, double z) {
+    array->x[index] = x;
+    array->y[index] = y;
+    array->z[index] = z;
+}
+
+static void allocVectorArray (VectorArray * array, size_t count) {
+    array->x = malloc (count * sizeof(double));
+    array->y = malloc (count * sizeof(double));
+    array->z = malloc (count * sizeof(double));
+}
+
+static void freeVectorArray (VectorArray * array) {
+    free (array->x);
+    free (array->y);
+    free (array->z);
+}
+
+static void initPathQueue (PathQueue * queue, int capacity) {
+    queue->path = malloc (capacity * sizeof(int));
+    allocVectorArray (&queue->origin, capacity);
+    allocVectorArray (&queue->direction, capacity);
+    allocVectorArray (&queue->throughput, capacity);
+    queue->bouncePdf = malloc (capacity * sizeof(double));
+    queue->depth = malloc (capacity * sizeof(int));
+    queue->seeds = malloc (capacity * sizeof(Seed));
+    queue->alive = malloc (capacity);
+    queue->distance = malloc (capacity * sizeof(double));
+    allocVectorArray (&queue->point, capacity);
+    allocVectorArray (&queue->normal, capacity);
+    queue->material = malloc (capacity * sizeof(int));
+    queue->primitive = malloc (capacity * sizeof(int));
+}
+
+static void freePathQueue (PathQueue * queue) {
+    free (queue->path);
+    freeVectorArray (&queue->origin);
+    freeVectorArray (&queue->direction);
+    freeVectorArray (&queue->throughput);
+    free (queue->bouncePdf);
+    free (queue->depth);
+    free (queue->seeds);
+    free (queue->alive);
+    free (queue->distance);
+    freeVectorArray (&queue->point);
+    freeVectorArray (&queue->normal);
+    free (queue->material);
+    free (queue->primitive);
+}
+
+static inline void getChunk (int itemIndex, int count, int * start, int * end) {
+    *start = itemIndex * WAVEFRONT_CHUNK_SIZE;
+    *end = *start + WAVEFRONT_CHUNK_SIZE < count ? *start + WAVEFRONT_CHUNK_SIZE : count;
+}
+
+static inline int getNumChunks (int count) {
+    return (count + WAVEFRONT_CHUNK_SIZE - 1) / WAVEFRONT_CHUNK_SIZE;
+}
+
+static void generatePaths (void * context, int itemIndex, int threadIndex) {
+    WavefrontJob * job = (WavefrontJob *) context;
+    const RenderSettings * settings = job->settings;
+    PathQueue * queue = &job->queues[job->current];
+    long long numPixels = (long long)settings->width * settings->height;
+
+    int start, end;
+    getChunk (itemIndex, job->batchSize, &start, &end);
+    for (int i = start; i < end; ++ i) {
+        //paths run sample by sample over the image in scanline order; each has its own stream
+        long long index = job->batchStart + i;
+        long long pixel = index % numPixels;
+        Seed seed;
+        initSeed (&seed, settings->seed ^ ((uint64_t)(index + 1) * 0x9E3779B97F4A7C15ULL));
+        Sampler sampler = createIndependentSampler (seed);
+
+        double jitterX = (double)(pixel % settings->width) + (nextSample(&sampler) - 0.5);
+        double jitterY = (double)(pixel / settings->width) + (nextSample(&sampler) - 0.5);
+        //getCameraRay aims at px + 0.5, which is where the sample sits on the film
+        job->filmX[i] = jitterX + 0.5;
+        job->filmY[i] = jitterY + 0.5;
+        job->radiance[i] = (Vector){0, 0, 0};
+        Ray ray = getCameraRay (job->cam, jitterX, jitterY);
+
+        queue->path[i] = i;
+        storeVector (&queue->origin, i, ray.origin.x, ray.origin.y, ray.origin.z);
+        storeVector (&queue->direction, i, ray.vector.x, ray.vector.y, ray.vector.z);
+        storeVector (&queue->throughput, i, 1, 1, 1);
+        queue->bouncePdf[i] = 0;
+        queue->depth[i] = 0;
+        queue->seeds[i] = sampler.seed;
+        queue->alive[i] = 1;
+    }
+}
+
+static void intersectPaths (void * context, int itemIndex, int threadIndex) {
+    WavefrontJob * job = (WavefrontJob *) context;
+    PathQueue * queue = &job->queues[job->current];
+
+    int start, end;
+    getChunk (itemIndex, job->count, &start, &end);
+
+    Ray rays [WAVEFRONT_CHUNK_SIZE];
+    HitRecord hits [WAVEFRONT_CHUNK_SIZE];
+    bool didHit [WAVEFRONT_CHUNK_SIZE];
+    int slots [WAVEFRONT_CHUNK_SIZE];
+    int numRays = 0;
+
+    for (int i = start; i < end; ++ i) {
+        if (!queue->alive[i]) continue;
+        rays[numRays].origin = loadPoint (&queue->origin, i);
+        rays[numRays].vector = loadVector (&queue->direction, i);
+        slots[numRays ++] = i;
+    }
+    if (numRays == 0) return;
+
+    if (job->settings->primaryPackets) {
+        getScenePacketHits (job->scene, rays, numRays, hits, didHit);
+    } else {
+        for (int i = 0; i < numRays; ++ i) {
+            didHit[i] = getSceneHit (job->scene, rays[i], &hits[i]);
+        }
+    }
+
+    for (int i = 0; i < numRays; ++ i) {
+        int slot = slots[i];
+        queue->alive[slot] = didHit[i];
+        if (!didHit[i]) continue;
+        queue->distance[slot] = hits[i].distance;
+        storeVector (&queue->point, slot, hits[i].intersection.x, hits[i].intersection.y, hits[i].intersection.z);
+        storeVector (&queue->normal, slot, hits[i].normal.x, hits[i].normal.y, hits[i].normal.z);
+        queue->material[slot] = hits[i].materialId;
+        queue->primitive[slot] = hits[i].primitive;
+    }
+}
+
+static inline uint32_t spreadBits (uint32_t value) {
+    //spaces the low MORTON_BITS bits two apart for interleaving
+    value &= 0x3FF;
+    value = (value | (value << 16)) & 0x030000FF;
+    value = (value | (value << 8)) & 0x0300F00F;
+    value = (value | (value << 4)) & 0x030C30C3;
+    value = (value | (value << 2)) & 0x09249249;
+    return value;
+}
+
+static inline uint32_t quantize (double value, double min, double scale) {
+    double cell = (value - min) * scale;
+    if (cell <= 0) return 0;
+    if (cell >= (1 << MORTON_BITS) - 1) return (1 << MORTON_BITS) - 1;
+    return (uint32_t) cell;
+}
+
+static void computeSortKeys (void * context, int itemIndex, int threadIndex) {
+    WavefrontJob * job = (WavefrontJob *) context;
+    PathQueue * queue = &job->queues[job->current];
+
+    int start, end;
+    getChunk (itemIndex, job->count, &start, &end);
+    for (int i = start; i < end; ++ i) {
+        job->order[i] = i;
+        if (!queue->alive[i]) {
+            job->keys[i] = SORT_DEAD_KEY;
+            continue;
+        }
+
+        //material type on top, then the octant of the incoming direction, then where the hit lies
+        uint32_t type = job->scene->materials[queue->material[i]].type;
+        uint32_t octant = (queue->direction.x[i] < 0) | ((queue->direction.y[i] < 0) << 1) | ((queue->direction.z[i] < 0) << 2);
+        uint32_t morton = spreadBits (quantize (queue->point.x[i], job->sceneMin.x, job->mortonScale.x))
+                        | (spreadBits (quantize (queue->point.y[i], job->sceneMin.y, job->mortonScale.y)) << 1)
+                        | (spreadBits (quantize (queue->point.z[i], job->sceneMin.z, job->mortonScale.z)) << 2);
+        job->keys[i] = (type << (SORT_KEY_BITS - 2)) | (octant << (3 * MORTON_BITS)) | morton;
+    }
+}
+
+static void radixSortKeys (WavefrontJob * job) {
+    //least significant byte first; a byte every key shares is skipped
+    uint32_t * keys = job->keys;
+    int * order = job->order;
+    uint32_t * tempKeys = job->sortKeys;
+    int * tempOrder = job->sortOrder;
+    int count = job->count;
+
+    for (int shift = 0; shift < SORT_KEY_BITS; shift += 8) {
+        int offsets[257] = {0};
+        for (int i = 0; i < count; ++ i) {
+            offsets[((keys[i] >> shift) & 0xFF) + 1] ++;
+        }
+        bool sorted = false;
+        for (int bucket = 0; bucket < 256; ++ bucket) {
+            if (offsets[bucket + 1] == count) sorted = true;
+            offsets[bucket + 1] += offsets[bucket];
+        }
+        if (sorted) continue;
+
+        for (int i = 0; i < count; ++ i) {
+            int slot = offsets[(keys[i] >> shift) & 0xFF] ++;
+            tempKeys[slot] = keys[i];
+            tempOrder[slot] = order[i];
+        }
+        uint32_t * swapKeys = keys; keys = tempKeys; tempKeys = swapKeys;
+        int * swapOrder = order; order = tempOrder; tempOrder = swapOrder;
+    }
+
+    job->keys = keys;
+    job->order = order;
+    job->sortKeys = tempKeys;
+    job->sortOrder = tempOrder;
+}
+
+static inline void gatherVector (VectorArray * destination, const VectorArray * source, int to, int from) {
+    destination->x[to] = source->x[from];
+    destination->y[to] = source->y[from];
+    destination->z[to] = source->z[from];
+}
+
+static void gatherPaths (void * context, int itemIndex, int threadIndex) {
+    WavefrontJob * job = (WavefrontJob *) context;
+    const PathQueue * source = &job->queues[job->current];
+    PathQueue * destination = &job->queues[1 - job->current];
+
+    int start, end;
+    getChunk (itemIndex, job->count, &start, &end);
+    for (int i = start; i < end; ++ i) {
+        int from = job->order[i];
+        destination->path[i] = source->path[from];
+        gatherVector (&destination->origin, &source->origin, i, from);
+        gatherVector (&destination->direction, &source->direction, i, from);
+        gatherVector (&destination->throughput, &source->throughput, i, from);
+        destination->bouncePdf[i] = source->bouncePdf[from];
+        destination->depth[i] = source->depth[from];
+        destination->seeds[i] = source->seeds[from];
+        destination->alive[i] = 1;
+        destination->distance[i] = source->distance[from];
+        gatherVector (&destination->point, &source->point, i, from);
+        gatherVector (&destination->normal, &source->normal, i, from);
+        destination->material[i] = source->material[from];
+        destination->primitive[i] = source->primitive[from];
+    }
+}
+
+static void sortPaths (WavefrontJob * job) {
+    int numChunks = getNumChunks (job->count);
+    parallelFor (job->settings->numThreads, numChunks, computeSortKeys, job);
+    radixSortKeys (job);
+
+    //dead paths carry the largest key, so the live ones are a prefix of the sorted order
+    int live = job->count;
+    while (live > 0 && job->keys[live - 1] == SORT_DEAD_KEY) -- live;
+    job->count = live;
+
+    parallelFor (job->settings->numThreads, getNumChunks (live), gatherPaths, job);
+    job->current = 1 - job->current;
+}
+
+static void shadePaths (void * context, int itemIndex, int threadIndex) {
+    WavefrontJob * job = (WavefrontJob *) context;
+    Scene * scene = job->scene;
+    const PathSettings * settings = &job->settings->path;
+    PathQueue * queue = &job->queues[job->current];
+    ShadowQueue * shadow = &job->shadow;
+    bool useLights = scene->numLights > 0 && settings->lightSamples > 0;
+    int numShadowSlots = useLights ? settings->lightSamples : 0;
+
+    int start, end;
+    getChunk (itemIndex, job->count, &start, &end);
+    for (int i = start; i < end; ++ i) {
+        Sampler sampler = createIndependentSampler (queue->seeds[i]);
+        Vector * radiance = &job->radiance[queue->path[i]];
+        Vector throughput = loadVector (&queue->throughput, i);
+        Vector direction = loadVector (&queue->direction, i);
+
+        HitRecord hit;
+        hit.distance = queue->distance[i];
+        hit.intersection = loadPoint (&queue->point, i);
+        hit.normal = loadVector (&queue->normal, i);
+        hit.materialId = queue->material[i];
+        hit.primitive = queue->primitive[i];
+        const Material * mat = &scene->materials[hit.materialId];
+
+        //the ray's origin is where the bounce that produced it left from
+        Vector emitted = getEmittedRadiance (scene, settings, &hit, direction, loadPoint (&queue->origin, i), queue->bouncePdf[i]);
+        *radiance = addVector (*radiance, multiplyVector (throughput, emitted));
+
+        Vector facingNormal = (mat->type == MATERIAL_GLASS) ? hit.normal : getFacingNormal (hit.normal, direction);
+
+        for (int k = 0; k < numShadowSlots; ++ k) {
+            int slot = i * numShadowSlots + k;
+            shadow->maxDistance[slot] = -1;
+            if (mat->type != MATERIAL_DIFFUSE) continue;
+
+            Point origin = movePoint (hit.intersection, scaleVector (facingNormal, RAY_EPSILON));
+            Ray shadowRay;
+            double maxDistance;
+            Vector contribution;
+            if (!sampleLightRay (scene, settings, &origin, facingNormal, mat, &sampler, &shadowRay, &maxDistance, &contribution)) continue;
+
+            contribution = multiplyVector (throughput, contribution);
+            storeVector (&shadow->origin, slot, shadowRay.origin.x, shadowRay.origin.y, shadowRay.origin.z);
+            storeVector (&shadow->direction, slot, shadowRay.vector.x, shadowRay.vector.y, shadowRay.vector.z);
+            storeVector (&shadow->contribution, slot, contribution.x, contribution.y, contribution.z);
+            shadow->maxDistance[slot] = maxDistance;
+        }
+
+        int depth = queue->depth[i];
+        queue->alive[i] = 0;
+        if (depth + 1 < settings->maxDepth) {
+            throughput = multiplyVector (throughput, mat->color);
+            if (applyRoulette (settings, depth, &throughput, &sampler)) {
+                Ray scattered;
+                double pdf;
+                sampleBsdf (mat, &direction, &hit, facingNormal, &sampler, &scattered, &pdf);
+                storeVector (&queue->origin, i, scattered.origin.x, scattered.origin.y, scattered.origin.z);
+                storeVector (&queue->direction, i, scattered.vector.x, scattered.vector.y, scattered.vector.z);
+                storeVector (&queue->throughput, i, throughput.x, throughput.y, throughput.z);
+                queue->bouncePdf[i] = pdf;
+                queue->depth[i] = depth + 1;
+                queue->alive[i] = 1;
+            }
+        }
+        queue->seeds[i] = sampler.seed;
+    }
+}
+
+static void traceShadowRays (void * context, int itemIndex, int threadIndex) {
+    WavefrontJob * job = (WavefrontJob *) context;
+    PathQueue * queue = &job->queues[job->current];
+    ShadowQueue * shadow = &job->shadow;
+    int numShadowSlots = job->settings->path.lightSamples;
+
+    //a chunk owns its paths' slots and radiance, so no two tasks add to the same path
+    int start, end;
+    getChunk (itemIndex, job->count, &start, &end);
+    for (int slot = start * numShadowSlots; slot < end * numShadowSlots; ++ slot) {
+        if (shadow->maxDistance[slot] < 0) continue;
+
+        Ray shadowRay = {loadPoint (&shadow->origin, slot), loadVector (&shadow->direction, slot)};
+        if (getSceneOcclusion (job->scene, shadowRay, shadow->maxDistance[slot])) continue;
+
+        Vector * radiance = &job->radiance[queue->path[slot / numShadowSlots]];
+        *radiance = addVector (*radiance, loadVector (&shadow->contribution, slot));
+    }
+}
+
+static void countShadowRays (WavefrontJob * job) {
+    int numSlots = job->count * job->settings->path.lightSamples;
+    for (int slot = 0; slot < numSlots; ++ slot) {
+        job->stats.shadowRays += job->shadow.maxDistance[slot] >= 0;
+    }
+}
+
+static void runBatch (WavefrontJob * job) {
+    const RenderSettings * settings = job->settings;
+    bool useLights = job->scene->numLights > 0 && settings->path.lightSamples > 0;
+
+    job->current = 0;
+    job->count = job->batchSize;
+    parallelFor (settings->numThreads, getNumChunks (job->count), generatePaths, job);
+
+    //each stage is its own parallelFor; the pool's threads persist across them, so a stage's time
+    //is its work plus one wake-up rather than a round of thread creation
+    while (job->count > 0) {
+        double start = getTimeSeconds ();
+        parallelFor (settings->numThreads, getNumChunks (job->count), intersectPaths, job);
+        double intersected = getTimeSeconds ();
+        sortPaths (job);
+        double sorted = getTimeSeconds ();
+        if (job->count == 0) break;
+
+        job->stats.vertices += job->count;
+        parallelFor (settings->numThreads, getNumChunks (job->count), shadePaths, job);
+        double shaded = getTimeSeconds ();
+        if (useLights) {
+            countShadowRays (job);
+            parallelFor (settings->numThreads, getNumChunks (job->count), traceShadowRays, job);
+        }
+        double traced = getTimeSeconds ();
+
+        job->stats.intersect += intersected - start;
+        job->stats.sort += sorted - intersected;
+        job->stats.shade += shaded - sorted;
+        job->stats.shadow += traced - shaded;
+    }
+}
+
+Film * renderWavefront (Scene * scene, Camera * cam, const RenderSettings * settings) {
+    Film * film = createFilm (settings->width, settings->height, settings->filter);
+
+    WavefrontJob job;
+    memset (&job, 0, sizeof(job));
+    job.scene = scene;
+    job.cam = cam;
+    job.settings = settings;
+
+    long long totalPaths = (long long)settings->width * settings->height * settings->samplesPerPixel;
+    int capacity = settings->wavefrontSize > 0 ? settings->wavefrontSize : WAVEFRONT_PATHS_PER_THREAD * settings->numThreads;
+    if (capacity > totalPaths) capacity = (int) totalPaths;
+    if (capacity < 1) capacity = 1;
+
+    initPathQueue (&job.queues[0], capacity);
+    initPathQueue (&job.queues[1], capacity);
+    size_t numShadowSlots = (size_t)capacity * (settings->path.lightSamples > 0 ? settings->path.lightSamples : 0);
+    allocVectorArray (&job.shadow.origin, numShadowSlots);
+    allocVectorArray (&job.shadow.direction, numShadowSlots);
+    allocVectorArray (&job.shadow.contribution, numShadowSlots);
+    job.shadow.maxDistance = malloc (numShadowSlots * sizeof(double));
+    job.filmX = malloc (capacity * sizeof(double));
+    job.filmY = malloc (capacity * sizeof(double));
+    job.radiance = malloc (capacity * sizeof(Vector));
+    job.keys = malloc (capacity * sizeof(uint32_t));
+    job.order = malloc (capacity * sizeof(int));
+    job.sortKeys = malloc (capacity * sizeof(uint32_t));
+    job.sortOrder = malloc (capacity * sizeof(int));
+
+    //the morton grid spans the mesh bounds; spheres outside them clamp to the border cells
+    job.sceneMin = scene->boundingBox.min;
+    Point sceneMax = scene->boundingBox.max;
+    double cells = (1 << MORTON_BITS) - 1;
+    job.mortonScale.x = sceneMax.x > job.sceneMin.x ? cells / (sceneMax.x - job.sceneMin.x) : 0;
+    job.mortonScale.y = sceneMax.y > job.sceneMin.y ? cells / (sceneMax.y - job.sceneMin.y) : 0;
+    job.mortonScale.z = sceneMax.z > job.sceneMin.z ? cells / (sceneMax.z - job.sceneMin.z) : 0;
+
+    long long numBatches = (totalPaths + capacity - 1) / capacity;
+    for (long long batch = 0; batch < numBatches; ++ batch) {
+        job.batchStart = batch * capacity;
+        job.batchSize = (int) (totalPaths - job.batchStart < capacity ? totalPaths - job.batchStart : capacity);
+        runBatch (&job);
+
+        //splatting in generation order keeps the image independent of the thread count
+        for (int i = 0; i < job.batchSize; ++ i) {
+            splatFilmSample (film, job.filmX[i], job.filmY[i], job.radiance[i], 1.0);
+        }
+
+        long long step = numBatches / 100 > 0 ? numBatches / 100 : 1;
+        if ((batch + 1) % step == 0 || batch + 1 == numBatches) {
+            fprintf(stderr, "\033[1A\033[2K%.3f percent of the way there\n", ((double)(batch + 1))/numBatches * 100);
+        }
+    }
+
+    fprintf (stderr, "Wavefront: %lld batches of %d paths, %lld vertices, %lld shadow rays\n",
+             numBatches, capacity, job.stats.vertices, job.stats.shadowRays);
+    fprintf (stderr, "Wavefront stages: intersect %.3fs, sort %.3fs, shade %.3fs, shadow %.3fs\n",
+             job.stats.intersect, job.stats.sort, job.stats.shade, job.stats.shadow);
+
+    freePathQueue (&job.queues[0]);
+    freePathQueue (&job.queues[1]);
+    freeVectorArray (&job.shadow.origin);
+    freeVectorArray (&job.shadow.direction);
+    freeVectorArray (&job.shadow.contribution);
+    free (job.shadow.maxDistance);
+    free (job.filmX);
+    free (job.filmY);
+    free (job.radiance);
+    free (job.keys);
+    free (job.order);
+    free (job.sortKeys);
+    free (job.sortOrder);
+    return film;
+}
\ No newline at end of file
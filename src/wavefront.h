@@ -0,0 +1,9 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "renderer.h"
+
+// the path integrator run a stage at a time over large batches of paths, rather than one path per sample to the end
+Film * renderWavefront (Scene * scene, Camera * cam, const RenderSettings * settings);
+
+#endif
\ No newline at end of file
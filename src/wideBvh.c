@@ -0,0 +1,316 @@
+#include "wideBvh.h"
+#include "timer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WIDE_BVH_X86
+#include <immintrin.h>
+#endif
+
+// widens the far distance by 2 * gamma(3) so float rounding in the slab test never rejects a real hit
+#define WIDE_BVH_FAR_SCALE 1.0000004f
+
+/* wide bvh
+ * the binary tree is collapsed by repeatedly opening the child with the largest surface area
+ * until a node has `width` children. the box test then checks all children of a node at once:
+ * eight lanes per AVX2 instruction, four per SSE instruction, or a plain loop elsewhere.
+ * the kernel is picked at runtime, so one binary runs on every x86 node and builds anywhere. */
+
+typedef struct {
+    const BVHNode * binaryNodes;
+    WideBVHNode * nodes;
+    int numNodes;
+    int width;
+} WideBuilder;
+
+SimdLevel detectSimdLevel () {
+#ifdef WIDE_BVH_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports ("sse2")) return SIMD_SSE;
+#endif
+    return SIMD_SCALAR;
+}
+
+const char * getSimdLevelName (SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX2: return "avx2";
+        case SIMD_SSE: return "sse";
+        case SIMD_SCALAR: return "scalar";
+        default: return "unknown";
+    }
+}
+
+bool parseSimdLevelName (const char * name, SimdLevel * level) {
+    if (strcmp (name, "avx2") == 0) {
+        *level = SIMD_AVX2;
+    } else if (strcmp (name, "sse") == 0) {
+        *level = SIMD_SSE;
+    } else if (strcmp (name, "scalar") == 0) {
+        *level = SIMD_SCALAR;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static double getBinaryNodeArea (const BVHNode * node) {
+    double x = node->max[0] - node->min[0];
+    double y = node->max[1] - node->min[1];
+    double z = node->max[2] - node->min[2];
+    return 2.0 * (x * y + y * z + z * x);
+}
+
+static int collapseNode (WideBuilder * builder, int binaryIndex) {
+    int wideIndex = builder->numNodes ++;
+    const BVHNode * binaryNodes = builder->binaryNodes;
+
+    int children[WIDE_BVH_LANES];
+    int count = 0;
+    if (binaryNodes[binaryIndex].numPrimitives > 0) {
+        children[count ++] = binaryIndex;
+    } else {
+        children[count ++] = binaryIndex + 1;
+        children[count ++] = binaryNodes[binaryIndex].offset;
+    }
+
+    while (count < builder->width) {
+        int largest = -1;
+        double largestArea = -1;
+        for (int i = 0; i < count; ++ i) {
+            const BVHNode * child = &binaryNodes[children[i]];
+            if (child->numPrimitives == 0 && getBinaryNodeArea (child) > largestArea) {
+                largestArea = getBinaryNodeArea (child);
+                largest = i;
+            }
+        }
+        if (largest < 0) break;
+
+        int opened = children[largest];
+        children[largest] = opened + 1;
+        children[count ++] = binaryNodes[opened].offset;
+    }
+
+    WideBVHNode * node = &builder->nodes[wideIndex];
+    memset (node, 0, sizeof(WideBVHNode));
+    node->numChildren = count;
+
+    for (int lane = 0; lane < WIDE_BVH_LANES; ++ lane) {
+        if (lane >= count) {
+            //an inverted box fails the slab test in every kernel
+            node->minX[lane] = node->minY[lane] = node->minZ[lane] = INFINITY;
+            node->maxX[lane] = node->maxY[lane] = node->maxZ[lane] = -INFINITY;
+            node->offset[lane] = -1;
+            continue;
+        }
+
+        const BVHNode * child = &binaryNodes[children[lane]];
+        node->minX[lane] = child->min[0];
+        node->minY[lane] = child->min[1];
+        node->minZ[lane] = child->min[2];
+        node->maxX[lane] = child->max[0];
+        node->maxY[lane] = child->max[1];
+        node->maxZ[lane] = child->max[2];
+        node->numPrimitives[lane] = child->numPrimitives;
+        node->offset[lane] = child->offset;
+    }
+
+    //recursion appends to the preallocated array, so the node is re-fetched by index
+    for (int lane = 0; lane < count; ++ lane) {
+        if (binaryNodes[children[lane]].numPrimitives == 0) {
+            int childIndex = collapseNode (builder, children[lane]);
+            builder->nodes[wideIndex].offset[lane] = childIndex;
+        }
+    }
+
+    return wideIndex;
+}
+
+void resolveWideBVHLayout (const BVHBuildSettings * settings, SimdLevel * level, int * width) {
+    *level = settings->simdLevel >= 0 ? (SimdLevel) settings->simdLevel : detectSimdLevel ();
+    if (*level > detectSimdLevel ()) *level = detectSimdLevel ();
+
+    *width = settings->wideWidth;
+    if (*width != 4 && *width != 8) {
+        //eight lanes fill one AVX2 register, four fill one SSE register
+        *width = (*level == SIMD_AVX2) ? 8 : 4;
+    }
+}
+
+bool createWideBVH (Scene * scene) {
+    double start = getTimeSeconds ();
+
+    //a rebuild leaves the old nodes to the scene's arena
+    scene->wideBVHNodes = NULL;
+    scene->numWideBVHNodes = 0;
+
+    SimdLevel level;
+    int width;
+    resolveWideBVHLayout (&scene->bvhSettings, &level, &width);
+    scene->simdLevel = level;
+    scene->wideBVHWidth = width;
+
+    if (scene->numBVHNodes == 0) return true;
+
+    //every wide node consumes at least one binary interior node (or the root leaf). the array is the
+    //arena's newest allocation, and gives the pages it didn't need back when it shrinks
+    WideBuilder builder;
+    builder.binaryNodes = scene->bvhNodes;
+    builder.width = width;
+    builder.numNodes = 0;
+    builder.nodes = arenaAlloc (&scene->arena, MEMORY_WIDE_BVH, scene->numBVHNodes * sizeof(WideBVHNode));
+    if (builder.nodes == NULL) {
+        fprintf (stderr, "Out of memory building the wide BVH over %d nodes\n", scene->numBVHNodes);
+        return false;
+    }
+
+    collapseNode (&builder, 0);
+
+    scene->wideBVHNodes = arenaResize (&scene->arena, MEMORY_WIDE_BVH, builder.nodes,
+                                       scene->numBVHNodes * sizeof(WideBVHNode), builder.numNodes * sizeof(WideBVHNode));
+    scene->numWideBVHNodes = builder.numNodes;
+    scene->wideBVHBuildTime = getTimeSeconds () - start;
+    return true;
+}
+
+void printWideBVHStats (Scene * scene) {
+    long long children = 0;
+    for (int i = 0; i < scene->numWideBVHNodes; ++ i) {
+        children += scene->wideBVHNodes[i].numChildren;
+    }
+
+    fprintf (stderr, "Wide BVH: %d-wide, %d nodes (%.1f KB), %.2f children per node, %s box test, collapsed in %.3f ms\n",
+             scene->wideBVHWidth, scene->numWideBVHNodes, scene->numWideBVHNodes * sizeof(WideBVHNode) / 1024.0,
+             scene->numWideBVHNodes ? (double) children / scene->numWideBVHNodes : 0.0,
+             getSimdLevelName (scene->simdLevel), scene->wideBVHBuildTime * 1000.0);
+}
+
+WideRay createWideRay (Point origin, Vector direction) {
+    WideRay ray;
+    double components[3] = {direction.x, direction.y, direction.z};
+    ray.origin[0] = (float) origin.x;
+    ray.origin[1] = (float) origin.y;
+    ray.origin[2] = (float) origin.z;
+
+    for (int axis = 0; axis < 3; ++ axis) {
+        //a finite stand-in for 1/0 keeps (plane - origin) * inverse from turning into 0 * inf = NaN
+        double inverse = (fabs (components[axis]) > 1e-30) ? 1.0 / components[axis] : copysign (1e30, components[axis]);
+        ray.inverseDirection[axis] = (float) inverse;
+        ray.directionIsNegative[axis] = inverse < 0;
+    }
+    return ray;
+}
+
+static int testWideNodeScalar (const WideBVHNode * node, const WideRay * ray, int width, float maxDist, float * tNear) {
+    const float * nearX = ray->directionIsNegative[0] ? node->maxX : node->minX;
+    const float * farX = ray->directionIsNegative[0] ? node->minX : node->maxX;
+    const float * nearY = ray->directionIsNegative[1] ? node->maxY : node->minY;
+    const float * farY = ray->directionIsNegative[1] ? node->minY : node->maxY;
+    const float * nearZ = ray->directionIsNegative[2] ? node->maxZ : node->minZ;
+    const float * farZ = ray->directionIsNegative[2] ? node->minZ : node->maxZ;
+
+    int mask = 0;
+    for (int lane = 0; lane < width; ++ lane) {
+        float close = (nearX[lane] - ray->origin[0]) * ray->inverseDirection[0];
+        float far = (farX[lane] - ray->origin[0]) * ray->inverseDirection[0];
+        float t;
+
+        t = (nearY[lane] - ray->origin[1]) * ray->inverseDirection[1];
+        if (t > close) close = t;
+        t = (farY[lane] - ray->origin[1]) * ray->inverseDirection[1];
+        if (t < far) far = t;
+
+        t = (nearZ[lane] - ray->origin[2]) * ray->inverseDirection[2];
+        if (t > close) close = t;
+        t = (farZ[lane] - ray->origin[2]) * ray->inverseDirection[2];
+        if (t < far) far = t;
+
+        if (close < (float) RAY_EPSILON) close = (float) RAY_EPSILON;
+        far *= WIDE_BVH_FAR_SCALE;
+        if (far > maxDist) far = maxDist;
+
+        tNear[lane] = close;
+        if (close <= far) mask |= 1 << lane;
+    }
+    return mask;
+}
+
+#ifdef WIDE_BVH_X86
+__attribute__((target("sse2")))
+static int testWideNodeSSE (const WideBVHNode * node, const WideRay * ray, int width, float maxDist, float * tNear) {
+    const float * nearX = ray->directionIsNegative[0] ? node->maxX : node->minX;
+    const float * farX = ray->directionIsNegative[0] ? node->minX : node->maxX;
+    const float * nearY = ray->directionIsNegative[1] ? node->maxY : node->minY;
+    const float * farY = ray->directionIsNegative[1] ? node->minY : node->maxY;
+    const float * nearZ = ray->directionIsNegative[2] ? node->maxZ : node->minZ;
+    const float * farZ = ray->directionIsNegative[2] ? node->minZ : node->maxZ;
+
+    __m128 originX = _mm_set1_ps (ray->origin[0]);
+    __m128 originY = _mm_set1_ps (ray->origin[1]);
+    __m128 originZ = _mm_set1_ps (ray->origin[2]);
+    __m128 inverseX = _mm_set1_ps (ray->inverseDirection[0]);
+    __m128 inverseY = _mm_set1_ps (ray->inverseDirection[1]);
+    __m128 inverseZ = _mm_set1_ps (ray->inverseDirection[2]);
+    __m128 minimum = _mm_set1_ps ((float) RAY_EPSILON);
+    __m128 maximum = _mm_set1_ps (maxDist);
+    __m128 farScale = _mm_set1_ps (WIDE_BVH_FAR_SCALE);
+
+    int mask = 0;
+    for (int lane = 0; lane < width; lane += 4) {
+        __m128 close = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (nearX + lane), originX), inverseX);
+        close = _mm_max_ps (close, _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (nearY + lane), originY), inverseY));
+        close = _mm_max_ps (close, _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (nearZ + lane), originZ), inverseZ));
+        close = _mm_max_ps (close, minimum);
+
+        __m128 far = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (farX + lane), originX), inverseX);
+        far = _mm_min_ps (far, _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (farY + lane), originY), inverseY));
+        far = _mm_min_ps (far, _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (farZ + lane), originZ), inverseZ));
+        far = _mm_min_ps (_mm_mul_ps (far, farScale), maximum);
+
+        _mm_storeu_ps (tNear + lane, close);
+        mask |= _mm_movemask_ps (_mm_cmple_ps (close, far)) << lane;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static int testWideNodeAVX2 (const WideBVHNode * node, const WideRay * ray, float maxDist, float * tNear) {
+    const float * nearX = ray->directionIsNegative[0] ? node->maxX : node->minX;
+    const float * farX = ray->directionIsNegative[0] ? node->minX : node->maxX;
+    const float * nearY = ray->directionIsNegative[1] ? node->maxY : node->minY;
+    const float * farY = ray->directionIsNegative[1] ? node->minY : node->maxY;
+    const float * nearZ = ray->directionIsNegative[2] ? node->maxZ : node->minZ;
+    const float * farZ = ray->directionIsNegative[2] ? node->minZ : node->maxZ;
+
+    __m256 originX = _mm256_set1_ps (ray->origin[0]);
+    __m256 originY = _mm256_set1_ps (ray->origin[1]);
+    __m256 originZ = _mm256_set1_ps (ray->origin[2]);
+    __m256 inverseX = _mm256_set1_ps (ray->inverseDirection[0]);
+    __m256 inverseY = _mm256_set1_ps (ray->inverseDirection[1]);
+    __m256 inverseZ = _mm256_set1_ps (ray->inverseDirection[2]);
+
+    __m256 close = _mm256_mul_ps (_mm256_sub_ps (_mm256_loadu_ps (nearX), originX), inverseX);
+    close = _mm256_max_ps (close, _mm256_mul_ps (_mm256_sub_ps (_mm256_loadu_ps (nearY), originY), inverseY));
+    close = _mm256_max_ps (close, _mm256_mul_ps (_mm256_sub_ps (_mm256_loadu_ps (nearZ), originZ), inverseZ));
+    close = _mm256_max_ps (close, _mm256_set1_ps ((float) RAY_EPSILON));
+
+    __m256 far = _mm256_mul_ps (_mm256_sub_ps (_mm256_loadu_ps (farX), originX), inverseX);
+    far = _mm256_min_ps (far, _mm256_mul_ps (_mm256_sub_ps (_mm256_loadu_ps (farY), originY), inverseY));
+    far = _mm256_min_ps (far, _mm256_mul_ps (_mm256_sub_ps (_mm256_loadu_ps (farZ), originZ), inverseZ));
+    far = _mm256_min_ps (_mm256_mul_ps (far, _mm256_set1_ps (WIDE_BVH_FAR_SCALE)), _mm256_set1_ps (maxDist));
+
+    _mm256_storeu_ps (tNear, close);
+    return _mm256_movemask_ps (_mm256_cmp_ps (close, far, _CMP_LE_OQ));
+}
+#endif
+
+int testWideNode (const WideBVHNode * node, const WideRay * ray, int width, SimdLevel level, float maxDist, float * tNear) {
+#ifdef WIDE_BVH_X86
+    if (level == SIMD_AVX2 && width == 8) return testWideNodeAVX2 (node, ray, maxDist, tNear);
+    if (level >= SIMD_SSE) return testWideNodeSSE (node, ray, width, maxDist, tNear);
+#endif
+    return testWideNodeScalar (node, ray, width, maxDist, tNear);
+}
\ No newline at end of file
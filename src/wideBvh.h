@@ -0,0 +1,46 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "bvh.h"
+
+#define WIDE_BVH_LANES 8
+#define WIDE_BVH_STACK_SIZE (BVH_TREE_DEPTH * (WIDE_BVH_LANES - 1) + 1) // every level pushes at most all but one child
+
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE,
+    SIMD_AVX2
+} SimdLevel;
+
+// one node holds up to 8 children with their bounds stored as structure of arrays
+struct _WideBVHNode {
+    float minX[WIDE_BVH_LANES];
+    float minY[WIDE_BVH_LANES];
+    float minZ[WIDE_BVH_LANES];
+    float maxX[WIDE_BVH_LANES];
+    float maxY[WIDE_BVH_LANES];
+    float maxZ[WIDE_BVH_LANES];
+    int offset[WIDE_BVH_LANES];                   // child node, or first bvhPrimitives entry for leaf lanes
+    unsigned short numPrimitives[WIDE_BVH_LANES]; // 0 for interior and empty lanes
+    int numChildren;
+    int padding[3];
+};
+
+typedef struct {
+    float origin[3];
+    float inverseDirection[3];
+    int directionIsNegative[3];
+} WideRay;
+
+SimdLevel detectSimdLevel ();
+const char * getSimdLevelName (SimdLevel level);
+bool parseSimdLevelName (const char * name, SimdLevel * level);
+
+void resolveWideBVHLayout (const BVHBuildSettings * settings, SimdLevel * level, int * width); // what createWideBVH will pick on this machine
+bool createWideBVH (Scene * scene); // false, with no wide BVH, when out of memory
+void printWideBVHStats (Scene * scene);
+
+WideRay createWideRay (Point origin, Vector direction);
+int testWideNode (const WideBVHNode * node, const WideRay * ray, int width, SimdLevel level, float maxDist, float * tNear);
+
+#endif
\ No newline at end of file